@@ -1,13 +1,43 @@
 #ifndef CTM_FIXED_ALLOCATOR_H
 #define CTM_FIXED_ALLOCATOR_H
 
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <deque>
 #include <vector>
-#include <map>
+#include <thread>
+#include "SmallObjAllocator\SOA_defaults.h"
+#include "SmallObjAllocator\SOA_memory.h"
 #include "SmallObjAllocator\Chunk.h"
+#include "SmallObjAllocator\BitmapChunk.h"
+#include "SmallObjAllocator\PageProvider.h"
+#include "SmallObjAllocator\PageMap.h"
+#include "SmallObjAllocator\OwnerScope.h"
+#include "SmallObjAllocator\RetentionPolicy.h"
+#include "SmallObjAllocator\AllocatorStats.h"
 
 namespace soa {
 
+	/// How CtmFixedAllocator finds the owning chunk of a pointer on deallocation
+	/// - Map:     the PageMap entry of the page holds the owning ChunkNode*
+	///            as chunk tag. O(1), two dependent loads.
+	///            (Originally a std::map keyed by chunk base address, O(log n).)
+	/// - Aligned: chunk storage aligned to its own (power of two) size, the
+	///            owning Chunk* sits in a trailer at the end of the storage and
+	///            is found by masking the pointer. O(1), no PageMap load.
+
+	enum class CtmChunkLookup {
+		Map,
+		Aligned
+	};
+
+#ifdef SOA_CTM_ALIGNED_CHUNKS
+	constexpr CtmChunkLookup DEFAULT_CTM_CHUNK_LOOKUP = CtmChunkLookup::Aligned;
+#else
+	constexpr CtmChunkLookup DEFAULT_CTM_CHUNK_LOOKUP = CtmChunkLookup::Map;
+#endif
+
 	/// CtmFixedAllocator is a slightly modified version of 
 	/// Alexandrescus FixedAllocator, designed to improve the speed 
 	/// of allocation and deallocation, especially in butterfly 
@@ -24,57 +54,216 @@ namespace soa {
 	///   deques typically have large minimal memory cost.
 	/// (For more see:https://en.cppreference.com/w/cpp/container/deque.html).
 	/// 
-	/// Using std::deque in this context allows the allocator to safely use 
-	/// an std::map for faster lookup of the appropriate chunk during deallocation,
-	/// while avoiding pointer invalidation.
+	/// Using std::deque in this context allows the allocator to safely store
+	/// the address of a chunk (PageMap tag, storage trailer) for the lookup
+	/// of the appropriate chunk during deallocation, while avoiding pointer
+	/// invalidation.
 	/// 
 	/// A separate std::vector is also maintained to cache empty chunks,
 	/// and trying to speed up newer allocations.
 	/// 
-	/// Additionally, the m_numFullBlocks member tracks how many chunks 
-	/// are completely full, allowing the allocator to skip unnecessary searches 
-	/// for available chunks, unlike the original Alexandrescu implementation.
+	/// Partially filled chunks (but allocChunk) are kept on intrusive lists,
+	/// one per occupancy bucket (used blocks / blocks, NUM_PARTIAL_BUCKETS
+	/// steps). A bit mask tells the non empty buckets apart.
+	/// When allocChunk is full the next one is, in O(1):
+	/// - the head of the fullest bucket: allocations go to chunks that are
+	///   already busy, the nearly empty ones can drain and be released;
+	/// - else an empty chunk of m_freeChunks;
+	/// - else a new chunk.
+	/// A deallocation moves its chunk to another bucket only when the
+	/// occupancy crosses a bucket boundary.
+	/// How many of them are kept is set by the RetentionPolicy: the storage of
+	/// the others goes back to the provider. Their Chunk stays in the deque
+	/// (it can't be erased from the middle) in m_releasedChunks, and it is
+	/// reused by the next NewChunk.
 	/// 
 	/// This approach trades some space for potential gains 
 	/// in allocation and deallocation speed.
+	/// 
+	/// Owner thread model:
+	/// - The thread that builds the allocator owns it: only the owner
+	///   allocates and touches chunks and caches.
+	/// - A thread inside a SerializedOwnerScope (ThreadCache, the preload
+	///   shim: every call under one lock) acts as owner as well, so a size
+	///   class created lazily by a worker keeps working after it exits.
+	/// - A Deallocate from any other thread doesn't touch that state, it
+	///   pushes the block on a lock-free MPSC list (m_remoteFrees), using the
+	///   block itself as list node (so blockSize must be >= sizeof(void*)).
+	/// - The owner takes the whole list with a single exchange and gives the
+	///   blocks back to their chunks on its next call (Allocate, Deallocate,
+	///   batches, Trim...): a pending list costs one relaxed load to notice.
+	/// This way producer/consumer pipelines never take a lock and never 
+	/// bounce the chunk metadata between cores.
+	/// 
+	/// With CtmChunkLookup::Aligned blocks find their chunk through the
+	/// storage trailer, the PageMap only gives their size class.
+	/// 
+	/// SOA_HARDENED (see Hardened.h): blocks are spaced by their redzone,
+	/// Deallocate checks the PageMap on the calling thread, before the
+	/// owner/remote split. The owner checks that the chunk found is one of
+	/// its own and holds the block: blocks of another allocator of the same
+	/// size class are caught too.
+	/// 
+	/// Chunk storage comes from a PageProvider (DefaultPageProvider() if none
+	/// is given), that must outlive the allocator.
+	/// It is registered in the PageMap while the chunk holds it.
 
-	class CtmFixedAllocator {
+	/// 
+	/// ChunkT sets the chunk engine and its max blocks (see BasicChunk, BasicBitmapChunk).
+	/// Explicitly instantiated for Chunk8, Chunk16, Chunk32 and BitmapChunk.
+
+	template<typename ChunkT>
+	class BasicCtmFixedAllocator {
 
 	private:
 
-		std::size_t m_blockSize{};
-		unsigned char m_numBlocks{};
-		std::size_t m_numFullChunks{};
+		using IndexT = typename ChunkT::index_type;
+
+		static constexpr std::size_t NUM_PARTIAL_BUCKETS = 8;
+		static constexpr std::uint8_t NO_BUCKET = 0xFF;
+
+		// a chunk of the deque, with its links in the partial lists
+		struct ChunkNode : ChunkT {
+			ChunkNode* m_prevPartial{};
+			ChunkNode* m_nextPartial{};
+			std::uint8_t m_bucket = NO_BUCKET; // NO_BUCKET: not on a list
+#ifdef SOA_HARDENED
+			const BasicCtmFixedAllocator* m_allocator{}; // holding the chunk, checked by FindChunk
+#endif
+		};
+
+		std::size_t m_blockSize{}; // stride: GetBlockSize() + DEFAULT_REDZONE_SIZE
+		IndexT m_numBlocks{};
+		std::uint64_t m_bucketScale{}; // used blocks * scale >> 32 = bucket
+
+		CtmChunkLookup m_lookup{};
+		std::size_t m_chunkAlignment{}; // storage alignment, aligned mode: also its size
+		std::size_t m_chunkBytes{};     // storage size of a chunk
+		PageProvider* m_provider{};
+
+		std::deque<ChunkNode, MallocAllocator<ChunkNode>> m_chunks{};
+		std::vector<ChunkNode*, MallocAllocator<ChunkNode*>> m_freeChunks;
+		std::vector<ChunkNode*, MallocAllocator<ChunkNode*>> m_releasedChunks; // no storage, on no list
+
+		ChunkNode* m_partial[NUM_PARTIAL_BUCKETS]{};
+		std::uint32_t m_partialMask{}; // bit b set: m_partial[b] not empty
 
-		std::deque<Chunk> m_chunks{};
-		std::map<std::uintptr_t, Chunk*> m_chunkMap{};
-		std::vector<Chunk*> m_freeChunks;
+		RetentionPolicy m_retention{};
+		std::chrono::steady_clock::time_point m_emptySince{}; // when m_freeChunks went above the low watermark, {} when not above
 
-		Chunk* m_allocChunk = nullptr;
-		Chunk* m_deallocChunk = nullptr;
+		ChunkNode* m_allocChunk = nullptr;
+		ChunkNode* m_deallocChunk = nullptr;
+
+		std::thread::id m_owner{};
+		std::atomic<void*> m_remoteFrees{};
+
+		FixedAllocatorStats m_stats{}; // written by the owner only
+
+		// allocChunk with no live block is empty for the stats, as in
+		// FixedAllocator, but not for the RetentionPolicy: it can't be released
+		void PublishChunks()
+		{
+			const bool emptyAllocChunk = m_allocChunk && m_allocChunk->m_blocksAvailable == m_numBlocks;
+
+			m_stats.SetChunks(m_chunks.size() - m_releasedChunks.size(), m_freeChunks.size() + emptyAllocChunk);
+			StampEmptySince(m_freeChunks.size());
+		}
+
+		// every change of the empty chunks ends in PublishChunks: m_emptySince
+		// is stamped when they go above the low watermark, whatever the path
+		// (Reset, batches...), and cleared when they are back to it or below
+		void StampEmptySince(std::size_t numEmpty)
+		{
+			const bool above = numEmpty > m_retention.m_lowWatermark;
+			if (above == (m_emptySince != std::chrono::steady_clock::time_point{})) return;
+
+			m_emptySince = above ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point{};
+		}
+
+		ChunkNode* NewChunk();
+		void   ReleaseChunk(ChunkNode& chunk);
+		ChunkNode* FindChunk(void* p) const;
 
 		void DoDeallocate(void* p);
+		void RequeueDeallocChunk();
+		void LinkPartial(ChunkNode* chunk);
+		void UnlinkPartial(ChunkNode* chunk);
+		bool MustRelease();
+		std::size_t ReleaseEmptyChunks(std::size_t keep);
+		void OwnerDeallocate(void* p);
+		void OwnerDeallocateBatch(std::size_t n, void** in);
+		void RemoteDeallocate(void* p) noexcept;
+		void RemoteDeallocateBatch(std::size_t n, void** in) noexcept;
+		void DrainRemoteFrees();
+
+		// entry of every owner side call
+		void DrainPendingRemoteFrees()
+		{
+			if (m_remoteFrees.load(std::memory_order_relaxed)) [[unlikely]]
+				DrainRemoteFrees();
+		}
+		void ClearLists();
+
+		bool ChunkContains(const ChunkT& chunk, const void* p) const
+		{
+			return p >= chunk.m_pData && p < chunk.m_pData + m_numBlocks * m_blockSize;
+		}
 
 	public:
 
-		explicit CtmFixedAllocator(std::size_t blockSize = 0);
-		~CtmFixedAllocator();
+		explicit BasicCtmFixedAllocator(std::size_t blockSize = 0,
+			std::size_t chunkSize = DEFAULT_CHUNK_SIZE,
+			CtmChunkLookup lookup = DEFAULT_CTM_CHUNK_LOOKUP,
+			PageProvider* provider = nullptr,
+			const RetentionPolicy& retention = RetentionPolicy());
+		~BasicCtmFixedAllocator();
 
 		// avoid copies
-		CtmFixedAllocator(const CtmFixedAllocator&) = delete;
-		CtmFixedAllocator& operator=(const CtmFixedAllocator&) = delete;
+		BasicCtmFixedAllocator(const BasicCtmFixedAllocator&) = delete;
+		BasicCtmFixedAllocator& operator=(const BasicCtmFixedAllocator&) = delete;
 
 		// move operations
-		CtmFixedAllocator(CtmFixedAllocator&&)  noexcept;
-		CtmFixedAllocator& operator=(CtmFixedAllocator&&)  noexcept;
+		BasicCtmFixedAllocator(BasicCtmFixedAllocator&&)  noexcept;
+		BasicCtmFixedAllocator& operator=(BasicCtmFixedAllocator&&)  noexcept;
 
-		//void Swap(CtmFixedAllocator& rhs);
+		//void Swap(BasicCtmFixedAllocator& rhs);
 
 		void* Allocate();
 		void  Deallocate(void* p);
-		inline std::size_t GetBlockSize() const { return m_blockSize; }
+
+		// n blocks at once, DeallocateBatch follows the same owner/remote rules
+		std::size_t AllocateBatch(std::size_t n, void** out);
+		void DeallocateBatch(std::size_t n, void** in);
+
+		// owner side only (see IsOwnerThread): gives back the remote frees,
+		// then frees the empty chunks beyond keep. Returns how many
+		std::size_t Trim(std::size_t keep = 0);
+		void SetRetentionPolicy(const RetentionPolicy& retention);
+
+		// owner side only, live blocks (and pending remote frees) become
+		// invalid. Reset: every chunk is empty again, kept up to the high
+		// watermark. Release: every chunk storage is freed, returns how many
+		void Reset();
+		std::size_t Release();
+
+		inline std::size_t GetBlockSize() const { return m_blockSize - DEFAULT_REDZONE_SIZE; }
+		inline std::size_t GetNumEmptyChunks() const { return m_freeChunks.size(); }
+
+		// any thread. Remote frees count once the owner has drained them,
+		// empty chunks are the ones of GetNumEmptyChunks, plus allocChunk
+		// when it has no live block
+		SizeClassStats GetStats() const { return m_stats.Read(GetBlockSize(), m_chunkBytes); }
+
+		// the owner thread, or any thread inside a SerializedOwnerScope
+		inline bool IsOwnerThread() const
+		{
+			return SerializedOwnerScope::Active() || std::this_thread::get_id() == m_owner;
+		}
 	};
 
+	using CtmFixedAllocator = BasicCtmFixedAllocator<Chunk>;
+	using BitmapCtmFixedAllocator = BasicCtmFixedAllocator<BitmapChunk>;
+
 }
 
 #endif //! CTM_FIXED_ALLOCATOR_H
\ No newline at end of file
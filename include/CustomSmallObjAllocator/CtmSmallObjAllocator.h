@@ -1,15 +1,30 @@
 #ifndef CUSTOM_SMALL_OBJ_ALLOC_H
 #define CUSTOM_SMALL_OBJ_ALLOC_H
 
+#include <atomic>
+#include <deque>
 #include <vector>
 #include "SmallObjAllocator\SOA_defaults.h"
+#include "SmallObjAllocator\SOA_memory.h"
 #include "CtmFixedAllocator.h"
 
 namespace soa {
 
+	/// CtmSmallObjAllocator
+	/// 
+	/// Same structure of SmallObjAllocator, built on CtmFixedAllocator.
+	/// - Size classes are multiples of DEFAULT_SIZE_GRANULARITY, dispatched in
+	///   constant time through m_table.
+	/// - CtmFixedAllocators are created lazily in a std::deque and never move:
+	///   a table entry is written once, before any block of its class exists,
+	///   so threads freeing remotely can read it safely.
+
 	class CtmSmallObjAllocator {
 	public:
-		CtmSmallObjAllocator(std::size_t chunkSize, std::size_t maxObjectSize);
+		CtmSmallObjAllocator(std::size_t chunkSize, std::size_t maxObjectSize,
+			CtmChunkLookup lookup = DEFAULT_CTM_CHUNK_LOOKUP,
+			PageProvider* provider = nullptr,
+			const RetentionPolicy& retention = RetentionPolicy());
 
 		static CtmSmallObjAllocator& Instance() noexcept
 		{
@@ -20,18 +35,63 @@ namespace soa {
 		void* Allocate(std::size_t numBytes);
 		void  Deallocate(void* p, std::size_t size);
 
+		// without the size: size class and chunk come from the PageMap, pointers
+		// that are not in any chunk are malloc fallbacks
+		void  Deallocate(void* p);
+
+		// alignment: power of two, same values on Allocate and Deallocate
+		void* Allocate(std::size_t numBytes, std::size_t alignment);
+		void  Deallocate(void* p, std::size_t size, std::size_t alignment);
+
+		// fixed allocator of the size class of numBytes (<= maxObjectSize),
+		// created on first use. Valid as long as the allocator: a size known
+		// at compile time is looked up once, see SOABackend::AllocateNode
+		CtmFixedAllocator& GetFixedAllocator(std::size_t numBytes);
+
+		// n objects of the same size at once
+		std::size_t AllocateBatch(std::size_t numBytes, std::size_t n, void** out);
+		void DeallocateBatch(std::size_t numBytes, std::size_t n, void** in);
+
+		// frees every empty chunk, then decommits the released storage
+		// of the provider. Returns how many chunks were freed.
+		// The calling thread must own every size class (or be in a
+		// SerializedOwnerScope, see ThreadCache::SerializedLock)
+		std::size_t Trim();
+		// arena use: every block of every size class is freed at once,
+		// no per-object Deallocate. Requests bigger than maxObjectSize
+		// are not tracked, they still need their own Deallocate.
+		// Reset keeps the chunks up to the high watermark of the
+		// RetentionPolicy, Release frees all of them (returns how many).
+		// The calling thread must own every size class (or be in a
+		// SerializedOwnerScope, see ThreadCache::SerializedLock)
+		void Reset();
+		std::size_t Release();
+
+		// size classes created later get it as well. Same rule of Trim:
+		// a size class can also be created concurrently by a worker only
+		// under ThreadCache::SerializedLock
+		void SetRetentionPolicy(const RetentionPolicy& retention);
+
+		// per size class counters, callable from any thread while the
+		// allocator is in use (relaxed reads, see FixedAllocatorStats)
+		AllocatorSnapshot Snapshot() const;
+
 	private:
 		CtmSmallObjAllocator(const CtmSmallObjAllocator& i_other) = delete;
 		CtmSmallObjAllocator& operator=(const CtmSmallObjAllocator& i_other) = delete;
 		CtmSmallObjAllocator(const CtmSmallObjAllocator&& i_other) = delete;
 		CtmSmallObjAllocator& operator=(const CtmSmallObjAllocator&& i_other) = delete;
 
-		std::vector<CtmFixedAllocator> m_Pool{};
-		CtmFixedAllocator* m_pLastAlloc{};
-		CtmFixedAllocator* m_pLastDealloc{};
+		CtmFixedAllocator& CreateFixedAllocator(std::size_t index);
+
+		std::deque<CtmFixedAllocator, MallocAllocator<CtmFixedAllocator>> m_Pool{};
+		std::vector<std::atomic<CtmFixedAllocator*>, MallocAllocator<std::atomic<CtmFixedAllocator*>>> m_table{};
 
 		std::size_t m_chunkSize{};
 		std::size_t m_maxObjSize{};
+		CtmChunkLookup m_lookup{};
+		PageProvider* m_provider{};
+		RetentionPolicy m_retention{};
 	};
 }
 
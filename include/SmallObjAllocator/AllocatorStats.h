@@ -0,0 +1,145 @@
+#ifndef ALLOCATOR_STATS_H
+#define ALLOCATOR_STATS_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace soa {
+
+	/// Statistics of one size class (of one fixed allocator)
+
+	struct SizeClassStats {
+		std::size_t m_blockSize{};
+		std::size_t m_allocations{};    // blocks handed out since construction
+		std::size_t m_frees{};          // blocks given back, Reset/Release drop the live ones
+		std::size_t m_liveBlocks{};
+		std::size_t m_peakLiveBlocks{};
+		std::size_t m_chunks{};         // chunks holding storage
+		std::size_t m_emptyChunks{};
+		std::size_t m_bytesReserved{};  // storage of the chunks, not the released one (see AllocatorSnapshot)
+		std::size_t m_bytesInUse{};     // live blocks * block size
+	};
+
+	/// Snapshot of a small object allocator: the size classes created so
+	/// far, by increasing block size, and their sum (m_blockSize is 0).
+	/// Reserved bytes not in use are the fragmentation of the size class.
+	/// Storage of released chunks is not counted: it belongs to the provider,
+	/// that may keep some of it committed for reuse (up to the cache bound
+	/// of VirtualPageProvider, see GetCommittedFreeBytes) until Trim().
+
+	struct AllocatorSnapshot {
+		std::vector<SizeClassStats> m_sizeClasses;
+		SizeClassStats m_total{};
+	};
+
+	/// FixedAllocatorStats
+	///
+	/// Always-on counters of a fixed allocator.
+	/// - Written by the one thread allowed to touch the allocator (the owner
+	///   of a CtmFixedAllocator): relaxed load + store, no locked instruction
+	///   and no fence on the allocation path.
+	/// - Read from any thread at any time (Snapshot under load). Every value
+	///   is one the writer stored, the set is not a consistent cut.
+	/// - m_frees is the one ordered counter: stored with release, read first
+	///   with acquire, so the allocations read after it include every one
+	///   freed by then and live blocks never go negative. A plain store on
+	///   x86, no fence on the free path either.
+	/// - Chunk counts are published by the allocator when they change.
+
+	class FixedAllocatorStats {
+	public:
+		FixedAllocatorStats() = default;
+		FixedAllocatorStats(const FixedAllocatorStats& other) noexcept { CopyFrom(other); }
+		FixedAllocatorStats& operator=(const FixedAllocatorStats& other) noexcept { CopyFrom(other); return *this; }
+
+		void OnAllocate(std::size_t n = 1) noexcept
+		{
+			const std::size_t allocations = Load(m_allocations) + n;
+			Store(m_allocations, allocations);
+
+			const std::size_t live = allocations - Load(m_frees);
+			if (live > Load(m_peakLive)) Store(m_peakLive, live);
+		}
+
+		void OnFree(std::size_t n = 1) noexcept { m_frees.store(Load(m_frees) + n, std::memory_order_release); }
+
+		// every live block dropped at once (Reset, Release)
+		void OnFreeAll() noexcept { m_frees.store(Load(m_allocations), std::memory_order_release); }
+
+		void SetChunks(std::size_t chunks, std::size_t emptyChunks) noexcept
+		{
+			Store(m_chunks, chunks);
+			Store(m_emptyChunks, emptyChunks);
+		}
+
+		SizeClassStats Read(std::size_t blockSize, std::size_t chunkBytes) const noexcept
+		{
+			SizeClassStats stats;
+			stats.m_blockSize = blockSize;
+			stats.m_frees = m_frees.load(std::memory_order_acquire);
+			stats.m_allocations = Load(m_allocations);
+			stats.m_liveBlocks = stats.m_allocations - stats.m_frees;
+			stats.m_peakLiveBlocks = Load(m_peakLive);
+			stats.m_chunks = Load(m_chunks);
+			stats.m_emptyChunks = Load(m_emptyChunks);
+			stats.m_bytesReserved = stats.m_chunks * chunkBytes;
+			stats.m_bytesInUse = stats.m_liveBlocks * blockSize;
+			return stats;
+		}
+
+		void Swap(FixedAllocatorStats& rhs) noexcept
+		{
+			FixedAllocatorStats tmp(rhs);
+			rhs = *this;
+			*this = tmp;
+		}
+
+	private:
+		static std::size_t Load(const std::atomic<std::size_t>& counter) noexcept
+		{
+			return counter.load(std::memory_order_relaxed);
+		}
+
+		static void Store(std::atomic<std::size_t>& counter, std::size_t value) noexcept
+		{
+			counter.store(value, std::memory_order_relaxed);
+		}
+
+		void CopyFrom(const FixedAllocatorStats& other) noexcept
+		{
+			Store(m_allocations, Load(other.m_allocations));
+			Store(m_frees, Load(other.m_frees));
+			Store(m_peakLive, Load(other.m_peakLive));
+			Store(m_chunks, Load(other.m_chunks));
+			Store(m_emptyChunks, Load(other.m_emptyChunks));
+		}
+
+		std::atomic<std::size_t> m_allocations{};
+		std::atomic<std::size_t> m_frees{};
+		std::atomic<std::size_t> m_peakLive{};
+		std::atomic<std::size_t> m_chunks{};
+		std::atomic<std::size_t> m_emptyChunks{};
+	};
+
+	/// Adds a size class to a snapshot and to its total (peak live blocks
+	/// are summed: an upper bound of the total peak)
+
+	inline void AddSizeClass(AllocatorSnapshot& snapshot, const SizeClassStats& stats)
+	{
+		snapshot.m_sizeClasses.push_back(stats);
+
+		SizeClassStats& total = snapshot.m_total;
+		total.m_allocations += stats.m_allocations;
+		total.m_frees += stats.m_frees;
+		total.m_liveBlocks += stats.m_liveBlocks;
+		total.m_peakLiveBlocks += stats.m_peakLiveBlocks;
+		total.m_chunks += stats.m_chunks;
+		total.m_emptyChunks += stats.m_emptyChunks;
+		total.m_bytesReserved += stats.m_bytesReserved;
+		total.m_bytesInUse += stats.m_bytesInUse;
+	}
+}
+
+
+#endif // !ALLOCATOR_STATS_H
@@ -2,6 +2,10 @@
 #define CHUNK_H
 
 #include <cstddef>
+#include <cstdint>
+#include <limits>
+#include "SOA_defaults.h"
+#include "SOA_memory.h"
 
 namespace soa {
 
@@ -24,8 +28,8 @@ namespace soa {
 	/// 
 	/// [*] A block can be either used or unused. We can store whatever we want in an
 	///     unused block, so we take advantage of this.
-	/// [*] The first byte of an unused block holds the index of the next
-	///     unused block.
+	/// [*] The first bytes of an unused block hold the index of the next
+	///     unused block (sizeof(IndexT) bytes).
 	/// 
 	/// Because we hold the first available index in firstAvailableBlock_, 
 	/// we have a fullfledged singly linked list 
@@ -33,19 +37,72 @@ namespace soa {
 	/// - No extra cost in size.
 	/// - Allocating and deallocating a block inside 
 	///   a Chunk takes constant time.
+	/// 
+	/// Init(pData, ...) adopts storage provided by the caller: in that case 
+	/// Release must not be called, the storage goes back to its owner.
+	/// 
+	/// Index width:
+	/// The original Chunk uses unsigned char indices, so a chunk can't hold
+	/// more than 255 blocks: with 8-16 bytes objects that means a new tiny
+	/// chunk every 255 allocations and a lot of chunks to search.
+	/// IndexT sets the width of the indices (8/16/32 bit) and so the max number
+	/// of blocks per chunk. A block must be at least sizeof(IndexT) bytes.
+	/// The chunk header is padded to the pointer size anyway, so wider
+	/// indices cost nothing up to 32 bits on 64-bit targets.
+	/// 
+	/// SOA_HARDENED (see Hardened.h): blockSize is the stride, redzone
+	/// included. The occupancy shadow (one bit per block, set = used) sits
+	/// past the last block: StorageBytes() is what Init(pData, ...) needs.
+	/// Free blocks are poisoned after their index.
+
+	template<typename IndexT>
+	struct BasicChunk {
+
+		using index_type = IndexT;
 
-	struct Chunk {
+		static constexpr std::size_t MAX_BLOCKS = (std::numeric_limits<IndexT>::max)();
 
-		void  Init(std::size_t i_blockSize, unsigned char blocks);
+		static constexpr std::size_t StorageBytes(std::size_t blockSize, std::size_t blocks)
+		{
+#ifdef SOA_HARDENED
+			return AlignUp(blockSize * blocks, sizeof(std::uint64_t)) + (blocks + 63) / 64 * sizeof(std::uint64_t);
+#else
+			return blockSize * blocks;
+#endif
+		}
+
+		void  Init(std::size_t i_blockSize, IndexT blocks);
+		void  Init(void* pData, std::size_t blockSize, IndexT blocks);
 		void* Allocate(std::size_t blockSize);
 		void  Deallocate(void* p, std::size_t blockSize);
-		void  Reset(std::size_t blockSize, unsigned char blocks);
+		void  Reset(std::size_t blockSize, IndexT blocks);
 		void  Release();
 
+		// up to n blocks written to out, returns how many
+		std::size_t AllocateBatch(std::size_t blockSize, std::size_t n, void** out);
+		// every block must belong to this chunk
+		void DeallocateBatch(std::size_t blockSize, std::size_t n, void** in);
+
 		unsigned char* m_pData{};
-		unsigned char  m_firstAvailableBlock{};
-		unsigned char  m_blocksAvailable{};
+		IndexT         m_firstAvailableBlock{};
+		IndexT         m_blocksAvailable{};
+#ifdef SOA_HARDENED
+		IndexT         m_numBlocks{};
+		std::uint64_t* m_shadow{};
+
+	private:
+		bool IsUsed(std::size_t index) const { return (m_shadow[index / 64] >> (index % 64)) & 1; }
+		void SetUsed(std::size_t index) { m_shadow[index / 64] |= std::uint64_t(1) << (index % 64); }
+		void ClearUsed(std::size_t index) { m_shadow[index / 64] &= ~(std::uint64_t(1) << (index % 64)); }
+#endif
 	};
+
+	using Chunk8  = BasicChunk<std::uint8_t>;  // Alexandrescu's original
+	using Chunk16 = BasicChunk<std::uint16_t>;
+	using Chunk32 = BasicChunk<std::uint32_t>;
+
+	// used by the small object allocators
+	using Chunk = BasicChunk<ChunkIndex>;
 }
 
 #endif // !CHUNK_H
\ No newline at end of file
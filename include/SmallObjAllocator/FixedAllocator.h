@@ -1,8 +1,16 @@
 #ifndef FIXED_ALLOCATOR_H
 #define FIXED_ALLOCATOR_H
 
+#include <chrono>
 #include <vector>
+#include "SOA_defaults.h"
+#include "SOA_memory.h"
 #include "Chunk.h"
+#include "BitmapChunk.h"
+#include "PageProvider.h"
+#include "PageMap.h"
+#include "RetentionPolicy.h"
+#include "AllocatorStats.h"
 
 namespace soa {
 
@@ -34,48 +42,137 @@ namespace soa {
 	/// - No? Linear search.
 	/// 
 	/// Improvements tweaks:
-	/// 1) Deallocate searches the appropriate Chunk starting from deallocChunk_'s
-	///    vicinity: going up and down from deallocChunk with 2 iterators (faster)
-	///     - This greatly improves the speed of bulk deallocations in any 
-	///       order (normal or reversed).
+	/// 1) Deallocate finds the appropriate Chunk in O(1): deallocChunk first,
+	///    then the index of the chunk, the PageMap tag of its pages.
+	///     - Originally it searched up and down from deallocChunk's vicinity,
+	///       linear in the number of chunks on butterfly or random frees.
+	///     - Chunks move in the vector (empties to the end, released ones
+	///       replaced by the last): their tag is updated with them.
 	/// 2) Avoid constantly allocate/deallocate a new Chunk. During deallocation, 
-	///    a chunk is freed only when there are two empty chunks.
-	///     - This heuristic isn't perfect. If in a loop you allocate a bunch of
-	///       smart pointers of an appropriate size, you end un probably allocated
-	///       2 chunks and at the end deallocatin.
+	///    empty chunks are moved to the end and kept, up to the high watermark
+	///    of the RetentionPolicy: past it they are freed down to the low one.
+	///     - Originally a chunk was freed as soon as there were two empty
+	///       chunks. If in a loop you allocate a bunch of smart pointers of an
+	///       appropriate size, you end up allocating and freeing the same chunk
+	///       over and over: the gap between the watermarks avoids it.
+	///     - Trim() frees the empty chunks on demand.
+	/// 3) Bulk release: Reset() makes every block available again and
+	///    Release() frees every chunk, one pass over the chunks and no
+	///    per-object Deallocate. Live blocks become invalid.
+	/// 4) Always-on counters (FixedAllocatorStats), read with GetStats()
+	///    from any thread.
+	/// 5) SOA_HARDENED (see Hardened.h): blocks are spaced by their redzone,
+	///    Deallocate checks the PageMap before searching the chunk, pointers
+	///    of no chunk are reported instead of searched forever.
 	///     
 	/// The deallocation strategy chosen also fits the butterfly allocation trend acceptably. 
 	/// Even if not allocating data in an ordered manner, 
 	/// programs tend to foster a certain locality; that is, 
 	/// they access a small amount of data at a time.
+	/// 
+	/// ChunkT sets the chunk engine: chunks hold chunkSize / blockSize blocks,
+	/// up to ChunkT::MAX_BLOCKS (the max value of the index type for BasicChunk).
+	/// Explicitly instantiated for Chunk8, Chunk16, Chunk32 and BitmapChunk.
+	/// 
+	/// Chunk storage comes from a PageProvider (DefaultPageProvider() if none
+	/// is given), that must outlive the allocator and its copies.
+	/// It is registered in the PageMap while the chunk holds it.
+
+	template<typename ChunkT>
+	class BasicFixedAllocator {
+
+		using IndexT = typename ChunkT::index_type;
+
+		std::size_t m_blockSize{}; // stride: GetBlockSize() + DEFAULT_REDZONE_SIZE
+		IndexT m_numBlocks{};
+		std::vector<ChunkT, MallocAllocator<ChunkT>> m_chunks;
+		ChunkT* m_allocChunk = nullptr;
+		ChunkT* m_deallocChunk = nullptr;
+		PageProvider* m_provider{};
 
-	class FixedAllocator {
+		RetentionPolicy m_retention{};
+		std::size_t m_emptyChunks{};                          // chunks with every block available
+		std::chrono::steady_clock::time_point m_emptySince{}; // when m_emptyChunks went above the low watermark, {} when not above
 
-		std::size_t m_blockSize{};
-		unsigned char m_numBlocks{};
-		std::vector<Chunk> m_chunks;
-		Chunk* m_allocChunk = nullptr;
-		Chunk* m_deallocChunk = nullptr;
+		mutable const BasicFixedAllocator* m_prev{};
+		mutable const BasicFixedAllocator* m_next{};
 
-		mutable const FixedAllocator* m_prev{};
-		mutable const FixedAllocator* m_next{};
+		FixedAllocatorStats m_stats{};
+
+		void PublishChunks()
+		{
+			m_stats.SetChunks(m_chunks.size(), m_emptyChunks);
+			StampEmptySince(m_emptyChunks);
+		}
+
+		// every change of the empty chunks ends in PublishChunks: m_emptySince
+		// is stamped when they go above the low watermark, whatever the path
+		// (Reset, batches...), and cleared when they are back to it or below
+		void StampEmptySince(std::size_t numEmpty)
+		{
+			const bool above = numEmpty > m_retention.m_lowWatermark;
+			if (above == (m_emptySince != std::chrono::steady_clock::time_point{})) return;
+
+			m_emptySince = above ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point{};
+		}
 
 		void DoDeallocate(void* p);
-		Chunk* VicinityFind(void* p);
+		void ReleaseEmptyChunk();
+		bool MustRelease();
+		std::size_t ReleaseEmptyChunks(std::size_t keep);
+		ChunkT* FindChunk(const void* p);
+		void ReleaseChunk(ChunkT& chunk);
+
+		// the PageMap tag of a chunk is its index in m_chunks
+		void TagChunk(const ChunkT& chunk)
+		{
+			PageMap::Instance().SetChunk(chunk.m_pData, ChunkBytes(), PageMap::IndexTag(&chunk - m_chunks.data()));
+		}
+
+		bool ChunkContains(const ChunkT& chunk, const void* p) const
+		{
+			return p >= chunk.m_pData && p < chunk.m_pData + m_numBlocks * m_blockSize;
+		}
+
+		// chunk storage size, whole PageMap pages
+		std::size_t ChunkBytes() const { return AlignUp(ChunkT::StorageBytes(m_blockSize, m_numBlocks), DEFAULT_PAGE_MAP_PAGE); }
 
 	public:
 
-		explicit FixedAllocator(std::size_t blockSize = 0);
-		FixedAllocator(const FixedAllocator&);
-		FixedAllocator& operator=(const FixedAllocator&);
-		~FixedAllocator();
+		explicit BasicFixedAllocator(std::size_t blockSize = 0, std::size_t chunkSize = DEFAULT_CHUNK_SIZE,
+			PageProvider* provider = nullptr, const RetentionPolicy& retention = RetentionPolicy());
+		BasicFixedAllocator(const BasicFixedAllocator&);
+		BasicFixedAllocator& operator=(const BasicFixedAllocator&);
+		~BasicFixedAllocator();
 
-		void Swap(FixedAllocator& rhs);
+		void Swap(BasicFixedAllocator& rhs);
 
 		void* Allocate();
 		void  Deallocate(void* p);
-		inline std::size_t GetBlockSize() const { return m_blockSize; }
+
+		// n blocks at once, see AllocateBatch
+		std::size_t AllocateBatch(std::size_t n, void** out);
+		void DeallocateBatch(std::size_t n, void** in);
+
+		// frees the empty chunks beyond keep, returns how many
+		std::size_t Trim(std::size_t keep = 0);
+
+		// every block available again: chunks are kept up to the high
+		// watermark of the RetentionPolicy, the others are freed
+		void Reset();
+		// frees every chunk, returns how many
+		std::size_t Release();
+		void SetRetentionPolicy(const RetentionPolicy& retention);
+
+		inline std::size_t GetBlockSize() const { return m_blockSize - DEFAULT_REDZONE_SIZE; }
+		inline std::size_t GetNumEmptyChunks() const { return m_emptyChunks; }
+
+		// any thread, see FixedAllocatorStats
+		SizeClassStats GetStats() const { return m_stats.Read(GetBlockSize(), ChunkBytes()); }
 	};
+
+	using FixedAllocator = BasicFixedAllocator<Chunk>;
+	using BitmapFixedAllocator = BasicFixedAllocator<BitmapChunk>;
 }
 
 #endif // !FIXED_ALLOCATOR_H
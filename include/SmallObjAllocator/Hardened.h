@@ -0,0 +1,186 @@
+#ifndef HARDENED_H
+#define HARDENED_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include "SOA_defaults.h"
+#include "PageMap.h"
+
+namespace soa {
+
+	/// Hardened mode
+	///
+	/// Compiled in with SOA_HARDENED: every misuse below is caught where it
+	/// happens instead of corrupting the in-block free lists.
+	/// - Occupancy shadow: one bit per block, outside the blocks (BasicChunk
+	///   keeps it past the last block of the chunk storage, BitmapChunk uses
+	///   its free mask). Double frees and frees of a block in the middle of
+	///   a block are rejected.
+	/// - Ownership: the fixed allocators check the PageMap before searching
+	///   the chunk. Pointers outside any chunk, or inside a chunk of another
+	///   size class, are rejected.
+	/// - Redzone: DEFAULT_REDZONE_SIZE bytes after every block, holding a
+	///   canary derived from the block address. Checked on deallocation:
+	///   writes past the end of the block.
+	/// - Poisoning: freed blocks are filled with FREE_POISON (but the free
+	///   list link), verified when handed out again: writes after free.
+	///
+	/// Errors go to the HardenedHandler. The default one prints the report on
+	/// stderr and aborts. A handler that returns (tests, canary deployments
+	/// that log and go on) makes the allocator skip the bad free: the block
+	/// is leaked, never reused. Reports of writes (overflow, write after
+	/// free) don't change the operation.
+	///
+	/// A block freed by a thread other than the owner of its CtmFixedAllocator
+	/// is marked in its redzone until the owner takes it back: a second free
+	/// from any thread is a double free.
+	///
+	/// Blocks still cached in a ThreadCache are checked when they are freed
+	/// (ownership, canary, double free inside the same bin) but not poisoned:
+	/// a write after free into them shows up once they go back to a chunk.
+	/// StaticFixedAllocator and the arenas are not checked.
+
+	enum class HardenedError {
+		DoubleFree,
+		ForeignPointer,   // not a block of this allocator, or not the start of one
+		WrongSizeClass,   // a block of another size class
+		Overflow,         // redzone canary overwritten
+		WriteAfterFree,   // poison of a free block overwritten
+		CorruptFreeList   // free list link pointing to a used block or out of the chunk
+	};
+
+	struct HardenedReport {
+		HardenedError m_error{};
+		const void* m_pointer{};
+		std::size_t m_blockSize{}; // size class of the allocator reporting it
+	};
+
+	using HardenedHandler = void(*)(const HardenedReport& report);
+
+	// returns the previous handler, nullptr restores the default one
+	HardenedHandler SetHardenedHandler(HardenedHandler handler) noexcept;
+
+	// the default handler: report on stderr (no allocation), then std::abort
+	void DefaultHardenedHandler(const HardenedReport& report) noexcept;
+
+	void ReportHardened(HardenedError error, const void* p, std::size_t blockSize) noexcept;
+
+	const char* ToString(HardenedError error) noexcept;
+
+	namespace hardened {
+
+		constexpr unsigned char FREE_POISON = 0xDF;
+
+		/// Canary of the block at p: the address mixed with a per-process key
+		/// (address of a function of the library, ASLR moves it every run)
+
+		inline std::uint64_t Canary(const void* p) noexcept
+		{
+			const std::uint64_t key = static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(&ReportHardened));
+			const std::uint64_t x = (static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(p)) ^ key) * 0x9E3779B97F4A7C15ull;
+			return x ^ (x >> 29);
+		}
+
+		/// Redzone: the last DEFAULT_REDZONE_SIZE bytes of the stride, the
+		/// canary repeated. memcpy: blocks are only 8 bytes aligned
+
+		inline void WriteCanary(unsigned char* block, std::size_t stride) noexcept
+		{
+			const std::uint64_t canary = Canary(block);
+			for (std::size_t i = stride - DEFAULT_REDZONE_SIZE; i < stride; i += sizeof(canary))
+				std::memcpy(block + i, &canary, sizeof(canary));
+		}
+
+		inline bool CheckCanary(const unsigned char* block, std::size_t stride) noexcept
+		{
+			const std::uint64_t canary = Canary(block);
+			for (std::size_t i = stride - DEFAULT_REDZONE_SIZE; i < stride; i += sizeof(canary))
+			{
+				std::uint64_t value;
+				std::memcpy(&value, block + i, sizeof(value));
+				if (value != canary) return false;
+			}
+			return true;
+		}
+
+		inline void Poison(unsigned char* block, std::size_t from, std::size_t stride) noexcept
+		{
+			std::memset(block + from, FREE_POISON, stride - from);
+		}
+
+		inline bool IsPoisoned(const unsigned char* block, std::size_t from, std::size_t stride) noexcept
+		{
+			std::uint64_t pattern;
+			std::memset(&pattern, FREE_POISON, sizeof(pattern));
+
+			std::size_t i = from;
+			for (; i + sizeof(pattern) <= stride; i += sizeof(pattern))
+			{
+				std::uint64_t value;
+				std::memcpy(&value, block + i, sizeof(value));
+				if (value != pattern) return false;
+			}
+			for (; i < stride; ++i)
+				if (block[i] != FREE_POISON) return false;
+			return true;
+		}
+
+		/// Remote frees of CtmFixedAllocator: while the block waits on the
+		/// remote list of its owner the first redzone word holds ~canary.
+		/// Mark: any thread, compare-exchange so two racing frees can't both
+		/// win. Blocks are 8 bytes aligned, so is the word.
+
+		inline std::atomic_ref<std::uint64_t> RedzoneWord(unsigned char* block, std::size_t stride) noexcept
+		{
+			return std::atomic_ref<std::uint64_t>(*reinterpret_cast<std::uint64_t*>(block + stride - DEFAULT_REDZONE_SIZE));
+		}
+
+		inline bool MarkRemoteFree(unsigned char* block, std::size_t stride) noexcept
+		{
+			std::uint64_t expected = Canary(block);
+			if (RedzoneWord(block, stride).compare_exchange_strong(expected, ~Canary(block), std::memory_order_relaxed))
+				return true;
+
+			ReportHardened(expected == ~Canary(block) ? HardenedError::DoubleFree : HardenedError::Overflow,
+				block, stride - DEFAULT_REDZONE_SIZE);
+			return false;
+		}
+
+		inline bool IsMarkedRemoteFree(unsigned char* block, std::size_t stride) noexcept
+		{
+			return RedzoneWord(block, stride).load(std::memory_order_relaxed) == ~Canary(block);
+		}
+
+		inline void UnmarkRemoteFree(unsigned char* block, std::size_t stride) noexcept
+		{
+			RedzoneWord(block, stride).store(Canary(block), std::memory_order_relaxed);
+		}
+
+		/// p must be a block of a chunk of blockSize (user size) bytes blocks
+
+		inline bool CheckOwnership(const void* p, std::size_t blockSize) noexcept
+		{
+			const std::size_t registered = PageMap::Instance().BlockSize(p);
+			if (registered == blockSize) [[likely]] return true;
+
+			ReportHardened(registered ? HardenedError::WrongSizeClass : HardenedError::ForeignPointer, p, blockSize);
+			return false;
+		}
+
+		/// p freed with a size past the size classes: must not be a block
+
+		inline bool CheckNotInChunk(const void* p) noexcept
+		{
+			const std::size_t registered = PageMap::Instance().BlockSize(p);
+			if (!registered) [[likely]] return true;
+
+			ReportHardened(HardenedError::WrongSizeClass, p, registered);
+			return false;
+		}
+	}
+}
+
+
+#endif // !HARDENED_H
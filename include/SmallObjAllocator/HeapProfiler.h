@@ -0,0 +1,114 @@
+#ifndef HEAP_PROFILER_H
+#define HEAP_PROFILER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <mutex>
+#include "SOA_defaults.h"
+
+namespace soa {
+
+	/// HeapProfiler
+	///
+	/// Process wide sampling profiler of the small object allocations: which
+	/// call stacks own the memory of the size classes.
+	/// - About once every GetSampleInterval() bytes allocated by a thread
+	///   (exponential intervals, so periodic patterns don't alias) the stack
+	///   of the allocation is captured. Samples are grouped in buckets keyed
+	///   by call stack and size class, every bucket keeps live and total
+	///   sample counts.
+	/// - Fast path, inlined in the allocators: a thread-local countdown of
+	///   bytes (Tick) on allocation, one relaxed load of a counting filter
+	///   indexed by address (OnFree) on deallocation. Only the sampled
+	///   allocations, and the frees of addresses hashing to a sampled slot,
+	///   take the lock.
+	/// - Dumps: pprof legacy heap profile (heap_v2, unsampled by pprof) and
+	///   folded stacks (flamegraph.pl, speedscope), live bytes only.
+	///
+	/// Stopped by default: the fast path runs anyway, the slow one then only
+	/// rearms the countdown. Blocks freed by Reset/Release of an allocator
+	/// are dropped with DropOwner. AllocateBatch is not sampled: it is the
+	/// refill path of ThreadCache, whose blocks are sampled when handed out.
+	///
+	/// Stack capture: CaptureStackBackTrace on Windows, backtrace() where
+	/// <execinfo.h> exists, nothing elsewhere (one bucket per size class).
+	/// pprof symbolizes the addresses itself, folded stacks use dladdr where
+	/// available (functions of the executable need -rdynamic) or hex.
+	/// Tables live in malloc'ed memory and the profiler is never destroyed:
+	/// static destructors can still free sampled blocks.
+
+	class HeapProfiler {
+	public:
+		static HeapProfiler& Instance() noexcept;
+
+		// samples about once every sampleBytes allocated per thread.
+		// Threads pick it up within one interval
+		void Start(std::size_t sampleBytes = DEFAULT_PROFILER_SAMPLE_BYTES) noexcept;
+		// no new samples, frees of the live ones are still tracked
+		void Stop() noexcept;
+		// drops every bucket and live sample
+		void Clear() noexcept;
+
+		bool IsActive() const noexcept { return m_sampleBytes.load(std::memory_order_relaxed) != 0; }
+		std::size_t GetSampleInterval() const noexcept { return m_sampleBytes.load(std::memory_order_relaxed); }
+		std::size_t GetNumLiveSamples() const noexcept { return m_numLive.load(std::memory_order_relaxed); }
+
+		// true once the thread allocated its interval: the caller must then
+		// call RecordAllocation, that rearms the countdown
+		static bool Tick(std::size_t blockSize) noexcept
+		{
+			s_bytesUntilSample -= static_cast<std::ptrdiff_t>(blockSize);
+			return s_bytesUntilSample < 0;
+		}
+
+		static void OnFree(const void* p) noexcept
+		{
+			if (s_filter[FilterSlot(p)].load(std::memory_order_relaxed)) [[unlikely]]
+				Instance().RecordFree(p);
+		}
+
+		// owner: the allocator the block belongs to, see DropOwner
+		void RecordAllocation(const void* owner, void* p, std::size_t blockSize) noexcept;
+		void RecordFree(const void* p) noexcept;
+
+		// every block of owner was freed at once (Reset, Release)
+		void DropOwner(const void* owner) noexcept;
+
+		// false if the file can't be written
+		bool DumpPprof(const char* path) const;
+		bool DumpFolded(const char* path) const;
+		void WritePprof(std::ostream& os) const;
+		void WriteFolded(std::ostream& os) const;
+
+	private:
+		HeapProfiler() = default;
+		HeapProfiler(const HeapProfiler&) = delete;
+		HeapProfiler& operator=(const HeapProfiler&) = delete;
+
+		struct Bucket;
+		struct Tables;
+
+		static std::size_t FilterSlot(const void* p) noexcept
+		{
+			const std::uint64_t key = static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(p) >> 3);
+			return static_cast<std::size_t>((key * 0x9E3779B97F4A7C15ull) >> (64 - DEFAULT_PROFILER_FILTER_BITS));
+		}
+
+		std::ptrdiff_t NextInterval() noexcept;
+		void RemoveLocked(const void* p) noexcept;
+
+		std::atomic<std::size_t> m_sampleBytes{};
+		std::atomic<std::size_t> m_numLive{};
+		mutable std::mutex m_mutex;
+		Tables* m_tables{}; // guarded by m_mutex
+
+		// inline: constant initialized and visible to the callers, no TLS wrapper call
+		static inline thread_local std::ptrdiff_t s_bytesUntilSample = 0;
+		static inline std::atomic<std::uint32_t> s_filter[std::size_t(1) << DEFAULT_PROFILER_FILTER_BITS]{};
+	};
+}
+
+
+#endif // !HEAP_PROFILER_H
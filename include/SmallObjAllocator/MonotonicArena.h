@@ -0,0 +1,100 @@
+#ifndef MONOTONIC_ARENA_H
+#define MONOTONIC_ARENA_H
+
+#include <cstddef>
+#include "SOA_defaults.h"
+#include "SOA_memory.h"
+#include "PageProvider.h"
+
+namespace soa {
+
+	/// MonotonicArena
+	///
+	/// Bump pointer allocator for short lived groups of objects (the
+	/// containers of one request, one frame, one parse...).
+	/// - Allocate moves a pointer inside the current buffer. A full buffer is
+	///   followed by a new one from the PageProvider, twice as big up to
+	///   DEFAULT_ARENA_MAX_BUFFER_SIZE.
+	/// - Deallocate is a no-op: memory comes back all at once.
+	/// - Reset() rewinds to the first buffer and keeps all of them, the next
+	///   round allocates without calling the provider. Release() gives the
+	///   buffers back.
+	/// - An optional initial buffer (on the stack, static...) owned by the
+	///   caller is used first, never given back.
+	///
+	/// Not thread-safe. Blocks are aligned to alignof(std::max_align_t) unless
+	/// asked otherwise, no size header: any alignment is one pointer increment.
+
+	class MonotonicArena {
+	public:
+		explicit MonotonicArena(std::size_t bufferSize = DEFAULT_ARENA_BUFFER_SIZE,
+			PageProvider* provider = nullptr);
+
+		MonotonicArena(void* initialBuffer, std::size_t initialSize,
+			std::size_t bufferSize = DEFAULT_ARENA_BUFFER_SIZE,
+			PageProvider* provider = nullptr);
+
+		~MonotonicArena();
+
+		// throws std::bad_alloc when the provider fails
+		void* Allocate(std::size_t numBytes);
+		void  Deallocate(void*, std::size_t) noexcept {}
+
+		// alignment: power of two
+		void* Allocate(std::size_t numBytes, std::size_t alignment);
+		void  Deallocate(void*, std::size_t, std::size_t) noexcept {}
+
+		std::size_t AllocateBatch(std::size_t numBytes, std::size_t n, void** out);
+		void DeallocateBatch(std::size_t, std::size_t, void**) noexcept {}
+
+		void Reset() noexcept;
+		std::size_t Release() noexcept;
+
+		// bytes behind the bump pointer (padding and skipped buffer tails included)
+		// / bytes of all the buffers
+		std::size_t BytesUsed() const noexcept;
+		std::size_t BytesReserved() const noexcept;
+
+		MonotonicArena(const MonotonicArena&) = delete;
+		MonotonicArena& operator=(const MonotonicArena&) = delete;
+
+	protected:
+
+		/// Header at the front of every provider buffer, buffers are linked
+		/// in the order they were first used
+
+		struct Buffer {
+			Buffer* m_next;
+			std::size_t m_size; // whole buffer, header included
+		};
+
+		static constexpr std::size_t HEADER_SIZE = AlignUp(sizeof(Buffer), alignof(std::max_align_t));
+
+		static char* Begin(Buffer* buffer) noexcept { return reinterpret_cast<char*>(buffer) + HEADER_SIZE; }
+		static char* End(Buffer* buffer) noexcept { return reinterpret_cast<char*>(buffer) + buffer->m_size; }
+
+		// Moves to the next buffer that fits numBytes, appends a new one if none
+		void Grow(std::size_t numBytes, std::size_t alignment);
+
+		// Makes buffer (nullptr: the initial one) current, bump pointer at cur
+		void MoveTo(Buffer* buffer, char* cur) noexcept;
+
+		char* m_cur;
+		char* m_end;
+		Buffer* m_current; // nullptr: the initial buffer (or none yet)
+
+	private:
+		PageProvider* m_provider;
+		Buffer* m_head;
+		Buffer* m_tail;
+
+		char* m_initialBuffer;
+		std::size_t m_initialSize;
+
+		std::size_t m_bufferSize;
+		std::size_t m_nextSize;
+	};
+}
+
+
+#endif // !MONOTONIC_ARENA_H
@@ -0,0 +1,35 @@
+#ifndef OWNER_SCOPE_H
+#define OWNER_SCOPE_H
+
+namespace soa {
+
+	/// SerializedOwnerScope
+	///
+	/// Owner thread model of CtmFixedAllocator: while a scope is alive, the
+	/// calling thread holds the lock that serializes every call made to a
+	/// shared allocator (ThreadCache::SharedMutex()), so it acts as the owner
+	/// of every size class it touches, whoever created it.
+	/// Size classes created lazily by a worker don't depend on that worker
+	/// anymore: after it exits, the next serialized caller frees their
+	/// blocks, drains their remote frees and trims them.
+	///
+	/// Scopes nest. ThreadCache::SerializedLock takes the lock and opens one.
+
+	class SerializedOwnerScope {
+	public:
+		SerializedOwnerScope() noexcept : m_prev(s_active) { s_active = true; }
+		~SerializedOwnerScope() { s_active = m_prev; }
+
+		SerializedOwnerScope(const SerializedOwnerScope&) = delete;
+		SerializedOwnerScope& operator=(const SerializedOwnerScope&) = delete;
+
+		static bool Active() noexcept { return s_active; }
+
+	private:
+		bool m_prev;
+
+		static inline thread_local bool s_active = false; // trivially destructible
+	};
+}
+
+#endif // !OWNER_SCOPE_H
@@ -0,0 +1,112 @@
+#ifndef PAGE_MAP_H
+#define PAGE_MAP_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "SOA_defaults.h"
+
+namespace soa {
+
+	/// PageMap
+	///
+	/// Process wide map from an address to the size class and the chunk
+	/// holding it, so a block can be deallocated without its size, and
+	/// without searching the chunks of its allocator.
+	/// - Two level radix tree on the page number (address >> DEFAULT_PAGE_MAP_SHIFT):
+	///   a root of leaf pointers, and leaves holding one entry per page
+	///   (block size and chunk tag, 16 bytes: one cache line for both).
+	///   48 bit addresses: 2^18 root entries, leaves of 2^18 pages (1 GB each).
+	/// - The fixed allocators register the storage of every chunk they get
+	///   from their provider, and unregister it when they release it.
+	///   Chunk storage is page aligned, and a multiple of a page.
+	/// - The chunk tag is opaque here, the allocator holding the chunk sets it
+	///   and updates it with SetChunk when the chunk moves. Tags of blocks of
+	///   the same size class must be told apart by every allocator:
+	///   FixedAllocator tags are odd (IndexTag, the index of the chunk),
+	///   CtmFixedAllocator ones are even (its ChunkNode*).
+	/// - BlockSize(p), Chunk(p): two dependent loads, 0 for any address outside
+	///   the chunks (malloc fallbacks, stack, other heaps).
+	///
+	/// Leaves are allocated on the first chunk of their 1 GB range and never
+	/// freed. The root is zero initialized static storage: only the pages of
+	/// it that are used get touched.
+	///
+	/// Thread-safe: chunks of different allocators (threads) can share a leaf.
+	/// Entries are read with relaxed loads: a block handed to another thread
+	/// carries the happens-before of the registration of its chunk. Chunk tags
+	/// are only read by the allocator holding the chunk, that also writes them.
+
+	class PageMap {
+	public:
+		static PageMap& Instance() noexcept
+		{
+			static PageMap pageMap;
+			return pageMap;
+		}
+
+		// [p, p + size) page aligned. false if out of memory
+		bool Register(const void* p, std::size_t size, std::size_t blockSize, std::uintptr_t chunk) noexcept;
+		void Unregister(const void* p, std::size_t size) noexcept;
+
+		// chunk tag of an index, see above
+		static constexpr std::uintptr_t IndexTag(std::size_t index) noexcept { return (std::uintptr_t(index) << 1) | 1; }
+		static constexpr bool IsIndexTag(std::uintptr_t chunk) noexcept { return chunk & 1; }
+
+		// new tag of a registered chunk that moved
+		void SetChunk(const void* p, std::size_t size, std::uintptr_t chunk) noexcept;
+
+		std::size_t BlockSize(const void* p) const noexcept
+		{
+			const Entry* entry = Find(p);
+			return entry ? entry->m_blockSize.load(std::memory_order_relaxed) : 0;
+		}
+
+		std::uintptr_t Chunk(const void* p) const noexcept
+		{
+			const Entry* entry = Find(p);
+			return entry ? entry->m_chunk.load(std::memory_order_relaxed) : 0;
+		}
+
+		bool Contains(const void* p) const noexcept { return BlockSize(p) != 0; }
+
+	private:
+		constexpr PageMap() = default;
+		PageMap(const PageMap&) = delete;
+		PageMap& operator=(const PageMap&) = delete;
+
+		static constexpr std::size_t ADDRESS_BITS = 48;
+		static constexpr std::size_t PAGE_BITS = ADDRESS_BITS - DEFAULT_PAGE_MAP_SHIFT;
+		static constexpr std::size_t LEAF_BITS = PAGE_BITS / 2;
+		static constexpr std::size_t ROOT_BITS = PAGE_BITS - LEAF_BITS;
+		static constexpr std::size_t LEAF_PAGES = std::size_t(1) << LEAF_BITS;
+
+		struct Entry {
+			std::atomic<std::uint32_t> m_blockSize;
+			std::atomic<std::uintptr_t> m_chunk;
+		};
+
+		struct Leaf {
+			Entry m_entries[LEAF_PAGES];
+		};
+
+		const Entry* Find(const void* p) const noexcept
+		{
+			const std::uintptr_t page = reinterpret_cast<std::uintptr_t>(p) >> DEFAULT_PAGE_MAP_SHIFT;
+
+			if (page >> (ROOT_BITS + LEAF_BITS)) return nullptr;
+
+			const Leaf* leaf = m_root[page >> LEAF_BITS].load(std::memory_order_acquire);
+			if (!leaf) return nullptr;
+
+			return &leaf->m_entries[page & (LEAF_PAGES - 1)];
+		}
+
+		Leaf* GetLeaf(std::size_t rootIndex) noexcept;
+		void  Store(const void* p, std::size_t size, std::uint32_t blockSize, std::uintptr_t chunk) noexcept;
+
+		std::atomic<Leaf*> m_root[std::size_t(1) << ROOT_BITS]{};
+	};
+}
+
+#endif // !PAGE_MAP_H
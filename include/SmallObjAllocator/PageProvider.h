@@ -0,0 +1,145 @@
+#ifndef PAGE_PROVIDER_H
+#define PAGE_PROVIDER_H
+
+#include <cstddef>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "SOA_defaults.h"
+#include "SOA_memory.h"
+
+namespace soa {
+
+	/// PageProvider
+	///
+	/// Source of the raw storage the fixed allocators carve their chunks from.
+	/// - AllocatePages(size, alignment): storage for one chunk, alignment is
+	///   a power of two. nullptr on failure.
+	/// - ReleasePages(p, size): gives it back, size must be the requested one.
+	/// - Decommit(): hands the physical memory of released storage back to the
+	///   OS. No-op when the provider can't do it.
+	///
+	/// A provider is shared by many allocators (and threads): implementations
+	/// must be thread-safe.
+
+	class PageProvider {
+	public:
+		virtual ~PageProvider() = default;
+
+		virtual void* AllocatePages(std::size_t size, std::size_t alignment) = 0;
+		virtual void  ReleasePages(void* p, std::size_t size) = 0;
+		virtual void  Decommit() {}
+	};
+
+	/// MallocPageProvider
+	///
+	/// One AlignedMalloc/AlignedFree per chunk, as Chunk::Init does.
+	/// Stateless, thread-safe as the system heap is.
+	/// Chunks are page aligned (PageMap): the heap pads every one of them,
+	/// a 4 KB chunk can take up to twice its size (glibc memalign).
+
+	class MallocPageProvider final : public PageProvider {
+	public:
+		static MallocPageProvider& Instance() noexcept;
+
+		void* AllocatePages(std::size_t size, std::size_t alignment) override;
+		void  ReleasePages(void* p, std::size_t size) override;
+	};
+
+	/// Huge page support of VirtualPageProvider
+	/// - None
+	/// - Transparent: superblocks are 2 MB aligned and hinted with MADV_HUGEPAGE,
+	///                the kernel backs them with huge pages when it can (Linux THP).
+	/// - Explicit:    superblocks mapped with MAP_HUGETLB / MEM_LARGE_PAGES.
+	///                Needs reserved huge pages (or SeLockMemoryPrivilege on Windows),
+	///                falls back to normal pages when the mapping fails.
+
+	enum class HugePages {
+		None,
+		Transparent,
+		Explicit
+	};
+
+#ifdef SOA_HUGE_PAGES
+	constexpr HugePages DEFAULT_HUGE_PAGES = HugePages::Transparent;
+#else
+	constexpr HugePages DEFAULT_HUGE_PAGES = HugePages::None;
+#endif
+
+	/// VirtualPageProvider
+	///
+	/// - Maps superblocks (DEFAULT_SUPERBLOCK_SIZE) straight from the OS with
+	///   mmap / VirtualAlloc and carves chunks out of them with a bump pointer.
+	///   No malloc call and no heap header per chunk: the chunks of an allocator
+	///   sit next to each other, fewer pages and TLB entries are touched, and the
+	///   small object memory lives in a few big contiguous address ranges.
+	/// - Released storage goes to a free list per size and is reused first.
+	/// - Decommit(): MADV_DONTNEED (MEM_RESET on Windows) on the whole pages of
+	///   released storage. The range stays mapped, so it is reused without any
+	///   recommit: chunks rebuild their free list on Init anyway.
+	/// - Released storage still committed is bounded by cacheBytes: past it,
+	///   ReleasePages decommits the oldest spans down to half of it. The
+	///   releases of the RetentionPolicy give memory back to the OS this way,
+	///   without waiting for a Trim().
+	/// - Requests bigger than a superblock get a mapping of their own.
+	/// - Nothing is unmapped before the destructor.
+	///
+	/// Instance() is never destroyed: chunks can be released by the destructors
+	/// of static allocators until the process exits, the OS takes the mappings back.
+
+	class VirtualPageProvider final : public PageProvider {
+	public:
+		explicit VirtualPageProvider(HugePages hugePages = DEFAULT_HUGE_PAGES,
+			std::size_t superblockSize = DEFAULT_SUPERBLOCK_SIZE,
+			std::size_t cacheBytes = DEFAULT_PROVIDER_CACHE_BYTES);
+		~VirtualPageProvider() override;
+
+		static VirtualPageProvider& Instance() noexcept;
+
+		void* AllocatePages(std::size_t size, std::size_t alignment) override;
+		void  ReleasePages(void* p, std::size_t size) override;
+		void  Decommit() override;
+
+		// released storage not decommitted yet
+		std::size_t GetCommittedFreeBytes();
+
+	private:
+		VirtualPageProvider(const VirtualPageProvider&) = delete;
+		VirtualPageProvider& operator=(const VirtualPageProvider&) = delete;
+
+		struct Region {
+			void* m_base{};
+			std::size_t m_size{};
+		};
+
+		struct Span {
+			void* m_p{};
+			bool m_committed{};
+		};
+
+		void* TakeFreeSpan(std::size_t size, std::size_t alignment);
+		void  DecommitDownTo(std::size_t bytes);
+		void* MapRegion(std::size_t size, std::size_t alignment);
+
+		std::mutex m_mutex;
+		HugePages m_hugePages{};
+		std::size_t m_pageSize{};       // mapping granularity, 2 MB with huge pages
+		std::size_t m_superblockSize{};
+		std::size_t m_cacheBytes{};
+		std::size_t m_committedFreeBytes{}; // released spans still committed
+		unsigned char* m_cursor{};   // first free byte of the current superblock
+		unsigned char* m_end{};
+		using SpanList = std::vector<Span, MallocAllocator<Span>>;
+
+		std::vector<Region, MallocAllocator<Region>> m_regions;
+		std::unordered_map<std::size_t, SpanList, std::hash<std::size_t>, std::equal_to<std::size_t>,
+			MallocAllocator<std::pair<const std::size_t, SpanList>>> m_freeSpans;
+	};
+
+	/// Provider of the fixed allocators when none is given:
+	/// MallocPageProvider if SOA_MALLOC_PAGES is defined, VirtualPageProvider otherwise.
+
+	PageProvider& DefaultPageProvider() noexcept;
+}
+
+#endif // !PAGE_PROVIDER_H
@@ -0,0 +1,32 @@
+#ifndef RETENTION_POLICY_H
+#define RETENTION_POLICY_H
+
+#include <chrono>
+#include <cstddef>
+#include "SOA_defaults.h"
+
+namespace soa {
+
+	/// RetentionPolicy
+	///
+	/// How many empty chunks a fixed allocator keeps for a size class, instead
+	/// of giving their storage back to the PageProvider.
+	/// - m_highWatermark: more empty chunks than this? Release them down to
+	///   m_lowWatermark at once. The gap between the two avoids releasing and
+	///   allocating a chunk again and again when the load oscillates.
+	/// - m_decay: when non zero, empty chunks above the low watermark for
+	///   longer than this are released as well. Checked when a chunk gets
+	///   empty, so an allocator that stops deallocating keeps them until Trim().
+	///
+	/// Keeping more is faster (no provider call on the next spike), releasing
+	/// is smaller. high = low = SIZE_MAX never releases anything,
+	/// high = low = 0 releases every chunk as soon as it is empty.
+
+	struct RetentionPolicy {
+		std::size_t m_highWatermark = DEFAULT_RETAIN_HIGH;
+		std::size_t m_lowWatermark = DEFAULT_RETAIN_LOW;
+		std::chrono::milliseconds m_decay{ 0 };
+	};
+}
+
+#endif // !RETENTION_POLICY_H
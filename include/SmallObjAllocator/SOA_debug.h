@@ -31,13 +31,14 @@
 /// Debug helpers for allocator internals
 /// -----------------------------------------------------------------------------
 
-    inline void SOA_PrintChunks(const std::deque<soa::Chunk>&chunks) {
+    template<typename ChunkT, typename Alloc>
+    inline void SOA_PrintChunks(const std::deque<ChunkT, Alloc>&chunks) {
         std::ostringstream oss;
         oss << "[DEBUG] m_chunks: size=" << chunks.size();
         std::cout << oss.str() << std::endl;
 
         for (std::size_t i = 0; i < chunks.size(); ++i) {
-            const soa::Chunk& c = chunks[i];
+            const ChunkT& c = chunks[i];
             std::ostringstream chunkInfo;
             chunkInfo << "  Chunk[" << i << "] @ " << &c
                 << "  freeBlocks=" << static_cast<int>(c.m_blocksAvailable)
@@ -46,7 +47,8 @@
         }
     }
 
-    inline void SOA_PrintChunkMap(const std::map<std::uintptr_t, soa::Chunk*>&m) {
+    template<typename ChunkT, typename Less, typename Alloc>
+    inline void SOA_PrintChunkMap(const std::map<std::uintptr_t, ChunkT*, Less, Alloc>&m) {
         std::ostringstream oss;
         oss << "[DEBUG] m_chunkMap: size=" << m.size();
         std::cout << oss.str() << std::endl;
@@ -66,8 +68,10 @@
 
 #define SOA_LOG_OSS(x) do {} while(0)
 
-    inline void SOA_PrintChunks([[maybe_unused]] const std::deque<soa::Chunk>&) {}
-    inline void SOA_PrintChunkMap([[maybe_unused]] const std::map<std::uintptr_t, soa::Chunk*>&) {}
+    template<typename ChunkT, typename Alloc>
+    inline void SOA_PrintChunks([[maybe_unused]] const std::deque<ChunkT, Alloc>&) {}
+    template<typename ChunkT, typename Less, typename Alloc>
+    inline void SOA_PrintChunkMap([[maybe_unused]] const std::map<std::uintptr_t, ChunkT*, Less, Alloc>&) {}
 
 #endif // !SOA_DEBUG_LOG_ENABLED
 
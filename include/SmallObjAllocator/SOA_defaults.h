@@ -2,12 +2,85 @@
 #define SOA_DEFAULTS_H
 
 #include <cstddef>
+#include <cstdint>
 
 namespace soa {
 
 	constexpr std::size_t DEFAULT_CHUNK_SIZE = 4096;
 
 	constexpr std::size_t DEFAULT_MAX_OBJ_SIZE = 64;
+
+	// width of the block indices inside a chunk: max 65535 blocks per chunk
+	using ChunkIndex = std::uint16_t;
+
+	// requests are rounded up to a multiple of this, every multiple is a size class
+	constexpr std::size_t DEFAULT_SIZE_GRANULARITY = 8;
+
+	// 0 bytes take the smallest size class, like malloc(0): a unique pointer
+	constexpr std::size_t SizeClassIndex(std::size_t numBytes) noexcept {
+		return numBytes ? (numBytes + DEFAULT_SIZE_GRANULARITY - 1) / DEFAULT_SIZE_GRANULARITY : 1;
+	}
+
+	constexpr std::size_t SizeClassBytes(std::size_t index) noexcept {
+		return index * DEFAULT_SIZE_GRANULARITY;
+	}
+
+	constexpr std::size_t DEFAULT_NUM_SIZE_CLASSES = SizeClassIndex(DEFAULT_MAX_OBJ_SIZE) + 1;
+
+	// chunk storage is aligned to this: a block of size class S is then aligned
+	// to the largest power of two dividing S, up to this value (cache line)
+	constexpr std::size_t DEFAULT_CHUNK_ALIGNMENT = 64;
+
+	// SOA_HARDENED: canary bytes after every block (see Hardened.h). Blocks of
+	// a size class S are S + DEFAULT_REDZONE_SIZE apart, so they are aligned
+	// to DEFAULT_BLOCK_ALIGNMENT at most
+#ifdef SOA_HARDENED
+	constexpr std::size_t DEFAULT_REDZONE_SIZE = 16;
+#else
+	constexpr std::size_t DEFAULT_REDZONE_SIZE = 0;
+#endif
+
+	constexpr std::size_t DEFAULT_BLOCK_ALIGNMENT = DEFAULT_REDZONE_SIZE ? DEFAULT_REDZONE_SIZE : DEFAULT_CHUNK_ALIGNMENT;
+
+	// PageMap: granularity of the address -> size class map. Chunk storage is
+	// aligned to it and a multiple of it, a page belongs to one chunk at most
+	constexpr std::size_t DEFAULT_PAGE_MAP_SHIFT = 12;
+
+	constexpr std::size_t DEFAULT_PAGE_MAP_PAGE = std::size_t(1) << DEFAULT_PAGE_MAP_SHIFT;
+
+	static_assert(DEFAULT_PAGE_MAP_PAGE >= DEFAULT_CHUNK_ALIGNMENT);
+
+	// VirtualPageProvider: chunks are carved from OS mappings of this size
+	constexpr std::size_t DEFAULT_SUPERBLOCK_SIZE = 4 * 1024 * 1024;
+
+	// VirtualPageProvider: released storage kept committed for reuse, past it
+	// the oldest released spans are decommitted down to half of it
+	constexpr std::size_t DEFAULT_PROVIDER_CACHE_BYTES = 4 * 1024 * 1024;
+
+	// ThreadCache: blocks cached per thread and per size, and how many
+	// of them are moved from/to the shared allocator at once
+	constexpr std::size_t DEFAULT_TC_BIN_CAPACITY = 128;
+
+	constexpr std::size_t DEFAULT_TC_BATCH_SIZE = DEFAULT_TC_BIN_CAPACITY / 2;
+
+	// RetentionPolicy: empty chunks kept per size class, over the high
+	// watermark they are released down to the low one
+	constexpr std::size_t DEFAULT_RETAIN_HIGH = 4;
+
+	constexpr std::size_t DEFAULT_RETAIN_LOW = 1;
+
+	// MonotonicArena: size of the first buffer, every new one doubles up to the max
+	constexpr std::size_t DEFAULT_ARENA_BUFFER_SIZE = 64 * 1024;
+
+	constexpr std::size_t DEFAULT_ARENA_MAX_BUFFER_SIZE = 4 * 1024 * 1024;
+
+	// HeapProfiler: mean bytes allocated between two samples, frames kept per
+	// stack, and log2 of the slots of the filter of the sampled addresses
+	constexpr std::size_t DEFAULT_PROFILER_SAMPLE_BYTES = 512 * 1024;
+
+	constexpr std::size_t DEFAULT_PROFILER_MAX_FRAMES = 32;
+
+	constexpr std::size_t DEFAULT_PROFILER_FILTER_BITS = 12;
 }
 
 
@@ -5,6 +5,8 @@
 #include <limits>
 #include <utility>
 #include "SOA_defaults.h"
+#include "SOA_memory.h"
+#include "PageMap.h"
 #include "SmallObjAllocator.h"
 
 namespace soa {
@@ -23,6 +25,34 @@ namespace soa {
 		return;
 	}
 
+	// without the size, see SmallObjAllocator::Deallocate(void*)
+	inline void soa_free(void* p) {
+		SmallObjAllocator::Instance().Deallocate(p);
+	}
+
+	inline void* soa_aligned_malloc(std::size_t n, std::size_t alignment) {
+		if (n == 0) return nullptr;
+		return SmallObjAllocator::Instance().Allocate(n, alignment);
+	}
+
+	inline void soa_aligned_free(void* p, std::size_t n, std::size_t alignment) {
+		if (!p) return;
+
+		SmallObjAllocator::Instance().Deallocate(p, n, alignment);
+		return;
+	}
+
+	// without the size: up to alignof(max_align_t) nothing is AlignedMalloc'ed,
+	// past it only the blocks out of the chunks are
+	inline void soa_aligned_free(void* p, std::size_t alignment) {
+		if (!p) return;
+
+		if (alignment <= alignof(std::max_align_t) || PageMap::Instance().Contains(p))
+			return soa_free(p);
+
+		AlignedFree(p);
+	}
+
 	// C++ functions
 	
 	template<typename T>
@@ -5,6 +5,10 @@
 
 #define SOA_MALLOC(n)        soa::soa_malloc(n)
 #define SOA_FREE(p, n)       soa::soa_free((p), (n))
+#define SOA_FREE_UNSIZED(p)  soa::soa_free((p))
+
+#define SOA_ALIGNED_MALLOC(n, a)   soa::soa_aligned_malloc((n), (a))
+#define SOA_ALIGNED_FREE(p, n, a)  soa::soa_aligned_free((p), (n), (a))
 
 #define SOA_NEW(T, ...)      soa::soa_new<T>(__VA_ARGS__)
 #define SOA_DELETE(T, p)     soa::soa_delete<T>((p))
@@ -0,0 +1,122 @@
+#ifndef SOA_MEMORY_H
+#define SOA_MEMORY_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include "SOA_defaults.h"
+
+#ifdef _MSC_VER
+#include <malloc.h>
+#endif
+
+namespace soa {
+
+	/// Aligned raw memory for chunk storage.
+	/// - alignment must be a power of two.
+	/// - size must be a multiple of alignment (std::aligned_alloc requirement).
+	/// - memory must be released with AlignedFree, never with std::free.
+
+	inline void* AlignedMalloc(std::size_t size, std::size_t alignment) noexcept
+	{
+#ifdef _MSC_VER
+		return _aligned_malloc(size, alignment);
+#else
+		return std::aligned_alloc(alignment, size);
+#endif
+	}
+
+	inline void AlignedFree(void* p) noexcept
+	{
+#ifdef _MSC_VER
+		_aligned_free(p);
+#else
+		std::free(p);
+#endif
+	}
+
+	/// MallocAllocator
+	///
+	/// STL allocator of the containers inside the allocators (pools, size
+	/// class tables, chunk lists, maps). Straight std::malloc/std::free, so
+	/// their bookkeeping never goes through operator new: it stays valid when
+	/// the global operator new/delete are replaced by the small object
+	/// allocator itself, which would otherwise recurse into its own metadata.
+
+	template<typename T>
+	struct MallocAllocator {
+		using value_type = T;
+
+		MallocAllocator() noexcept = default;
+		template<typename U>
+		MallocAllocator(const MallocAllocator<U>&) noexcept {}
+
+		T* allocate(std::size_t n)
+		{
+			if (n > static_cast<std::size_t>(-1) / sizeof(T))
+				throw std::bad_array_new_length();
+
+			if (void* p = std::malloc(n * sizeof(T)))
+				return static_cast<T*>(p);
+			throw std::bad_alloc();
+		}
+
+		void deallocate(T* p, std::size_t) noexcept
+		{
+			std::free(p);
+		}
+
+		template<typename U>
+		bool operator==(const MallocAllocator<U>&) const noexcept { return true; }
+		template<typename U>
+		bool operator!=(const MallocAllocator<U>&) const noexcept { return false; }
+	};
+
+	/// Smallest power of two >= n
+	constexpr std::size_t NextPowerOfTwo(std::size_t n) noexcept
+	{
+		std::size_t p = 1;
+		while (p < n) p <<= 1;
+		return p;
+	}
+
+	constexpr bool IsPowerOfTwo(std::size_t n) noexcept
+	{
+		return n != 0 && (n & (n - 1)) == 0;
+	}
+
+	/// n rounded up to a multiple of alignment (power of two)
+	constexpr std::size_t AlignUp(std::size_t n, std::size_t alignment) noexcept
+	{
+		return (n + alignment - 1) & ~(alignment - 1);
+	}
+
+	/// Aligned requests of the small object allocators.
+	/// True if AlignUp(numBytes, alignment) bytes asked without alignment are
+	/// already aligned enough:
+	/// - up to maxObjSize they come from a size class multiple of alignment,
+	///   carved from DEFAULT_CHUNK_ALIGNMENT aligned chunks (DEFAULT_BLOCK_ALIGNMENT
+	///   at most in hardened mode, blocks are spaced by their redzone).
+	/// - past it std::malloc only guarantees alignof(std::max_align_t).
+	/// Otherwise the request needs AlignedMalloc.
+
+	constexpr bool IsDefaultAligned(std::size_t numBytes, std::size_t alignment,
+		std::size_t maxObjSize) noexcept
+	{
+		return alignment <= alignof(std::max_align_t)
+			|| (alignment <= DEFAULT_BLOCK_ALIGNMENT && AlignUp(numBytes, alignment) <= maxObjSize);
+	}
+
+	/// Bytes asked to the size class of an object of numBytes/alignment,
+	/// 0 when the object doesn't come from a size class (too big, or
+	/// aligned more than the chunks). Same routing as Allocate(n, alignment).
+
+	constexpr std::size_t SizeClassRequest(std::size_t numBytes, std::size_t alignment,
+		std::size_t maxObjSize) noexcept
+	{
+		const std::size_t bytes = AlignUp(numBytes ? numBytes : 1, alignment);
+		return bytes <= maxObjSize && IsDefaultAligned(numBytes, alignment, maxObjSize) ? bytes : 0;
+	}
+}
+
+#endif // !SOA_MEMORY_H
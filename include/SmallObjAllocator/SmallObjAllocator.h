@@ -1,8 +1,11 @@
 #ifndef SMALL_OBJ_ALLOCATOR_H
 #define SMALL_OBJ_ALLOCATOR_H
 
+#include <atomic>
+#include <deque>
 #include <vector>
 #include "SOA_defaults.h"
+#include "SOA_memory.h"
 #include "FixedAllocator.h"
 
 namespace soa {
@@ -40,11 +43,20 @@ namespace soa {
 	/// - Pool can accomodate objects of varyous sizes without growing so much
 	/// - Improvement: keep sorted by size
 	/// 
-	/// Use the same strategy of FixedAllocators to improve lookup speed
+	/// Current approach: constant time dispatch, still paying only for used sizes.
+	/// - Requests are rounded up to DEFAULT_SIZE_GRANULARITY: every multiple of
+	///   it is a size class (16, 24, 32, 48... each keep their own allocator).
+	/// - m_table[SizeClassIndex(size)] points straight to the FixedAllocator of
+	///   that class. Only a pointer per class is wasted for unused sizes.
+	/// - FixedAllocators are created lazily, on the first request of a class,
+	///   and appended to a std::deque: they are never moved or copied, so the
+	///   pointers in the table stay valid.
 
 	class SmallObjAllocator {
 	public:
-		SmallObjAllocator(std::size_t chunkSize, std::size_t maxObjectSize);
+		SmallObjAllocator(std::size_t chunkSize, std::size_t maxObjectSize,
+			PageProvider* provider = nullptr,
+			const RetentionPolicy& retention = RetentionPolicy());
 
 		static SmallObjAllocator& Instance() noexcept
 		{
@@ -55,18 +67,56 @@ namespace soa {
 		void* Allocate(std::size_t numBytes);
 		void  Deallocate(void* p, std::size_t size);
 
+		// without the size: size class and chunk come from the PageMap, pointers
+		// that are not in any chunk are malloc fallbacks
+		void  Deallocate(void* p);
+
+		// alignment: power of two, same values on Allocate and Deallocate
+		void* Allocate(std::size_t numBytes, std::size_t alignment);
+		void  Deallocate(void* p, std::size_t size, std::size_t alignment);
+
+		// fixed allocator of the size class of numBytes (<= maxObjectSize),
+		// created on first use. Valid as long as the allocator: a size known
+		// at compile time is looked up once, see SOABackend::AllocateNode
+		FixedAllocator& GetFixedAllocator(std::size_t numBytes);
+
+		// n objects of the same size at once
+		std::size_t AllocateBatch(std::size_t numBytes, std::size_t n, void** out);
+		void DeallocateBatch(std::size_t numBytes, std::size_t n, void** in);
+
+		// frees every empty chunk, then decommits the released storage
+		// of the provider. Returns how many chunks were freed
+		std::size_t Trim();
+		// arena use: every block of every size class is freed at once,
+		// no per-object Deallocate. Requests bigger than maxObjectSize
+		// are not tracked, they still need their own Deallocate.
+		// Reset keeps the chunks up to the high watermark of the
+		// RetentionPolicy, Release frees all of them (returns how many)
+		void Reset();
+		std::size_t Release();
+
+		// size classes created later get it as well
+		void SetRetentionPolicy(const RetentionPolicy& retention);
+
+		// per size class counters, callable from any thread while the
+		// allocator is in use (relaxed reads, see FixedAllocatorStats)
+		AllocatorSnapshot Snapshot() const;
+
 	private:
 		SmallObjAllocator(const SmallObjAllocator& i_other) = delete;
 		SmallObjAllocator& operator=(const SmallObjAllocator& i_other) = delete;
 		SmallObjAllocator(const SmallObjAllocator&& i_other) = delete;
 		SmallObjAllocator& operator=(const SmallObjAllocator&& i_other) = delete;
 
-		std::vector<FixedAllocator> m_Pool{};
-		FixedAllocator* m_pLastAlloc{};
-		FixedAllocator* m_pLastDealloc{};
+		FixedAllocator& CreateFixedAllocator(std::size_t index);
+
+		std::deque<FixedAllocator, MallocAllocator<FixedAllocator>> m_Pool{};
+		std::vector<std::atomic<FixedAllocator*>, MallocAllocator<std::atomic<FixedAllocator*>>> m_table{};
 
 		std::size_t m_chunkSize{};
 		std::size_t m_maxObjSize{};
+		PageProvider* m_provider{};
+		RetentionPolicy m_retention{};
 	};
 }
 
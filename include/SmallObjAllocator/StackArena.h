@@ -0,0 +1,52 @@
+#ifndef STACK_ARENA_H
+#define STACK_ARENA_H
+
+#include "MonotonicArena.h"
+
+namespace soa {
+
+	/// StackArena
+	///
+	/// MonotonicArena with markers: GetMarker() saves the bump pointer,
+	/// Rollback(marker) frees everything allocated after it in O(1).
+	/// Markers nest as a stack, rolling back to a marker invalidates the
+	/// ones saved after it. Buffers are kept, as by Reset().
+	/// - Deallocate of the last block (LIFO) gives its bytes back at once,
+	///   any other is a no-op until the next rollback.
+	/// - Scope rolls back to the marker taken at construction.
+
+	class StackArena : public MonotonicArena {
+	public:
+		struct Marker {
+			Buffer* m_buffer;
+			char* m_cur;
+		};
+
+		class Scope {
+		public:
+			explicit Scope(StackArena& arena) noexcept
+				: m_arena(arena), m_marker(arena.GetMarker()) {
+			}
+
+			~Scope() { m_arena.Rollback(m_marker); }
+
+			Scope(const Scope&) = delete;
+			Scope& operator=(const Scope&) = delete;
+
+		private:
+			StackArena& m_arena;
+			Marker m_marker;
+		};
+
+		using MonotonicArena::MonotonicArena;
+
+		void Deallocate(void* p, std::size_t numBytes) noexcept;
+		void Deallocate(void* p, std::size_t numBytes, std::size_t alignment) noexcept;
+
+		Marker GetMarker() const noexcept { return { m_current, m_cur }; }
+		void Rollback(const Marker& marker) noexcept;
+	};
+}
+
+
+#endif // !STACK_ARENA_H
@@ -0,0 +1,304 @@
+#ifndef STATIC_FIXED_ALLOCATOR_H
+#define STATIC_FIXED_ALLOCATOR_H
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "SOA_defaults.h"
+#include "SOA_memory.h"
+#include "PageProvider.h"
+#include "PageMap.h"
+#include "RetentionPolicy.h"
+
+namespace soa {
+
+	/// StaticFixedAllocator
+	///
+	/// FixedAllocator with the block size and the number of blocks per chunk
+	/// known at compile time. Same chunk layout (free list of indices inside
+	/// the unused blocks) and same strategies (allocChunk / deallocChunk, the
+	/// chunk of a block found by its index in the PageMap, empty chunks moved
+	/// to the end and released past the high watermark of the RetentionPolicy,
+	/// storage from a PageProvider and registered in the PageMap).
+	///
+	/// - Block address and index arithmetic use constants: shifts or a
+	///   multiply by a constant instead of the divisions of the runtime version.
+	/// - The index type is the narrowest one that counts BlocksPerChunk.
+	/// - Header only, unlike FixedAllocator: Allocate/Deallocate fast paths
+	///   are inlined at the call site, only chunk refill and search are not.
+	///
+	/// Not thread-safe. Non copyable: a size known at compile time belongs
+	/// to one owner (a pool of a type, a node allocator...).
+
+	template<std::size_t BlockSize, std::size_t BlocksPerChunk = DEFAULT_CHUNK_SIZE / BlockSize>
+	class StaticFixedAllocator {
+	public:
+
+		using IndexT = std::conditional_t<(BlocksPerChunk <= 0xFF), std::uint8_t,
+			std::conditional_t<(BlocksPerChunk <= 0xFFFF), std::uint16_t, std::uint32_t>>;
+
+		static constexpr std::size_t BLOCK_SIZE = BlockSize;
+		static constexpr std::size_t NUM_BLOCKS = BlocksPerChunk;
+		static constexpr std::size_t CHUNK_LENGTH = BlockSize * BlocksPerChunk;
+		static constexpr std::size_t CHUNK_BYTES = AlignUp(CHUNK_LENGTH, DEFAULT_PAGE_MAP_PAGE); // whole PageMap pages
+
+		static_assert(BlockSize >= sizeof(IndexT), "a free block must hold the index of the next one");
+		static_assert(BlocksPerChunk > 0 && BlocksPerChunk <= 0xFFFFFFFF, "BlocksPerChunk out of range");
+		static_assert(CHUNK_LENGTH / BlockSize == BlocksPerChunk, "chunk size overflow");
+
+		explicit StaticFixedAllocator(PageProvider* provider = nullptr,
+			const RetentionPolicy& retention = RetentionPolicy())
+			: m_provider(provider ? provider : &DefaultPageProvider())
+			, m_retention(retention) {
+		}
+
+		~StaticFixedAllocator() { Release(); }
+
+		StaticFixedAllocator(const StaticFixedAllocator&) = delete;
+		StaticFixedAllocator& operator=(const StaticFixedAllocator&) = delete;
+
+		// nullptr when out of memory
+		void* Allocate()
+		{
+			if (!m_allocChunk || m_allocChunk->m_blocksAvailable == 0) [[unlikely]]
+				return AllocateSlow();
+
+			if (m_allocChunk->m_blocksAvailable == NUM_BLOCKS) --m_emptyChunks;
+			return m_allocChunk->Allocate();
+		}
+
+		void Deallocate(void* p)
+		{
+			assert(!m_chunks.empty() && m_deallocChunk);
+
+			if (!m_deallocChunk->Contains(p)) [[unlikely]]
+				m_deallocChunk = FindChunk(p);
+
+			m_deallocChunk->Deallocate(p);
+
+			if (m_deallocChunk->m_blocksAvailable == NUM_BLOCKS) [[unlikely]]
+				OnEmptyChunk();
+		}
+
+		// frees the empty chunks beyond keep, returns how many
+		std::size_t Trim(std::size_t keep = 0);
+		// frees every chunk, returns how many. Live blocks become invalid
+		std::size_t Release();
+
+		std::size_t GetNumChunks() const { return m_chunks.size(); }
+		std::size_t GetNumEmptyChunks() const { return m_emptyChunks; }
+
+	private:
+
+		struct StaticChunk {
+			unsigned char* m_pData;
+			IndexT m_firstAvailableBlock;
+			std::size_t m_blocksAvailable;
+
+			void Init(void* storage)
+			{
+				m_pData = static_cast<unsigned char*>(storage);
+				m_firstAvailableBlock = 0;
+				m_blocksAvailable = NUM_BLOCKS;
+
+				unsigned char* p = m_pData;
+				for (std::size_t i = 1; i <= NUM_BLOCKS; p += BLOCK_SIZE, ++i)
+				{
+					const IndexT next = static_cast<IndexT>(i);
+					std::memcpy(p, &next, sizeof(IndexT));
+				}
+			}
+
+			void* Allocate()
+			{
+				unsigned char* pResult = m_pData + std::size_t(m_firstAvailableBlock) * BLOCK_SIZE;
+				std::memcpy(&m_firstAvailableBlock, pResult, sizeof(IndexT));
+				--m_blocksAvailable;
+				return pResult;
+			}
+
+			void Deallocate(void* p)
+			{
+				unsigned char* pToRelease = static_cast<unsigned char*>(p);
+				const std::size_t offset = static_cast<std::size_t>(pToRelease - m_pData);
+
+				assert(offset % BLOCK_SIZE == 0);
+
+				std::memcpy(pToRelease, &m_firstAvailableBlock, sizeof(IndexT));
+				m_firstAvailableBlock = static_cast<IndexT>(offset / BLOCK_SIZE);
+				++m_blocksAvailable;
+			}
+
+			bool Contains(const void* p) const
+			{
+				return p >= m_pData && p < m_pData + CHUNK_LENGTH;
+			}
+		};
+
+		void* AllocateSlow();
+		StaticChunk* FindChunk(const void* p);
+		void OnEmptyChunk();
+		void ReleaseChunk(StaticChunk& chunk);
+
+		// the PageMap tag of a chunk is its index in m_chunks
+		void TagChunk(const StaticChunk& chunk)
+		{
+			PageMap::Instance().SetChunk(chunk.m_pData, CHUNK_BYTES, PageMap::IndexTag(&chunk - m_chunks.data()));
+		}
+
+		std::vector<StaticChunk, MallocAllocator<StaticChunk>> m_chunks;
+		StaticChunk* m_allocChunk = nullptr;
+		StaticChunk* m_deallocChunk = nullptr;
+		std::size_t m_emptyChunks{};
+
+		PageProvider* m_provider{};
+		RetentionPolicy m_retention{};
+	};
+
+	/// -----------------------------------------------------------------------------
+	/// StaticFixedAllocator::AllocateSlow
+	/// -----------------------------------------------------------------------------
+	/// allocChunk is full: first chunk with a free block, or a new one
+
+	template<std::size_t BlockSize, std::size_t BlocksPerChunk>
+	void* StaticFixedAllocator<BlockSize, BlocksPerChunk>::AllocateSlow()
+	{
+		for (StaticChunk& chunk : m_chunks)
+		{
+			if (chunk.m_blocksAvailable > 0)
+			{
+				m_allocChunk = &chunk;
+				return Allocate();
+			}
+		}
+
+		void* storage = m_provider->AllocatePages(CHUNK_BYTES, DEFAULT_PAGE_MAP_PAGE);
+		if (!storage) return nullptr;
+
+		if (!PageMap::Instance().Register(storage, CHUNK_BYTES, BLOCK_SIZE, PageMap::IndexTag(m_chunks.size())))
+		{
+			m_provider->ReleasePages(storage, CHUNK_BYTES);
+			return nullptr;
+		}
+
+		StaticChunk chunk;
+		chunk.Init(storage);
+		m_chunks.push_back(chunk);
+		++m_emptyChunks;
+
+		m_allocChunk = &m_chunks.back();
+		m_deallocChunk = m_allocChunk;
+		return Allocate();
+	}
+
+	/// -----------------------------------------------------------------------------
+	/// StaticFixedAllocator::FindChunk
+	/// -----------------------------------------------------------------------------
+	/// Index of the chunk in the PageMap, as FixedAllocator::FindChunk
+
+	template<std::size_t BlockSize, std::size_t BlocksPerChunk>
+	auto StaticFixedAllocator<BlockSize, BlocksPerChunk>::FindChunk(const void* p) -> StaticChunk*
+	{
+		const std::uintptr_t tag = PageMap::Instance().Chunk(p);
+		const std::size_t index = tag >> 1;
+
+		assert(PageMap::IsIndexTag(tag) && index < m_chunks.size() && m_chunks[index].Contains(p)); // p not in any chunk
+
+		return &m_chunks[index];
+	}
+
+	/// -----------------------------------------------------------------------------
+	/// StaticFixedAllocator::OnEmptyChunk
+	/// -----------------------------------------------------------------------------
+	/// deallocChunk just became empty: moved to the end, then released down to
+	/// the low watermark once the empty chunks are past the high one
+
+	template<std::size_t BlockSize, std::size_t BlocksPerChunk>
+	void StaticFixedAllocator<BlockSize, BlocksPerChunk>::OnEmptyChunk()
+	{
+		++m_emptyChunks;
+
+		StaticChunk& lastChunk = m_chunks.back();
+
+		if (&lastChunk != m_deallocChunk && lastChunk.m_blocksAvailable != NUM_BLOCKS)
+		{
+			std::swap(*m_deallocChunk, lastChunk);
+			TagChunk(*m_deallocChunk);
+			TagChunk(lastChunk);
+			m_allocChunk = &m_chunks.back();
+		}
+
+		if (m_emptyChunks > m_retention.m_highWatermark)
+			Trim(m_retention.m_lowWatermark);
+	}
+
+	/// -----------------------------------------------------------------------------
+	/// StaticFixedAllocator::Trim
+	/// -----------------------------------------------------------------------------
+
+	template<std::size_t BlockSize, std::size_t BlocksPerChunk>
+	std::size_t StaticFixedAllocator<BlockSize, BlocksPerChunk>::Trim(std::size_t keep)
+	{
+		std::size_t released = 0;
+
+		for (std::size_t i = m_chunks.size(); i-- > 0 && m_emptyChunks > keep; )
+		{
+			if (m_chunks[i].m_blocksAvailable != NUM_BLOCKS)
+				continue;
+
+			ReleaseChunk(m_chunks[i]);
+			m_chunks[i] = m_chunks.back();
+			m_chunks.pop_back();
+			if (i < m_chunks.size()) TagChunk(m_chunks[i]);
+			--m_emptyChunks;
+			++released;
+		}
+
+		if (released)
+		{
+			m_allocChunk = m_chunks.empty() ? nullptr : &m_chunks.back();
+			m_deallocChunk = m_chunks.empty() ? nullptr : &m_chunks.front();
+		}
+
+		return released;
+	}
+
+	/// -----------------------------------------------------------------------------
+	/// StaticFixedAllocator::Release
+	/// -----------------------------------------------------------------------------
+
+	template<std::size_t BlockSize, std::size_t BlocksPerChunk>
+	std::size_t StaticFixedAllocator<BlockSize, BlocksPerChunk>::Release()
+	{
+		const std::size_t released = m_chunks.size();
+
+		for (StaticChunk& chunk : m_chunks)
+			ReleaseChunk(chunk);
+
+		m_chunks.clear();
+		m_allocChunk = m_deallocChunk = nullptr;
+		m_emptyChunks = 0;
+
+		return released;
+	}
+
+	/// -----------------------------------------------------------------------------
+	/// StaticFixedAllocator::ReleaseChunk
+	/// -----------------------------------------------------------------------------
+
+	template<std::size_t BlockSize, std::size_t BlocksPerChunk>
+	void StaticFixedAllocator<BlockSize, BlocksPerChunk>::ReleaseChunk(StaticChunk& chunk)
+	{
+		PageMap::Instance().Unregister(chunk.m_pData, CHUNK_BYTES);
+		m_provider->ReleasePages(chunk.m_pData, CHUNK_BYTES);
+		chunk.m_pData = nullptr;
+	}
+}
+
+
+#endif // !STATIC_FIXED_ALLOCATOR_H
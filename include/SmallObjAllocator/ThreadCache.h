@@ -0,0 +1,422 @@
+#ifndef THREAD_CACHE_H
+#define THREAD_CACHE_H
+
+#include <cassert>
+#include <cstddef>
+#include <cstdlib>
+#include <mutex>
+#include "SOA_defaults.h"
+#include "SOA_memory.h"
+#include "PageMap.h"
+#include "HeapProfiler.h"
+#include "Hardened.h"
+#include "OwnerScope.h"
+
+namespace soa {
+
+	/// ThreadCache
+	///
+	/// - Per-thread front end for a shared small object allocator
+	///   (SmallObjAllocator or CtmSmallObjAllocator).
+	/// - Every thread owns one bin per size class. A bin is a small
+	///   stack of free blocks: allocation and deallocation on the fast path
+	///   are a pop/push on it and touch no shared state at all.
+	/// - Empty bin? Refill it with a batch of blocks taken from the shared
+	///   allocator (AllocateBatch), paying a single lock acquisition for the
+	///   whole batch.
+	/// - Full bin? Drain half of it back to the shared allocator
+	///   (DeallocateBatch), again under a single lock.
+	/// - When a thread exits, its cache destructor flushes every bin back.
+	///
+	/// Blocks can be freed by a thread different from the one that
+	/// allocated them: they just end up in the bin of the freeing thread.
+	///
+	/// The shared allocator is still not thread-safe by itself. Every access
+	/// made from here is serialized with one mutex per allocator type, so
+	/// don't mix cached calls with direct Instance() calls coming from other threads.
+	/// The lock holder acts as owner of the CtmFixedAllocators it reaches
+	/// (SerializedLock): a size class created by a thread that exited is
+	/// still freed to, drained and trimmed by the others.
+	///
+	/// Bins store pointers in a side array instead of an intrusive list,
+	/// so they work for any block size and never touch cold block memory.
+	///
+	/// SOA_HARDENED: a block is checked when it enters a bin (ownership,
+	/// canary, not already cached in that bin or freed to its chunk), see
+	/// Hardened.h.
+	///
+	/// Destructors of thread_local and static objects can still allocate and
+	/// free after the cache of their thread is gone: Current() is nullptr
+	/// from there on, such calls must go to Allocator::Instance() under
+	/// SerializedLock themselves.
+
+	template<typename Allocator>
+	class ThreadCache {
+	public:
+
+		static ThreadCache& Local() noexcept
+		{
+			thread_local ThreadCache cache;
+			return cache;
+		}
+
+		// Local(), or nullptr once the cache of the calling thread is destroyed
+		static ThreadCache* Current() noexcept
+		{
+			return s_destroyed ? nullptr : &Local();
+		}
+
+		// serializes every access to Allocator::Instance() made by the caches
+		static std::mutex& SharedMutex() noexcept
+		{
+			static std::mutex sharedMutex;
+			return sharedMutex;
+		}
+
+		// SharedMutex() held for the lifetime of the object, the calling thread
+		// acting as owner of the size classes it touches (SerializedOwnerScope).
+		// Direct calls to Allocator::Instance() take it as well, e.g. Trim()
+		class SerializedLock {
+		public:
+			SerializedLock() : m_lock(SharedMutex()) {}
+
+		private:
+			std::lock_guard<std::mutex> m_lock;
+			SerializedOwnerScope m_owner; // closed before the unlock
+		};
+
+		void* Allocate(std::size_t numBytes);
+		void  Deallocate(void* p, std::size_t numBytes);
+		void  Deallocate(void* p); // size from the PageMap
+		void* Allocate(std::size_t numBytes, std::size_t alignment);
+		void  Deallocate(void* p, std::size_t numBytes, std::size_t alignment);
+		std::size_t AllocateBatch(std::size_t numBytes, std::size_t n, void** out);
+		void  DeallocateBatch(std::size_t numBytes, std::size_t n, void** in);
+		void  Flush();
+
+		~ThreadCache();
+
+	private:
+
+		struct Bin {
+			void** m_slots{};
+			std::size_t m_count{};
+		};
+
+		ThreadCache() = default;
+		ThreadCache(const ThreadCache&) = delete;
+		ThreadCache& operator=(const ThreadCache&) = delete;
+
+		static bool InitBin(Bin& bin) noexcept
+		{
+			if (!bin.m_slots)
+				bin.m_slots = static_cast<void**>(std::malloc(DEFAULT_TC_BIN_CAPACITY * sizeof(void*)));
+			return bin.m_slots != nullptr;
+		}
+
+		bool Refill(Bin& bin, std::size_t numBytes);
+		void Drain(Bin& bin, std::size_t numBytes, std::size_t count);
+
+#ifdef SOA_HARDENED
+		static bool CheckFree(const Bin& bin, void* p, std::size_t blockSize) noexcept;
+#endif
+
+		Bin m_bins[DEFAULT_NUM_SIZE_CLASSES]{};
+
+		static thread_local bool s_destroyed; // trivially destructible, valid until the thread ends
+	};
+
+	template<typename Allocator>
+	thread_local bool ThreadCache<Allocator>::s_destroyed = false;
+
+	/// -----------------------------------------------------------------------------
+	/// ThreadCache::Allocate
+	/// -----------------------------------------------------------------------------
+	/// Requests bigger than the max small object size go straight to the
+	/// default allocator, as the shared allocator would do.
+
+	template<typename Allocator>
+	void* ThreadCache<Allocator>::Allocate(std::size_t numBytes)
+	{
+		if (numBytes > DEFAULT_MAX_OBJ_SIZE)
+			return std::malloc(numBytes);
+
+		const std::size_t index = SizeClassIndex(numBytes);
+		Bin& bin = m_bins[index];
+
+		if (bin.m_count == 0 && !Refill(bin, SizeClassBytes(index)))
+			return nullptr;
+
+		void* p = bin.m_slots[--bin.m_count];
+
+		// sampled here, not in the AllocateBatch of the refill
+		if (HeapProfiler::Tick(SizeClassBytes(index))) [[unlikely]]
+			HeapProfiler::Instance().RecordAllocation(&Allocator::Instance(), p, SizeClassBytes(index));
+
+		return p;
+	}
+
+	/// -----------------------------------------------------------------------------
+	/// ThreadCache::Deallocate
+	/// -----------------------------------------------------------------------------
+
+	template<typename Allocator>
+	void ThreadCache<Allocator>::Deallocate(void* p, std::size_t numBytes)
+	{
+		if (numBytes > DEFAULT_MAX_OBJ_SIZE)
+		{
+#ifdef SOA_HARDENED
+			if (!hardened::CheckNotInChunk(p)) return;
+#endif
+			return std::free(p);
+		}
+
+		const std::size_t index = SizeClassIndex(numBytes);
+		Bin& bin = m_bins[index];
+		numBytes = SizeClassBytes(index);
+
+#ifdef SOA_HARDENED
+		if (!CheckFree(bin, p, numBytes)) return;
+#endif
+
+		HeapProfiler::OnFree(p);
+
+		// the block can come from another thread, so this bin may be still unused
+		if (!InitBin(bin))
+		{
+			SerializedLock lock;
+			Allocator::Instance().Deallocate(p, numBytes);
+			return;
+		}
+
+		if (bin.m_count == DEFAULT_TC_BIN_CAPACITY)
+			Drain(bin, numBytes, DEFAULT_TC_BATCH_SIZE);
+
+		bin.m_slots[bin.m_count++] = p;
+	}
+
+	/// -----------------------------------------------------------------------------
+	/// ThreadCache::Deallocate (size-less)
+	/// -----------------------------------------------------------------------------
+
+	template<typename Allocator>
+	void ThreadCache<Allocator>::Deallocate(void* p)
+	{
+		if (!p) return;
+
+		const std::size_t blockSize = PageMap::Instance().BlockSize(p);
+
+		if (!blockSize)
+			return std::free(p);
+
+		assert(blockSize <= DEFAULT_MAX_OBJ_SIZE);
+		Deallocate(p, blockSize);
+	}
+
+	/// -----------------------------------------------------------------------------
+	/// ThreadCache::Allocate (aligned)
+	/// -----------------------------------------------------------------------------
+	/// Same rounding as the shared allocators, see IsDefaultAligned
+
+	template<typename Allocator>
+	void* ThreadCache<Allocator>::Allocate(std::size_t numBytes, std::size_t alignment)
+	{
+		assert(IsPowerOfTwo(alignment));
+
+		if (IsDefaultAligned(numBytes, alignment, DEFAULT_MAX_OBJ_SIZE))
+			return Allocate(AlignUp(numBytes, alignment));
+
+		return AlignedMalloc(AlignUp(numBytes, alignment), alignment);
+	}
+
+	/// -----------------------------------------------------------------------------
+	/// ThreadCache::Deallocate (aligned)
+	/// -----------------------------------------------------------------------------
+
+	template<typename Allocator>
+	void ThreadCache<Allocator>::Deallocate(void* p, std::size_t numBytes, std::size_t alignment)
+	{
+		assert(IsPowerOfTwo(alignment));
+
+		if (IsDefaultAligned(numBytes, alignment, DEFAULT_MAX_OBJ_SIZE))
+			return Deallocate(p, AlignUp(numBytes, alignment));
+
+		AlignedFree(p);
+	}
+
+	/// -----------------------------------------------------------------------------
+	/// ThreadCache::AllocateBatch
+	/// -----------------------------------------------------------------------------
+	/// Cached blocks first. What the bin can't give comes straight from the
+	/// shared allocator with one AllocateBatch under one lock, without
+	/// refilling the bin first.
+
+	template<typename Allocator>
+	std::size_t ThreadCache<Allocator>::AllocateBatch(std::size_t numBytes, std::size_t n, void** out)
+	{
+		if (numBytes > DEFAULT_MAX_OBJ_SIZE)
+		{
+			for (std::size_t i = 0; i < n; ++i)
+			{
+				out[i] = std::malloc(numBytes);
+				if (!out[i]) return i;
+			}
+			return n;
+		}
+
+		const std::size_t index = SizeClassIndex(numBytes);
+		Bin& bin = m_bins[index];
+
+		std::size_t taken = 0;
+		while (taken < n && bin.m_count > 0)
+			out[taken++] = bin.m_slots[--bin.m_count];
+
+		if (taken == n) return n;
+
+		SerializedLock lock;
+		return taken + Allocator::Instance().AllocateBatch(SizeClassBytes(index), n - taken, out + taken);
+	}
+
+	/// -----------------------------------------------------------------------------
+	/// ThreadCache::DeallocateBatch
+	/// -----------------------------------------------------------------------------
+	/// Fills the bin, what doesn't fit goes back with one DeallocateBatch
+
+	template<typename Allocator>
+	void ThreadCache<Allocator>::DeallocateBatch(std::size_t numBytes, std::size_t n, void** in)
+	{
+#ifdef SOA_HARDENED
+		// one Deallocate per block, every one is checked
+		for (std::size_t i = 0; i < n; ++i) Deallocate(in[i], numBytes);
+#else
+		if (numBytes > DEFAULT_MAX_OBJ_SIZE)
+		{
+			for (std::size_t i = 0; i < n; ++i) std::free(in[i]);
+			return;
+		}
+
+		const std::size_t index = SizeClassIndex(numBytes);
+		Bin& bin = m_bins[index];
+
+		for (std::size_t i = 0; i < n; ++i) HeapProfiler::OnFree(in[i]);
+
+		std::size_t given = 0;
+		if (InitBin(bin))
+		{
+			while (given < n && bin.m_count < DEFAULT_TC_BIN_CAPACITY)
+				bin.m_slots[bin.m_count++] = in[given++];
+		}
+
+		if (given == n) return;
+
+		SerializedLock lock;
+		Allocator::Instance().DeallocateBatch(SizeClassBytes(index), n - given, in + given);
+#endif
+	}
+
+	/// -----------------------------------------------------------------------------
+	/// ThreadCache::Flush
+	/// -----------------------------------------------------------------------------
+	/// Gives back every cached block to the shared allocator
+
+	template<typename Allocator>
+	void ThreadCache<Allocator>::Flush()
+	{
+		for (std::size_t index = 1; index < DEFAULT_NUM_SIZE_CLASSES; ++index)
+		{
+			if (m_bins[index].m_count)
+				Drain(m_bins[index], SizeClassBytes(index), m_bins[index].m_count);
+		}
+	}
+
+	/// -----------------------------------------------------------------------------
+	/// ThreadCache dtor
+	/// -----------------------------------------------------------------------------
+	/// Runs at thread exit. Thread local objects are destroyed before the
+	/// static ones, so the shared allocator is still alive here.
+
+	template<typename Allocator>
+	ThreadCache<Allocator>::~ThreadCache()
+	{
+		Flush();
+
+		for (Bin& bin : m_bins)
+		{
+			std::free(bin.m_slots);
+			bin.m_slots = nullptr;
+		}
+
+		s_destroyed = true;
+	}
+
+	/// -----------------------------------------------------------------------------
+	/// ThreadCache::Refill
+	/// -----------------------------------------------------------------------------
+
+	template<typename Allocator>
+	bool ThreadCache<Allocator>::Refill(Bin& bin, std::size_t numBytes)
+	{
+		assert(bin.m_count == 0);
+
+		if (!InitBin(bin)) return false;
+
+		SerializedLock lock;
+		bin.m_count = Allocator::Instance().AllocateBatch(numBytes, DEFAULT_TC_BATCH_SIZE, bin.m_slots);
+
+		return bin.m_count > 0;
+	}
+
+#ifdef SOA_HARDENED
+
+	/// -----------------------------------------------------------------------------
+	/// ThreadCache::CheckFree
+	/// -----------------------------------------------------------------------------
+	/// false: reported, the block must not be cached. A block already given
+	/// back to its chunk is poisoned, redzone included.
+
+	template<typename Allocator>
+	bool ThreadCache<Allocator>::CheckFree(const Bin& bin, void* p, std::size_t blockSize) noexcept
+	{
+		if (!hardened::CheckOwnership(p, blockSize))
+			return false;
+
+		for (std::size_t i = 0; i < bin.m_count; ++i)
+		{
+			if (bin.m_slots[i] == p)
+			{
+				ReportHardened(HardenedError::DoubleFree, p, blockSize);
+				return false;
+			}
+		}
+
+		unsigned char* block = static_cast<unsigned char*>(p);
+		const std::size_t stride = blockSize + DEFAULT_REDZONE_SIZE;
+
+		if (hardened::CheckCanary(block, stride))
+			return true;
+
+		const bool freed = hardened::IsPoisoned(block, blockSize, stride);
+		ReportHardened(freed ? HardenedError::DoubleFree : HardenedError::Overflow, p, blockSize);
+		return !freed;
+	}
+
+#endif
+
+	/// -----------------------------------------------------------------------------
+	/// ThreadCache::Drain
+	/// -----------------------------------------------------------------------------
+	/// Releases the top count blocks of a bin
+
+	template<typename Allocator>
+	void ThreadCache<Allocator>::Drain(Bin& bin, std::size_t numBytes, std::size_t count)
+	{
+		assert(count <= bin.m_count);
+
+		bin.m_count -= count;
+
+		SerializedLock lock;
+		Allocator::Instance().DeallocateBatch(numBytes, count, bin.m_slots + bin.m_count);
+	}
+}
+
+#endif // !THREAD_CACHE_H
@@ -2,10 +2,26 @@
 #define BENCHMARK_H
 
 #include <chrono>
+#include <cstdio>
 #include <utility> // std::forward
 #include <iostream>
 #include <cassert>
+#include <vector>
+#include <thread>
+#include <latch>
+#include <barrier>
+#include <atomic>
+#include <mutex>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory_resource>
 #include "BmkAllocator.h"
+#include "Runner.h"
+#include "mema\STL_Allocator.h"
+#include "SmallObjAllocator\AllocatorStats.h"
+#include "SmallObjAllocator\FixedAllocator.h"
+#include "SmallObjAllocator\StaticFixedAllocator.h"
 
 namespace bmk {
 
@@ -17,17 +33,28 @@ namespace bmk {
     struct BenchmarkResults
     {
         std::size_t Operations;
-        std::chrono::milliseconds Milliseconds;
+        std::chrono::nanoseconds Elapsed;
         double OpsPerSec;        // ops / second
-        double MsPerOp;          // ms / operation
+        double NsPerOp;          // ns / operation
     };
 
+    struct ScalingPoint
+    {
+        std::size_t Threads;
+        BenchmarkResults Results;
+    };
+
+    /// Single threaded benchmarks go through the Runner (see Runner.h):
+    /// warmup, repetitions, ns timing per phase and sampled per operation
+    /// latencies. Multi-threaded ones report the median wall time of the
+    /// repetitions, workers pinned one per CPU when PinCpu >= 0.
+
 	class Benchmark {
-    
+
     public:
 
-        explicit Benchmark(std::size_t i_nOperations)
-            : m_numOfOperations(i_nOperations) {
+        explicit Benchmark(std::size_t i_nOperations, const RunnerOptions& options = RunnerOptions())
+            : m_numOfOperations(i_nOperations), m_runner(options) {
         }
 
         // trends for Small Objects (only allocation and deallocation)
@@ -43,28 +70,91 @@ namespace bmk {
         template <typename AllocBackend>
         void BenchButterfly(BmkAllocator<AllocBackend>&, std::size_t size);
 
+        // objects allocated and freed batchSize at a time, one by one vs AllocateBatch/FreeBatch
+        template <typename AllocBackend>
+        void BenchBatch(BmkAllocator<AllocBackend>&, std::size_t size, std::size_t batchSize);
+
+        // objects allocated groupSize at a time on an arena, freed one by one vs one Reset
+        // (AllocBackend: mema::InstanceBackend)
+        template <typename AllocBackend>
+        void BenchReset(BmkAllocator<AllocBackend>&, std::size_t size, std::size_t groupSize);
+
+        // FixedAllocator(Size) vs StaticFixedAllocator<Size>, same chunk size
+        template <std::size_t Size>
+        void BenchStaticFixed();
+
+        // node based std::pmr containers (list, map) filled and destroyed on resource
+        void BenchPmrNodes(const char* name, std::pmr::memory_resource& resource);
+
+        // same trend run by numThreads threads at once (m_numOfOperations each)
+        template <typename AllocBackend>
+        void BenchButterflyThreads(BmkAllocator<AllocBackend>&, std::size_t size, std::size_t numThreads);
+
+        // scaling curves, run on 1, 2, 4... maxThreads threads (m_numOfOperations
+        // each). AllocBackend must be thread safe (SystemBackend, ThreadCacheBackend)
+
+        // every thread replaces random blocks of its own working set
+        template <typename AllocBackend>
+        void BenchChurnThreads(BmkAllocator<AllocBackend>&, std::size_t minSize, std::size_t maxSize, std::size_t maxThreads);
+
+        // pairs of threads: one allocates, the other frees (maxThreads / 2 pairs at most)
+        template <typename AllocBackend>
+        void BenchProducerConsumer(BmkAllocator<AllocBackend>&, std::size_t size, std::size_t maxThreads);
+
+        // Larson-style: random replacements in working sets that move to
+        // another thread every round, so most frees are remote
+        template <typename AllocBackend>
+        void BenchLarson(BmkAllocator<AllocBackend>&, std::size_t minSize, std::size_t maxSize, std::size_t maxThreads);
+
+        // one std::map behind a mutex, nodes inserted and erased by any thread
+        template <typename AllocBackend>
+        void BenchSharedContainer(BmkAllocator<AllocBackend>&, std::size_t maxThreads);
+
         // trends for Small Objects with new and delete
         template <typename AllocBackend, typename T, typename... Args>
         void BenchSameOrderNewDelete(BmkAllocator<AllocBackend>&, Args&&... args);
 
+        const Runner& GetRunner() const noexcept { return m_runner; }
+
+        // per size class counters of a small object allocator (Snapshot())
+        inline static void PrintSnapshot(const char* title, const soa::AllocatorSnapshot& snapshot)
+        {
+            auto print = [](const soa::SizeClassStats& s) {
+                std::cout << "  allocs: " << s.m_allocations << "  frees: " << s.m_frees
+                    << "  live: " << s.m_liveBlocks << "  peak: " << s.m_peakLiveBlocks
+                    << "  chunks: " << s.m_chunks << " (" << s.m_emptyChunks << " empty)"
+                    << "  bytes: " << s.m_bytesInUse << '/' << s.m_bytesReserved << '\n';
+            };
+
+            std::cout << title << '\n';
+            for (const soa::SizeClassStats& s : snapshot.m_sizeClasses)
+            {
+                std::cout << "\tsize " << s.m_blockSize;
+                print(s);
+            }
+            std::cout << "\ttotal";
+            print(snapshot.m_total);
+        }
+
     private:
 
         std::size_t m_numOfOperations;
+        Runner m_runner;
 
-        inline static BenchmarkResults BuildResults(std::size_t ops, std::chrono::milliseconds ms)
+        inline static BenchmarkResults BuildResults(std::size_t ops, std::chrono::nanoseconds elapsed)
         {
             BenchmarkResults r{};
 
             r.Operations = ops;
-            r.Milliseconds = ms;
-            double msd = static_cast<double>(ms.count());
-            if (msd <= 0.0) {
+            r.Elapsed = elapsed;
+            const double ns = static_cast<double>(elapsed.count());
+            if (ns <= 0.0) {
                 r.OpsPerSec = 0.0;
-                r.MsPerOp = 0.0;
+                r.NsPerOp = 0.0;
             }
             else {
-                r.OpsPerSec = (static_cast<double>(ops) * 1000.0) / msd;
-                r.MsPerOp = msd / static_cast<double>(ops);
+                r.OpsPerSec = (static_cast<double>(ops) * 1e9) / ns;
+                r.NsPerOp = ns / static_cast<double>(ops);
             }
 
             return r;
@@ -74,117 +164,197 @@ namespace bmk {
         {
             std::cout << title << '\n';
             std::cout << "\tOperations:   " << r.Operations << '\n';
-            std::cout << "\tElapsed ms:   " << r.Milliseconds.count() << '\n';
+            std::cout << "\tElapsed ms:   " << std::chrono::duration<double, std::milli>(r.Elapsed).count() << '\n';
             std::cout << "\tOps/sec:      " << r.OpsPerSec << '\n';
-            std::cout << "\tMs/op:        " << r.MsPerOp << '\n\n';
+            std::cout << "\tNs/op:        " << r.NsPerOp << "\n\n";
+        }
+
+        // speedup: throughput over the one of the first point
+        inline static void PrintScaling(const char* title, const std::vector<ScalingPoint>& curve)
+        {
+            std::cout << title << '\n';
+            std::cout << "\tthreads        ms        ops/sec   speedup\n";
+            for (const ScalingPoint& p : curve) {
+                const double base = curve.front().Results.OpsPerSec;
+                char line[96];
+                std::snprintf(line, sizeof(line), "\t%7zu %9.2f %14.0f %8.2fx\n",
+                    p.Threads, std::chrono::duration<double, std::milli>(p.Results.Elapsed).count(), p.Results.OpsPerSec,
+                    base > 0.0 ? p.Results.OpsPerSec / base : 0.0);
+                std::cout << line;
+            }
+        }
+
+        // 1, 2, 4... and maxThreads itself
+        inline static std::vector<std::size_t> ThreadCounts(std::size_t maxThreads)
+        {
+            std::vector<std::size_t> counts;
+            for (std::size_t n = 1; n < maxThreads; n *= 2) counts.push_back(n);
+            counts.push_back(maxThreads ? maxThreads : 1);
+            return counts;
         }
 	};
 
     /// -----------------------------------------------------------------------------
-    /// Helper function to measure execution time
+    /// Helper function to run body(threadIndex) on numThreads threads
     /// -----------------------------------------------------------------------------
-    
+    /// Threads are created first and start together: elapsed time is the
+    /// wall time of the slowest one, thread creation excluded.
+    /// pinCpu >= 0: thread t runs on CPU pinCpu + t (see PinCurrentThread).
+
     template <typename F>
-    std::chrono::milliseconds time_ms(F&& f) {
-        using namespace std::chrono;
-        auto start = high_resolution_clock::now();
-        std::forward<F>(f)();
-        auto end = high_resolution_clock::now();
-        return duration_cast<milliseconds>(end - start);
+    std::chrono::nanoseconds time_threads_ns(std::size_t numThreads, int pinCpu, F&& body) {
+        std::latch ready(static_cast<std::ptrdiff_t>(numThreads) + 1);
+        std::latch start(1);
+        std::vector<std::thread> threads;
+        threads.reserve(numThreads);
+
+        for (std::size_t t = 0; t < numThreads; ++t) {
+            threads.emplace_back([&, t] {
+                if (pinCpu >= 0) PinCurrentThread(pinCpu + static_cast<int>(t));
+
+                ready.count_down();
+                start.wait();
+                body(t);
+                });
+        }
+
+        ready.arrive_and_wait();
+
+        const auto begin = std::chrono::steady_clock::now();
+        start.count_down();
+        for (auto& thread : threads) thread.join();
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin);
     }
 
+    /// -----------------------------------------------------------------------------
+    /// Helper to draw sizes and slots: xorshift64, one per thread
+    /// -----------------------------------------------------------------------------
+
+    struct FastRandom {
+        std::uint64_t m_state;
+
+        explicit FastRandom(std::uint64_t seed) : m_state(seed * 0x9E3779B97F4A7C15ull | 1) {}
+
+        std::size_t operator()(std::size_t bound) {
+            m_state ^= m_state << 13;
+            m_state ^= m_state >> 7;
+            m_state ^= m_state << 17;
+            return static_cast<std::size_t>(m_state % bound);
+        }
+
+        std::size_t Between(std::size_t low, std::size_t high) { return low + (*this)(high - low + 1); }
+    };
+
+    /// -----------------------------------------------------------------------------
+    /// Helper to hand blocks from one thread to another
+    /// -----------------------------------------------------------------------------
+    /// One producer, one consumer. Both yield while the ring is full / empty.
+
+    class SpscRing {
+    public:
+        void Push(void* p) {
+            const std::size_t tail = m_tail.load(std::memory_order_relaxed);
+            while (tail - m_head.load(std::memory_order_acquire) == CAPACITY) std::this_thread::yield();
+            m_slots[tail % CAPACITY] = p;
+            m_tail.store(tail + 1, std::memory_order_release);
+        }
+
+        void* Pop() {
+            const std::size_t head = m_head.load(std::memory_order_relaxed);
+            while (m_tail.load(std::memory_order_acquire) == head) std::this_thread::yield();
+            void* p = m_slots[head % CAPACITY];
+            m_head.store(head + 1, std::memory_order_release);
+            return p;
+        }
+
+    private:
+        static constexpr std::size_t CAPACITY = 1024;
+
+        void* m_slots[CAPACITY]{};
+        alignas(64) std::atomic<std::size_t> m_head{};
+        alignas(64) std::atomic<std::size_t> m_tail{};
+    };
+
     /// -----------------------------------------------------------------------------
     /// Benchmark::BenchSameOrderNewDelete
     /// -----------------------------------------------------------------------------
-    
+
     template <typename AllocBackend, typename T, typename... Args>
     void Benchmark::BenchSameOrderNewDelete(BmkAllocator<AllocBackend>& allocator, Args&&... args) {
-        
-        using namespace std::chrono;
 
         std::vector<T*> ptrs;
         ptrs.reserve(m_numOfOperations);
 
-        // mesure NEW
-        auto msNew = time_ms([&]() {
-            for (std::size_t i = 0; i < m_numOfOperations; ++i) {
-                T* obj = allocator.New<T>(std::forward<Args>(args)...);
-                ptrs.push_back(obj);
-            }
-            });
-
-        // mesure DELETE
-        auto msDel = time_ms([&]() {
-            for (std::size_t i = 0; i < m_numOfOperations; ++i) {
-                allocator.Delete(ptrs[i]);
-            }
-            });
-
-        // separe results
-        auto rNew = BuildResults(m_numOfOperations, msNew);
-        auto rDel = BuildResults(m_numOfOperations, msDel);
+        auto stats = m_runner.Run([&](Repetition& rep) {
+            rep.Time("new", m_numOfOperations, [&](LatencySampler& sample) {
+                for (std::size_t i = 0; i < m_numOfOperations; ++i)
+                    sample([&] { ptrs.push_back(allocator.template New<T>(args...)); });
+                });
 
-        std::cout << "\tNew ms: " << rNew.Milliseconds << "  Delete ms: " << rDel.Milliseconds << '\n';
+            rep.Time("delete", m_numOfOperations, [&](LatencySampler& sample) {
+                for (std::size_t i = 0; i < m_numOfOperations; ++i)
+                    sample([&] { allocator.Delete(ptrs[i]); });
+                });
 
-        // total results
-        auto msTotal = msNew + msDel;
-        auto rTotal = BuildResults(m_numOfOperations, msTotal);
+            ptrs.clear();
+            });
 
-        //PrintResults("New (SameOrder)", rNew);
-        //PrintResults("Delete (SameOrder)", rDel);
-        PrintResults("Total (SameOrder)", rTotal);
+        PrintStats("BenchSameOrderNewDelete results:", stats);
     }
 
     /// -----------------------------------------------------------------------------
     /// Benchmark::BenchBulk
     /// -----------------------------------------------------------------------------
-    
+
     template <typename AllocBackend>
     void Benchmark::BenchBulk(BmkAllocator<AllocBackend>& allocator, std::size_t size) {
-    
+
         std::cout << "\n=== BenchBulk size=" << size << " ===\n";
 
-        std::vector<std::pair<void*, std::size_t>> ptrs;
+        std::vector<void*> ptrs;
         ptrs.reserve(m_numOfOperations);
 
-        // allocate with measurement
-        auto alloc_ms = time_ms([&] {
-            for (std::size_t i = 0; i < m_numOfOperations; ++i) {
-                ptrs.emplace_back(allocator.Allocate(size), size); // construct directly inside the vector
-            }
-            });
+        auto stats = m_runner.Run([&](Repetition& rep) {
+            rep.Time("alloc", m_numOfOperations, [&](LatencySampler& sample) {
+                for (std::size_t i = 0; i < m_numOfOperations; ++i)
+                    sample([&] { ptrs.push_back(allocator.Allocate(size)); });
+                });
 
-        // free outside timing
-        for (auto& pr : ptrs) allocator.Free(pr.first, pr.second);
-        ptrs.clear();
+            // free outside timing
+            for (void* p : ptrs) allocator.Free(p, size);
+            ptrs.clear();
+            });
 
-        BenchmarkResults r = BuildResults(m_numOfOperations, alloc_ms);
-        PrintResults("BenchBulk results (alloc only):", r);
+        PrintStats("BenchBulk results (alloc only):", stats);
     }
 
     /// -----------------------------------------------------------------------------
     /// Benchmark::BenchSameOrder
     /// -----------------------------------------------------------------------------
-    
+
     template <typename AllocBackend>
     void Benchmark::BenchSameOrder(BmkAllocator<AllocBackend>& allocator, std::size_t size) {
 
         std::cout << "\n=== BenchSameOrder size=" << size << " ===\n";
 
-        std::vector<std::pair<void*, std::size_t>> ptrs; 
+        std::vector<void*> ptrs;
         ptrs.reserve(m_numOfOperations);
 
-        auto alloc_ms = time_ms([&] {
-            for (std::size_t i = 0; i < m_numOfOperations; ++i) ptrs.emplace_back(allocator.Allocate(size), size);
-            });
+        auto stats = m_runner.Run([&](Repetition& rep) {
+            rep.Time("alloc", m_numOfOperations, [&](LatencySampler& sample) {
+                for (std::size_t i = 0; i < m_numOfOperations; ++i)
+                    sample([&] { ptrs.push_back(allocator.Allocate(size)); });
+                });
+
+            rep.Time("free", m_numOfOperations, [&](LatencySampler& sample) {
+                for (void* p : ptrs)
+                    sample([&] { allocator.Free(p, size); });
+                });
 
-        auto free_ms = time_ms([&] {
-            for (auto& pr : ptrs) allocator.Free(pr.first, pr.second);
+            ptrs.clear();
             });
 
-        BenchmarkResults r = BuildResults(m_numOfOperations, std::chrono::duration_cast<std::chrono::milliseconds>(alloc_ms + free_ms));
-        std::cout << "\talloc ms: " << alloc_ms.count() << "  free ms: " << free_ms.count() << '\n';
-        PrintResults("BenchSameOrder results:", r);
+        PrintStats("BenchSameOrder results:", stats);
     }
 
     /// -----------------------------------------------------------------------------
@@ -196,20 +366,24 @@ namespace bmk {
 
         std::cout << "\n=== BenchReverseOrder size=" << size << " ===\n";
 
-        std::vector<std::pair<void*, std::size_t>> ptrs; 
+        std::vector<void*> ptrs;
         ptrs.reserve(m_numOfOperations);
 
-        auto alloc_ms = time_ms([&] {
-            for (std::size_t i = 0; i < m_numOfOperations; ++i) ptrs.emplace_back(allocator.Allocate(size), size);
-            });
+        auto stats = m_runner.Run([&](Repetition& rep) {
+            rep.Time("alloc", m_numOfOperations, [&](LatencySampler& sample) {
+                for (std::size_t i = 0; i < m_numOfOperations; ++i)
+                    sample([&] { ptrs.push_back(allocator.Allocate(size)); });
+                });
+
+            rep.Time("free", m_numOfOperations, [&](LatencySampler& sample) {
+                for (auto it = ptrs.rbegin(); it != ptrs.rend(); ++it)
+                    sample([&] { allocator.Free(*it, size); });
+                });
 
-        auto free_ms = time_ms([&] {
-            for (auto it = ptrs.rbegin(); it != ptrs.rend(); ++it) allocator.Free(it->first, it->second);
+            ptrs.clear();
             });
 
-        BenchmarkResults r = BuildResults(m_numOfOperations, std::chrono::duration_cast<std::chrono::milliseconds>(alloc_ms + free_ms));
-        std::cout << "\talloc ms: " << alloc_ms.count() << "  free ms: " << free_ms.count() << '\n';
-        PrintResults("BenchReverseOrder results:", r);
+        PrintStats("BenchReverseOrder results:", stats);
     }
 
     /// -----------------------------------------------------------------------------
@@ -221,28 +395,410 @@ namespace bmk {
 
         std::cout << "\n=== BenchButterfly size=" << size << " ===\n";
 
-        std::vector<std::pair<void*, std::size_t>> ptrs; 
+        std::vector<void*> ptrs;
         ptrs.reserve(m_numOfOperations);
 
-        auto alloc_ms = time_ms([&] {
-            for (std::size_t i = 0; i < m_numOfOperations; ++i) ptrs.emplace_back(allocator.Allocate(size), size);
+        auto stats = m_runner.Run([&](Repetition& rep) {
+            rep.Time("alloc", m_numOfOperations, [&](LatencySampler& sample) {
+                for (std::size_t i = 0; i < m_numOfOperations; ++i)
+                    sample([&] { ptrs.push_back(allocator.Allocate(size)); });
+                });
+
+            rep.Time("free", m_numOfOperations, [&](LatencySampler& sample) {
+                std::size_t i = 0;
+                std::size_t j = ptrs.empty() ? 0 : ptrs.size() - 1;
+                while (i < j) {
+                    sample([&] { allocator.Free(ptrs[i], size); });
+                    sample([&] { allocator.Free(ptrs[j], size); });
+                    ++i; --j;
+                }
+                if (i == j && !ptrs.empty()) allocator.Free(ptrs[i], size);
+                });
+
+            ptrs.clear();
             });
 
-        auto free_ms = time_ms([&] {
-            std::size_t i = 0;
-            std::size_t j = ptrs.empty() ? 0 : ptrs.size() - 1;
-            while (i < j) {
-                allocator.Free(ptrs[i].first, ptrs[i].second);
-                allocator.Free(ptrs[j].first, ptrs[j].second);
-                ++i; --j;
-            }
-            if (i == j && !ptrs.empty()) allocator.Free(ptrs[i].first, ptrs[i].second);
+        PrintStats("BenchButterfly results:", stats);
+    }
+
+    /// -----------------------------------------------------------------------------
+    /// Benchmark::BenchBatch
+    /// -----------------------------------------------------------------------------
+    /// Same workload twice: groups of batchSize objects allocated and then
+    /// freed together (like the nodes of a parsed message).
+    /// First one call per object, then one AllocateBatch/FreeBatch per group.
+    /// Latency per call: one object, then one whole batch.
+
+    template <typename AllocBackend>
+    void Benchmark::BenchBatch(BmkAllocator<AllocBackend>& allocator, std::size_t size, std::size_t batchSize) {
+
+        std::cout << "\n=== BenchBatch size=" << size << " batch=" << batchSize << " ===\n";
+
+        const std::size_t numBatches = m_numOfOperations / batchSize;
+        std::vector<void*> ptrs(batchSize);
+
+        auto stats = m_runner.Run([&](Repetition& rep) {
+            rep.Time("one by one", numBatches * batchSize * 2, [&](LatencySampler& sample) {
+                for (std::size_t b = 0; b < numBatches; ++b) {
+                    for (std::size_t i = 0; i < batchSize; ++i) sample([&] { ptrs[i] = allocator.Allocate(size); });
+                    for (std::size_t i = 0; i < batchSize; ++i) sample([&] { allocator.Free(ptrs[i], size); });
+                }
+                });
+
+            rep.Time("batch", numBatches * batchSize * 2, [&](LatencySampler& sample) {
+                for (std::size_t b = 0; b < numBatches; ++b) {
+                    std::size_t n = 0;
+                    sample([&] { n = allocator.AllocateBatch(size, batchSize, ptrs.data()); });
+                    assert(n == batchSize);
+                    sample([&] { allocator.FreeBatch(size, n, ptrs.data()); });
+                }
+                });
             });
 
-        BenchmarkResults r = BuildResults(m_numOfOperations, std::chrono::duration_cast<std::chrono::milliseconds>(alloc_ms + free_ms));
-        std::cout << "\talloc ms: " << alloc_ms.count() << "  free ms: " << free_ms.count() << '\n';
-        PrintResults("BenchButterfly results:", r);
+        PrintStats("BenchBatch results (ops: objects allocated + freed):", stats);
+        if (stats.size() == 2 && stats[1].MedianNsPerOp > 0.0)
+            std::cout << "\tspeedup: " << stats[0].MedianNsPerOp / stats[1].MedianNsPerOp << "x\n";
+    }
+
+    /// -----------------------------------------------------------------------------
+    /// Benchmark::BenchReset
+    /// -----------------------------------------------------------------------------
+    /// Request scoped workload: groups of groupSize objects on their own
+    /// allocator instance, all dropped when the group ends.
+    /// First one Free per object, then one Reset of the instance per group.
+
+    template <typename AllocBackend>
+    void Benchmark::BenchReset(BmkAllocator<AllocBackend>& allocator, std::size_t size, std::size_t groupSize) {
+
+        std::cout << "\n=== BenchReset size=" << size << " group=" << groupSize << " ===\n";
+
+        const std::size_t numGroups = m_numOfOperations / groupSize;
+        std::vector<void*> ptrs(groupSize);
+        auto& arena = allocator.GetBackend().GetAllocator();
+
+        auto stats = m_runner.Run([&](Repetition& rep) {
+            rep.Time("free", numGroups * groupSize, [&](LatencySampler& sample) {
+                for (std::size_t g = 0; g < numGroups; ++g) {
+                    for (std::size_t i = 0; i < groupSize; ++i) sample([&] { ptrs[i] = allocator.Allocate(size); });
+                    for (std::size_t i = 0; i < groupSize; ++i) sample([&] { allocator.Free(ptrs[i], size); });
+                }
+                });
+
+            rep.Time("reset", numGroups * groupSize, [&](LatencySampler& sample) {
+                for (std::size_t g = 0; g < numGroups; ++g) {
+                    for (std::size_t i = 0; i < groupSize; ++i) sample([&] { ptrs[i] = allocator.Allocate(size); });
+                    sample([&] { arena.Reset(); });
+                }
+                });
+            });
+
+        PrintStats("BenchReset results (ops: objects):", stats);
+        if (stats.size() == 2 && stats[1].MedianNsPerOp > 0.0)
+            std::cout << "\tspeedup: " << stats[0].MedianNsPerOp / stats[1].MedianNsPerOp << "x\n";
+    }
+
+    /// -----------------------------------------------------------------------------
+    /// Benchmark::BenchStaticFixed
+    /// -----------------------------------------------------------------------------
+    /// Fixed allocators used directly, no size class dispatch: rounds of 4096
+    /// blocks allocated and freed in reverse order, m_numOfOperations blocks
+    /// in total. The working set stays in a few chunks, so it is the fast
+    /// path that is measured, not the chunk search.
+    /// Runtime block size first, then the compile-time one.
+
+    template <std::size_t Size>
+    void Benchmark::BenchStaticFixed() {
+
+        std::cout << "\n=== BenchStaticFixed size=" << Size << " ===\n";
+
+        constexpr std::size_t round = 4096;
+        const std::size_t numRounds = m_numOfOperations / round;
+        std::vector<void*> ptrs(round);
+
+        soa::FixedAllocator runtimeFixed(Size);
+        soa::StaticFixedAllocator<Size> staticFixed;
+
+        auto run = [&](auto& fixed) {
+            return [&](LatencySampler& sample) {
+                for (std::size_t r = 0; r < numRounds; ++r) {
+                    for (std::size_t i = 0; i < round; ++i) sample([&] { ptrs[i] = fixed.Allocate(); });
+                    for (std::size_t i = round; i-- > 0; ) sample([&] { fixed.Deallocate(ptrs[i]); });
+                }
+                };
+            };
+
+        auto stats = m_runner.Run([&](Repetition& rep) {
+            rep.Time("runtime", numRounds * round * 2, run(runtimeFixed));
+            rep.Time("static", numRounds * round * 2, run(staticFixed));
+            });
+
+        PrintStats("BenchStaticFixed results:", stats);
+        if (stats.size() == 2 && stats[1].MedianNsPerOp > 0.0)
+            std::cout << "\tspeedup: " << stats[0].MedianNsPerOp / stats[1].MedianNsPerOp << "x\n";
+    }
+
+    /// -----------------------------------------------------------------------------
+    /// Benchmark::BenchPmrNodes
+    /// -----------------------------------------------------------------------------
+    /// One small allocation per element: m_numOfOperations list nodes pushed
+    /// and popped in rounds of 1024, then a map filled and destroyed.
+
+    inline void Benchmark::BenchPmrNodes(const char* name, std::pmr::memory_resource& resource) {
+
+        std::cout << "\n=== BenchPmrNodes " << name << " ===\n";
+
+        constexpr std::size_t round = 1024;
+        const std::size_t numRounds = (m_numOfOperations + round - 1) / round;
+
+        auto stats = m_runner.Run([&](Repetition& rep) {
+            rep.Time("list", numRounds * round * 2, [&](LatencySampler& sample) {
+                std::pmr::list<int> list(&resource);
+                for (std::size_t r = 0; r < numRounds; ++r) {
+                    for (std::size_t j = 0; j < round; ++j) sample([&] { list.push_back(static_cast<int>(j)); });
+                    for (std::size_t j = 0; j < round; ++j) sample([&] { list.pop_front(); });
+                }
+                });
+
+            std::pmr::map<std::size_t, int> map(&resource);
+
+            rep.Time("map insert", m_numOfOperations, [&](LatencySampler& sample) {
+                for (std::size_t i = 0; i < m_numOfOperations; ++i)
+                    sample([&] { map.emplace(i * 7919 % m_numOfOperations, 0); });
+                });
+
+            // one call: ns per node, no latency
+            rep.Time("map clear", m_numOfOperations, [&](LatencySampler&) { map.clear(); });
+            });
+
+        PrintStats("BenchPmrNodes results:", stats);
+    }
+
+    /// -----------------------------------------------------------------------------
+    /// Benchmark::BenchButterflyThreads
+    /// -----------------------------------------------------------------------------
+    /// Every thread allocates and frees its own objects with the butterfly trend.
+    /// Threads start together, elapsed time is the wall time of the slowest one.
+    /// With a scalable backend ops/sec should grow close to linearly with numThreads.
+
+    template <typename AllocBackend>
+    void Benchmark::BenchButterflyThreads(BmkAllocator<AllocBackend>& allocator, std::size_t size, std::size_t numThreads) {
+
+        std::cout << "\n=== BenchButterflyThreads size=" << size << " threads=" << numThreads << " ===\n";
+
+        std::vector<std::vector<void*>> perThread(numThreads);
+        for (auto& ptrs : perThread) ptrs.reserve(m_numOfOperations);
+
+        auto total_ns = m_runner.Median([&] {
+            return time_threads_ns(numThreads, m_runner.GetOptions().PinCpu, [&](std::size_t t) {
+                std::vector<void*>& ptrs = perThread[t];
+
+                for (std::size_t i = 0; i < m_numOfOperations; ++i) ptrs.push_back(allocator.Allocate(size));
+
+                std::size_t i = 0;
+                std::size_t j = ptrs.empty() ? 0 : ptrs.size() - 1;
+                while (i < j) {
+                    allocator.Free(ptrs[i], size);
+                    allocator.Free(ptrs[j], size);
+                    ++i; --j;
+                }
+                if (i == j && !ptrs.empty()) allocator.Free(ptrs[i], size);
+                ptrs.clear();
+            });
+        });
+
+        BenchmarkResults r = BuildResults(m_numOfOperations * numThreads, total_ns);
+        PrintResults("BenchButterflyThreads results (median):", r);
+    }
+
+    /// -----------------------------------------------------------------------------
+    /// Benchmark::BenchChurnThreads
+    /// -----------------------------------------------------------------------------
+    /// No sharing at all: every thread frees and reallocates random blocks of
+    /// its own working set of 1024, sizes random in [minSize, maxSize].
+    /// What is measured is the cost of the shared state of the backend.
+
+    template <typename AllocBackend>
+    void Benchmark::BenchChurnThreads(BmkAllocator<AllocBackend>& allocator, std::size_t minSize, std::size_t maxSize, std::size_t maxThreads) {
+
+        std::cout << "\n=== BenchChurnThreads size=" << minSize << ".." << maxSize << " ===\n";
+
+        constexpr std::size_t workingSet = 1024;
+        std::vector<ScalingPoint> curve;
+
+        for (std::size_t numThreads : ThreadCounts(maxThreads)) {
+            using Blocks = std::vector<std::pair<void*, std::size_t>>;
+            std::vector<Blocks> perThread(numThreads, Blocks(workingSet));
+
+            auto ns = m_runner.Median([&] {
+                return time_threads_ns(numThreads, m_runner.GetOptions().PinCpu, [&](std::size_t t) {
+                    FastRandom random(t + 1);
+                    Blocks& blocks = perThread[t];
+
+                    for (auto& b : blocks) {
+                        b.second = random.Between(minSize, maxSize);
+                        b.first = allocator.Allocate(b.second);
+                    }
+
+                    for (std::size_t i = 0; i < m_numOfOperations; ++i) {
+                        auto& b = blocks[random(workingSet)];
+                        allocator.Free(b.first, b.second);
+                        b.second = random.Between(minSize, maxSize);
+                        b.first = allocator.Allocate(b.second);
+                    }
+
+                    for (auto& b : blocks) allocator.Free(b.first, b.second);
+                });
+            });
+
+            curve.push_back({ numThreads, BuildResults(m_numOfOperations * numThreads, ns) });
+        }
+
+        PrintScaling("BenchChurnThreads scaling:", curve);
+    }
+
+    /// -----------------------------------------------------------------------------
+    /// Benchmark::BenchProducerConsumer
+    /// -----------------------------------------------------------------------------
+    /// Every block is freed by another thread than the one that allocated
+    /// it: producers allocate m_numOfOperations blocks each and pass them to
+    /// their consumer through a ring. Threads counted as pairs.
+
+    template <typename AllocBackend>
+    void Benchmark::BenchProducerConsumer(BmkAllocator<AllocBackend>& allocator, std::size_t size, std::size_t maxThreads) {
+
+        std::cout << "\n=== BenchProducerConsumer size=" << size << " ===\n";
+
+        std::vector<ScalingPoint> curve;
+
+        for (std::size_t numPairs : ThreadCounts(maxThreads / 2)) {
+            auto ns = m_runner.Median([&] {
+                std::vector<SpscRing> rings(numPairs);
+
+                return time_threads_ns(numPairs * 2, m_runner.GetOptions().PinCpu, [&](std::size_t t) {
+                    SpscRing& ring = rings[t / 2];
+
+                    if (t % 2 == 0) {
+                        for (std::size_t i = 0; i < m_numOfOperations; ++i) ring.Push(allocator.Allocate(size));
+                    }
+                    else {
+                        for (std::size_t i = 0; i < m_numOfOperations; ++i) allocator.Free(ring.Pop(), size);
+                    }
+                });
+            });
+
+            curve.push_back({ numPairs * 2, BuildResults(m_numOfOperations * numPairs, ns) });
+        }
+
+        PrintScaling("BenchProducerConsumer scaling (ops: blocks handed over):", curve);
+    }
+
+    /// -----------------------------------------------------------------------------
+    /// Benchmark::BenchLarson
+    /// -----------------------------------------------------------------------------
+    /// After Larson and Krishnan: server threads free blocks that other
+    /// threads allocated. numThreads working sets of 1024 random sized blocks,
+    /// filled before the timing. In each of 16 rounds every thread replaces
+    /// random blocks of one set, then the sets move on to the next thread.
+    /// With one thread nothing is remote: the reference point.
+
+    template <typename AllocBackend>
+    void Benchmark::BenchLarson(BmkAllocator<AllocBackend>& allocator, std::size_t minSize, std::size_t maxSize, std::size_t maxThreads) {
+
+        std::cout << "\n=== BenchLarson size=" << minSize << ".." << maxSize << " ===\n";
+
+        constexpr std::size_t workingSet = 1024;
+        constexpr std::size_t rounds = 16;
+        const std::size_t perRound = m_numOfOperations / rounds;
+        std::vector<ScalingPoint> curve;
+
+        for (std::size_t numThreads : ThreadCounts(maxThreads)) {
+            using Blocks = std::vector<std::pair<void*, std::size_t>>;
+
+            auto ns = m_runner.Median([&] {
+                std::vector<Blocks> sets(numThreads, Blocks(workingSet));
+
+                FastRandom fill(numThreads);
+                for (Blocks& blocks : sets) {
+                    for (auto& b : blocks) {
+                        b.second = fill.Between(minSize, maxSize);
+                        b.first = allocator.Allocate(b.second);
+                    }
+                }
+
+                std::barrier sync(static_cast<std::ptrdiff_t>(numThreads));
+
+                auto elapsed = time_threads_ns(numThreads, m_runner.GetOptions().PinCpu, [&](std::size_t t) {
+                    FastRandom random(t + 1);
+
+                    for (std::size_t r = 0; r < rounds; ++r) {
+                        Blocks& blocks = sets[(t + r) % numThreads];
+
+                        for (std::size_t i = 0; i < perRound; ++i) {
+                            auto& b = blocks[random(workingSet)];
+                            allocator.Free(b.first, b.second);
+                            b.second = random.Between(minSize, maxSize);
+                            b.first = allocator.Allocate(b.second);
+                        }
+
+                        sync.arrive_and_wait();
+                    }
+                });
+
+                for (Blocks& blocks : sets) {
+                    for (auto& b : blocks) allocator.Free(b.first, b.second);
+                }
+                return elapsed;
+            });
+
+            curve.push_back({ numThreads, BuildResults(perRound * rounds * numThreads, ns) });
+        }
+
+        PrintScaling("BenchLarson scaling:", curve);
+    }
+
+    /// -----------------------------------------------------------------------------
+    /// Benchmark::BenchSharedContainer
+    /// -----------------------------------------------------------------------------
+    /// One std::map on the backend (mema::STLAllocator), guarded by a mutex:
+    /// every thread inserts a random key, or erases it when already there.
+    /// The allocator runs inside the lock, nodes are freed by any thread.
+    /// Doesn't scale by design: slower allocators hold the lock longer.
+
+    template <typename AllocBackend>
+    void Benchmark::BenchSharedContainer(BmkAllocator<AllocBackend>& allocator, std::size_t maxThreads) {
+
+        std::cout << "\n=== BenchSharedContainer ===\n";
+
+        using Node = std::pair<const std::size_t, std::size_t>;
+        using Map = std::map<std::size_t, std::size_t, std::less<std::size_t>, mema::STLAllocator<Node, AllocBackend>>;
+
+        constexpr std::size_t numKeys = 1 << 16;
+        std::vector<ScalingPoint> curve;
+
+        for (std::size_t numThreads : ThreadCounts(maxThreads)) {
+            auto ns = m_runner.Median([&] {
+                std::mutex mutex;
+                Map map{ mema::STLAllocator<Node, AllocBackend>(allocator.GetBackend()) };
+
+                return time_threads_ns(numThreads, m_runner.GetOptions().PinCpu, [&](std::size_t t) {
+                    FastRandom random(t + 1);
+
+                    for (std::size_t i = 0; i < m_numOfOperations; ++i) {
+                        const std::size_t key = random(numKeys);
+
+                        std::lock_guard<std::mutex> lock(mutex);
+                        auto it = map.find(key);
+                        if (it == map.end()) map.emplace(key, i);
+                        else map.erase(it);
+                    }
+                });
+            });
+
+            curve.push_back({ numThreads, BuildResults(m_numOfOperations * numThreads, ns) });
+        }
+
+        PrintScaling("BenchSharedContainer scaling:", curve);
     }
 }
 
-#endif !BENCHMARK_H
\ No newline at end of file
+#endif // !BENCHMARK_H
@@ -6,11 +6,25 @@
 
 namespace bmk {
 
+    /// Backend is held by value: stateless backends (static functions) are
+    /// default constructed, stateful ones (mema::InstanceBackend) are passed in.
+
     template<typename Backend>
     class BmkAllocator {
     public:
-        void* Allocate(std::size_t size) { return Backend::Allocate(size); }
-        void Free(void* p, std::size_t size) { Backend::Free(p, size); }
+        BmkAllocator() = default;
+        explicit BmkAllocator(const Backend& backend) : m_backend(backend) {}
+
+        void* Allocate(std::size_t size) { return m_backend.Allocate(size); }
+        void Free(void* p, std::size_t size) { m_backend.Free(p, size); }
+
+        void* Allocate(std::size_t size, std::size_t alignment) { return m_backend.Allocate(size, alignment); }
+        void Free(void* p, std::size_t size, std::size_t alignment) { m_backend.Free(p, size, alignment); }
+
+        std::size_t AllocateBatch(std::size_t size, std::size_t n, void** out) { return m_backend.AllocateBatch(size, n, out); }
+        void FreeBatch(std::size_t size, std::size_t n, void** in) { m_backend.FreeBatch(size, n, in); }
+
+        Backend& GetBackend() { return m_backend; }
 
         template<typename T, typename... Args>
         T* New(Args&&... args) {
@@ -24,6 +38,9 @@ namespace bmk {
             obj->~T();
             Free(obj, sizeof(T));
         }
+
+    private:
+        Backend m_backend{};
     };
 }
 
@@ -0,0 +1,217 @@
+#ifndef BMK_RUNNER_H
+#define BMK_RUNNER_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define BMK_HAS_TSC
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#endif
+
+namespace bmk {
+
+    /// Benchmark runner
+    ///
+    /// - Clock: the TSC where there is one (x86, x64), converted to ns with
+    ///   a ratio calibrated against steady_clock once per process. Elsewhere
+    ///   steady_clock itself. The TSC read is not serializing: fine for
+    ///   operations of some ns and more, not for single instructions.
+    /// - A measurement (Runner::Run) runs its body Warmups times, results
+    ///   dropped, then Repetitions times. The body times its phases with
+    ///   Repetition::Time, untimed work (setup, cleanup) goes around them.
+    ///   Per phase: ns/op of every repetition, reported as median, mean,
+    ///   stddev and min.
+    /// - Latency: about one operation in SampleInterval is timed on its own
+    ///   (gaps drawn at random: periodic events, a new chunk every N blocks,
+    ///   don't alias with the sampling). p50/p99/p99.9/max over the samples
+    ///   of every repetition, overhead of the clock subtracted. Sampling costs
+    ///   two clock reads per sampled operation, in the ns/op figures too.
+    /// - The calling thread is pinned to the PinCpu-th CPU it may run on
+    ///   during Run (-1: not pinned), then put back on every CPU of the
+    ///   process.
+
+    struct RunnerOptions
+    {
+        std::size_t Warmups = 1;
+        std::size_t Repetitions = 5;
+        std::size_t SampleInterval = 32; // 1: every operation
+        int PinCpu = 0;
+    };
+
+    class Clock {
+    public:
+        static std::uint64_t Now() noexcept {
+#ifdef BMK_HAS_TSC
+            return __rdtsc();
+#else
+            return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+        }
+
+        static double NsPerTick() noexcept;
+        // two Now() back to back
+        static double OverheadNs() noexcept;
+
+        static double ToNs(std::uint64_t ticks) noexcept { return static_cast<double>(ticks) * NsPerTick(); }
+    };
+
+    // cpu: index among the CPUs the process may run on (wraps). false if
+    // the OS refused or doesn't support it
+    bool PinCurrentThread(int cpu) noexcept;
+    // back to every CPU of the process
+    void UnpinCurrentThread() noexcept;
+
+    /// Times operations one by one, at random intervals of mean `interval`:
+    /// sample([&] { ... }) around every operation of a timed phase
+
+    class LatencySampler {
+    public:
+        LatencySampler(std::size_t interval, std::uint64_t seed, std::vector<std::uint64_t>& samples) noexcept
+            : m_interval(interval ? interval : 1), m_random(seed * 0x9E3779B97F4A7C15ull | 1), m_samples(&samples) {
+            m_countdown = NextGap();
+        }
+
+        template <typename F>
+        void operator()(F&& op) {
+            if (--m_countdown) {
+                op();
+                return;
+            }
+
+            const std::uint64_t start = Clock::Now();
+            op();
+            const std::uint64_t end = Clock::Now();
+
+            m_samples->push_back(end - start);
+            m_countdown = NextGap();
+        }
+
+    private:
+        // uniform in [1, 2 * interval - 1]
+        std::size_t NextGap() noexcept {
+            if (m_interval == 1) return 1;
+            m_random ^= m_random << 13;
+            m_random ^= m_random >> 7;
+            m_random ^= m_random << 17;
+            return 1 + static_cast<std::size_t>(m_random % (2 * m_interval - 1));
+        }
+
+        std::size_t m_interval;
+        std::size_t m_countdown{};
+        std::uint64_t m_random;
+        std::vector<std::uint64_t>* m_samples;
+    };
+
+    struct PhaseStats
+    {
+        const char* Name;
+        std::size_t Operations;   // per repetition
+        std::size_t Repetitions;
+        double MedianNsPerOp;
+        double MeanNsPerOp;
+        double StddevNsPerOp;
+        double MinNsPerOp;
+        std::size_t NumSamples;   // latency, 0: none taken
+        double P50Ns;
+        double P99Ns;
+        double P999Ns;
+        double MaxNs;
+    };
+
+    struct PhaseData
+    {
+        const char* Name;
+        std::size_t Operations;
+        std::vector<double> NsPerOp;          // one per repetition
+        std::vector<std::uint64_t> Samples;   // ticks
+    };
+
+    /// One run of the body of Runner::Run
+
+    class Repetition {
+    public:
+        Repetition(const RunnerOptions& options, std::uint64_t seed, std::vector<PhaseData>& phases) noexcept
+            : m_options(&options), m_seed(seed), m_phases(&phases) {
+        }
+
+        // phase: a string literal, the same every repetition. ops: operations
+        // done by f, for ns/op. f(LatencySampler&)
+        template <typename F>
+        void Time(const char* phase, std::size_t ops, F&& f) {
+            PhaseData& data = Find(phase, ops);
+            data.Samples.reserve(data.Samples.size() + 2 * ops / (m_options->SampleInterval ? m_options->SampleInterval : 1) + 64);
+            LatencySampler sampler(m_options->SampleInterval, ++m_seed, data.Samples);
+
+            const std::uint64_t start = Clock::Now();
+            f(sampler);
+            const std::uint64_t end = Clock::Now();
+
+            data.NsPerOp.push_back(ops ? Clock::ToNs(end - start) / static_cast<double>(ops) : 0.0);
+        }
+
+    private:
+        PhaseData& Find(const char* phase, std::size_t ops);
+
+        const RunnerOptions* m_options;
+        std::uint64_t m_seed;
+        std::vector<PhaseData>* m_phases;
+    };
+
+    class Runner {
+    public:
+        explicit Runner(const RunnerOptions& options = RunnerOptions()) : m_options(options) {}
+
+        const RunnerOptions& GetOptions() const noexcept { return m_options; }
+
+        // body(Repetition&). Phases in order of their first Time
+        template <typename Body>
+        std::vector<PhaseStats> Run(Body&& body) const {
+            const bool pinned = m_options.PinCpu >= 0 && PinCurrentThread(m_options.PinCpu);
+
+            std::vector<PhaseData> warmup;
+            for (std::size_t w = 0; w < m_options.Warmups; ++w) {
+                Repetition repetition(m_options, w, warmup);
+                body(repetition);
+                warmup.clear();
+            }
+
+            std::vector<PhaseData> phases;
+            for (std::size_t r = 0; r < m_options.Repetitions; ++r) {
+                Repetition repetition(m_options, 1000 + r, phases);
+                body(repetition);
+            }
+
+            if (pinned) UnpinCurrentThread();
+            return Summarize(phases);
+        }
+
+        // median of Warmups + Repetitions runs of run(), results of the
+        // warmups dropped: for the multi-threaded benchmarks
+        template <typename F>
+        std::chrono::nanoseconds Median(F&& run) const {
+            for (std::size_t w = 0; w < m_options.Warmups; ++w) run();
+
+            std::vector<std::chrono::nanoseconds> times;
+            for (std::size_t r = 0; r < m_options.Repetitions; ++r) times.push_back(run());
+            return MedianOf(times);
+        }
+
+        static std::vector<PhaseStats> Summarize(std::vector<PhaseData>& phases);
+        static std::chrono::nanoseconds MedianOf(std::vector<std::chrono::nanoseconds>& times);
+
+    private:
+        RunnerOptions m_options;
+    };
+
+    void PrintStats(const char* title, const std::vector<PhaseStats>& phases);
+}
+
+#endif // !BMK_RUNNER_H
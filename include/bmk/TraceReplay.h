@@ -0,0 +1,133 @@
+#ifndef TRACE_REPLAY_H
+#define TRACE_REPLAY_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <vector>
+#include "BmkAllocator.h"
+#include "mema\AllocationTrace.h"
+
+namespace bmk {
+
+    /// Deterministic replay of a recorded allocation stream (mema::TraceWriter,
+    /// mema::RecordingBackend) against any backend.
+    /// - One thread, records in file order: the same calls in the same order
+    ///   on every run and every backend. The recorded thread indices are not
+    ///   replayed.
+    /// - Time: the allocator calls only, sampling excluded.
+    /// - Footprint: resident memory of the process over the one before the
+    ///   replay (the id table is touched before), read at numSamples evenly
+    ///   spaced points: peaks between two samples are missed. The free
+    ///   memory of the C heap is given back to the OS before, memory an
+    ///   allocator keeps (empty chunks) isn't: Trim() it between replays.
+    /// - Fragmentation: 1 - requested live bytes / footprint.
+    /// Blocks still live at the end of the trace are freed after the timing.
+
+    struct ReplaySample
+    {
+        std::size_t Operation;   // records replayed so far
+        std::size_t LiveBytes;   // requested, live
+        std::size_t Footprint;   // bytes
+        double Fragmentation;
+    };
+
+    struct ReplayResults
+    {
+        std::size_t Operations;
+        std::chrono::nanoseconds Elapsed;
+        std::size_t PeakLiveBytes;
+        std::size_t PeakFootprint;
+        std::vector<ReplaySample> Samples;
+    };
+
+    // resident bytes of the process, 0 where unknown
+    std::size_t ResidentBytes() noexcept;
+
+    // free memory of the C heap back to the OS, where the CRT can
+    void ReleaseFreeMemory() noexcept;
+
+    void PrintReplay(const char* title, const ReplayResults& results);
+
+    /// -----------------------------------------------------------------------------
+    /// ReplayTrace
+    /// -----------------------------------------------------------------------------
+
+    template <typename AllocBackend>
+    ReplayResults ReplayTrace(BmkAllocator<AllocBackend>& allocator, const mema::TraceReader& trace, std::size_t numSamples = 16) {
+
+        using clock = std::chrono::steady_clock;
+
+        std::vector<void*> blocks(trace.GetNumIds(), nullptr);
+        ReleaseFreeMemory();
+        const std::size_t baseline = ResidentBytes();
+
+        ReplayResults results{};
+        results.Operations = trace.GetNumRecords();
+        results.Elapsed = std::chrono::nanoseconds(0);
+
+        const std::size_t interval = (std::max)(std::size_t(1), results.Operations / (std::max)(std::size_t(1), numSamples));
+        std::size_t liveBytes = 0;
+
+        auto sample = [&](std::size_t operation) {
+            const std::size_t resident = ResidentBytes();
+            const std::size_t footprint = resident > baseline ? resident - baseline : 0;
+            const double fragmentation = footprint > liveBytes ? 1.0 - static_cast<double>(liveBytes) / footprint : 0.0;
+
+            results.PeakFootprint = (std::max)(results.PeakFootprint, footprint);
+            results.Samples.push_back({ operation, liveBytes, footprint, fragmentation });
+        };
+
+        const mema::TraceRecord* record = trace.begin();
+        const mema::TraceRecord* const end = trace.end();
+
+        while (record != end) {
+            const mema::TraceRecord* const segmentEnd = record + (std::min)(interval, static_cast<std::size_t>(end - record));
+
+            const auto start = clock::now();
+            for (; record != segmentEnd; ++record) {
+                const std::size_t size = static_cast<std::size_t>(record->m_size);
+                void*& block = blocks[record->m_id];
+
+                switch (record->m_op) {
+                case mema::TraceOp::Allocate:
+                    block = allocator.Allocate(size);
+                    liveBytes += size;
+                    break;
+                case mema::TraceOp::AllocateAligned:
+                    block = allocator.Allocate(size, std::size_t(1) << record->m_alignmentLog2);
+                    liveBytes += size;
+                    break;
+                case mema::TraceOp::Free:
+                    allocator.Free(block, size);
+                    block = nullptr;
+                    liveBytes -= size;
+                    break;
+                case mema::TraceOp::FreeAligned:
+                    allocator.Free(block, size, std::size_t(1) << record->m_alignmentLog2);
+                    block = nullptr;
+                    liveBytes -= size;
+                    break;
+                }
+                results.PeakLiveBytes = (std::max)(results.PeakLiveBytes, liveBytes);
+            }
+            results.Elapsed += clock::now() - start;
+
+            sample(static_cast<std::size_t>(record - trace.begin()));
+        }
+
+        // live at the end of the trace: its alloc record has the size
+        for (const mema::TraceRecord& r : trace) {
+            void*& block = blocks[r.m_id];
+            if (!block) continue;
+
+            if (r.m_op == mema::TraceOp::Allocate) allocator.Free(block, static_cast<std::size_t>(r.m_size));
+            else if (r.m_op == mema::TraceOp::AllocateAligned) allocator.Free(block, static_cast<std::size_t>(r.m_size), std::size_t(1) << r.m_alignmentLog2);
+            block = nullptr;
+        }
+
+        return results;
+    }
+}
+
+#endif // !TRACE_REPLAY_H
@@ -4,6 +4,8 @@
 #include "mema\STL_Allocator.h"
 #include "mema\SystemBackend.h"
 #include "mema\SoaBacked.h"
+#include "mema\ThreadCacheBackend.h"
+#include "mema\InstanceBackend.h"
 
 namespace mema {
 
@@ -12,6 +14,16 @@ namespace mema {
 
 	template<typename T>
 	using SoaAllocatorSTL = STLAllocator<T, SOABackend>;
+
+	template<typename T>
+	using TcSoaAllocatorSTL = STLAllocator<T, TcSOABackend>;
+
+	// stateful: built from the backend, e.g. MonotonicAllocatorSTL<int>(MonotonicBackend(arena))
+	template<typename T>
+	using MonotonicAllocatorSTL = STLAllocator<T, MonotonicBackend>;
+
+	template<typename T>
+	using StackAllocatorSTL = STLAllocator<T, StackBackend>;
 }
 
 #endif // !ALLOC_TYPEDEF_H
@@ -0,0 +1,157 @@
+#ifndef ALLOCATION_TRACE_H
+#define ALLOCATION_TRACE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+namespace mema {
+
+    /// Allocation trace file
+    ///
+    /// Binary, native byte order: a TraceHeader padded to TRACE_HEADER_SIZE
+    /// bytes, then fixed size TraceRecords in the order the operations were
+    /// made (one lock per writer: the order is a valid history even when
+    /// many threads record).
+    /// - Pointers are replaced by ids, dense and never reused: the replay
+    ///   keeps them in a flat table of GetNumIds() entries.
+    /// - Threads by small indices, in order of first record.
+    /// - Batches are recorded block by block.
+    ///
+    /// TraceWriter fills the file through a TRACE_WINDOW_SIZE bytes mapped
+    /// window, moved forward (and the file grown) as it fills up. The header
+    /// is written by Close(): a trace still being written doesn't open.
+    /// Frees of blocks allocated before the recording started are counted
+    /// (GetNumUntracked), not recorded.
+
+    enum class TraceOp : std::uint8_t {
+        Allocate,
+        AllocateAligned,
+        Free,
+        FreeAligned
+    };
+
+    struct TraceRecord {
+        std::uint64_t m_size;
+        std::uint32_t m_id;
+        std::uint16_t m_thread;
+        TraceOp       m_op;
+        std::uint8_t  m_alignmentLog2; // aligned ops only
+    };
+
+    static_assert(sizeof(TraceRecord) == 16, "TraceRecord: records must not straddle two windows");
+
+    struct TraceHeader {
+        char          m_magic[8];
+        std::uint32_t m_version;
+        std::uint32_t m_numThreads;
+        std::uint64_t m_numRecords;
+        std::uint64_t m_numIds;
+        std::uint64_t m_numUntracked;
+        std::uint64_t m_numDropped;
+    };
+
+    constexpr char          TRACE_MAGIC[8] = { 'S', 'O', 'A', 'T', 'R', 'A', 'C', 'E' };
+    constexpr std::uint32_t TRACE_VERSION = 1;
+    constexpr std::size_t   TRACE_HEADER_SIZE = 64;
+    constexpr std::size_t   TRACE_WINDOW_SIZE = 4 * 1024 * 1024; // multiple of the Windows allocation granularity
+
+    static_assert(sizeof(TraceHeader) <= TRACE_HEADER_SIZE, "TraceHeader: too big for its slot");
+    static_assert(TRACE_HEADER_SIZE % sizeof(TraceRecord) == 0 && TRACE_WINDOW_SIZE % sizeof(TraceRecord) == 0,
+        "trace file: records must not straddle two windows");
+
+    class TraceWriter {
+    public:
+        TraceWriter() = default;
+        ~TraceWriter() { Close(); }
+
+        TraceWriter(const TraceWriter&) = delete;
+        TraceWriter& operator=(const TraceWriter&) = delete;
+
+        // truncates path. false if the file can't be created or mapped
+        bool Open(const char* path);
+        // writes the header, trims the file. Recording after it is ignored.
+        // false if the file couldn't be completed (or wasn't open)
+        bool Close() noexcept;
+
+        bool IsOpen() const noexcept { return m_open; }
+
+        // alignment 0: the call had none
+        void RecordAllocate(const void* p, std::size_t size, std::size_t alignment = 0) noexcept;
+        // before the block is given back: its address can't be reused meanwhile
+        void RecordFree(const void* p, std::size_t size, std::size_t alignment = 0) noexcept;
+
+        std::uint64_t GetNumRecords() const noexcept;
+        std::uint64_t GetNumUntracked() const noexcept;
+        // records lost because the file couldn't grow: the trace is incomplete
+        std::uint64_t GetNumDropped() const noexcept;
+
+    private:
+        void Append(std::size_t size, std::size_t alignment, TraceOp op, std::uint32_t id) noexcept;
+        bool MapWindow(std::uint64_t offset) noexcept;
+        void UnmapWindow() noexcept;
+
+        mutable std::mutex m_mutex;
+        std::unordered_map<const void*, std::uint32_t> m_ids; // live blocks
+        std::unordered_map<std::thread::id, std::uint16_t> m_threads;
+
+        bool           m_open{};
+        unsigned char* m_window{};  // nullptr once the file can't grow
+        unsigned char* m_cursor{};
+        std::uint64_t  m_windowOffset{}; // in the file
+        std::uint64_t  m_numRecords{};
+        std::uint32_t  m_nextId{};
+        std::uint64_t  m_numUntracked{};
+        std::uint64_t  m_numDropped{};
+
+#ifdef _WIN32
+        void* m_file{};
+        void* m_mapping{};
+#else
+        int m_fd = -1;
+#endif
+    };
+
+    /// Read only view of a whole trace file, checked on Open: header, size,
+    /// and every record (known op, id in range)
+
+    class TraceReader {
+    public:
+        TraceReader() = default;
+        ~TraceReader() { Close(); }
+
+        TraceReader(const TraceReader&) = delete;
+        TraceReader& operator=(const TraceReader&) = delete;
+
+        // false if the file is missing, truncated or not a trace
+        bool Open(const char* path);
+        void Close() noexcept;
+
+        bool IsOpen() const noexcept { return m_data != nullptr; }
+
+        const TraceHeader& GetHeader() const noexcept { return *reinterpret_cast<const TraceHeader*>(m_data); }
+        std::size_t GetNumRecords() const noexcept { return static_cast<std::size_t>(GetHeader().m_numRecords); }
+        std::size_t GetNumIds() const noexcept { return static_cast<std::size_t>(GetHeader().m_numIds); }
+
+        const TraceRecord* begin() const noexcept { return reinterpret_cast<const TraceRecord*>(m_data + TRACE_HEADER_SIZE); }
+        const TraceRecord* end() const noexcept { return begin() + GetNumRecords(); }
+
+    private:
+        bool Validate() const noexcept;
+
+        const unsigned char* m_data{};
+        std::size_t m_size{};
+
+#ifdef _WIN32
+        void* m_file{};
+        void* m_mapping{};
+#else
+        int m_fd = -1;
+#endif
+    };
+}
+
+
+#endif // !ALLOCATION_TRACE_H
@@ -2,6 +2,7 @@
 #define CUSTOM_SOA_BACKEND_H
 
 #include "CustomSmallObjAllocator\CtmSmallObjAllocator.h"
+#include "SmallObjAllocator\HeapProfiler.h"
 
 namespace mema {
 
@@ -19,6 +20,68 @@ namespace mema {
             soa::CtmSmallObjAllocator::Instance().Deallocate(p, size);
             return;
         }
+
+        static void* Allocate(std::size_t size, std::size_t alignment) noexcept {
+            if (size == 0) return nullptr;
+            return soa::CtmSmallObjAllocator::Instance().Allocate(size, alignment);
+        }
+
+        static void Free(void* p, std::size_t size, std::size_t alignment) noexcept {
+
+            if (!p) return;
+
+            soa::CtmSmallObjAllocator::Instance().Deallocate(p, size, alignment);
+            return;
+        }
+
+        static std::size_t AllocateBatch(std::size_t size, std::size_t n, void** out) noexcept {
+            if (size == 0) return 0;
+            return soa::CtmSmallObjAllocator::Instance().AllocateBatch(size, n, out);
+        }
+
+        static void FreeBatch(std::size_t size, std::size_t n, void** in) noexcept {
+            soa::CtmSmallObjAllocator::Instance().DeallocateBatch(size, n, in);
+        }
+
+        // one object of a size known at compile time (STLAllocator n == 1, the
+        // nodes of list/map/unordered_map): its fixed allocator is looked up
+        // once per Size/Alignment, no size check and no table lookup after.
+        // Same size class as Allocate(Size, Alignment): the two paths mix.
+        template<std::size_t Size, std::size_t Alignment>
+        static void* AllocateNode() noexcept {
+            if constexpr (NODE_BYTES<Size, Alignment> != 0) {
+                void* p = NodeAllocator<Size, Alignment>().Allocate();
+
+                if (soa::HeapProfiler::Tick(NODE_BYTES<Size, Alignment>)) [[unlikely]]
+                    soa::HeapProfiler::Instance().RecordAllocation(&soa::CtmSmallObjAllocator::Instance(), p, NODE_BYTES<Size, Alignment>);
+
+                return p;
+            }
+            else return Allocate(Size, Alignment);
+        }
+
+        template<std::size_t Size, std::size_t Alignment>
+        static void FreeNode(void* p) noexcept {
+
+            if (!p) return;
+
+            if constexpr (NODE_BYTES<Size, Alignment> != 0) {
+                soa::HeapProfiler::OnFree(p);
+                NodeAllocator<Size, Alignment>().Deallocate(p);
+            }
+            else Free(p, Size, Alignment);
+        }
+
+    private:
+
+        template<std::size_t Size, std::size_t Alignment>
+        static constexpr std::size_t NODE_BYTES = soa::SizeClassRequest(Size, Alignment, soa::DEFAULT_MAX_OBJ_SIZE);
+
+        template<std::size_t Size, std::size_t Alignment>
+        static soa::CtmFixedAllocator& NodeAllocator() {
+            static soa::CtmFixedAllocator& fixed = soa::CtmSmallObjAllocator::Instance().GetFixedAllocator(NODE_BYTES<Size, Alignment>);
+            return fixed;
+        }
     };
 }
 
@@ -0,0 +1,125 @@
+#ifndef INSTANCE_BACKEND_H
+#define INSTANCE_BACKEND_H
+
+#include <cassert>
+#include "SmallObjAllocator\SmallObjAllocator.h"
+#include "CustomSmallObjAllocator\CtmSmallObjAllocator.h"
+#include "SmallObjAllocator\MonotonicArena.h"
+#include "SmallObjAllocator\StackArena.h"
+
+namespace mema {
+
+    /// Stateful backend: forwards to one allocator instance instead of
+    /// Instance(). A subsystem or a single request gets its own chunks,
+    /// and drops all of them at once with Reset()/Release() on the instance.
+    /// Copies point to the same instance, which must outlive them.
+    /// Allocate throws what the allocator throws (arenas: std::bad_alloc).
+
+    template<typename Allocator>
+    class InstanceBackend {
+    public:
+
+        explicit InstanceBackend(Allocator& allocator) noexcept
+            : m_allocator(&allocator) {
+        }
+
+        void* Allocate(std::size_t size) const {
+            if (size == 0) return nullptr;
+            return m_allocator->Allocate(size);
+        }
+
+        void Free(void* p, std::size_t size) const noexcept {
+
+            if (!p) return;
+
+            m_allocator->Deallocate(p, size);
+            return;
+        }
+
+        void* Allocate(std::size_t size, std::size_t alignment) const {
+            if (size == 0) return nullptr;
+            return m_allocator->Allocate(size, alignment);
+        }
+
+        void Free(void* p, std::size_t size, std::size_t alignment) const noexcept {
+
+            if (!p) return;
+
+            m_allocator->Deallocate(p, size, alignment);
+            return;
+        }
+
+        std::size_t AllocateBatch(std::size_t size, std::size_t n, void** out) const {
+            if (size == 0) return 0;
+            return m_allocator->AllocateBatch(size, n, out);
+        }
+
+        void FreeBatch(std::size_t size, std::size_t n, void** in) const noexcept {
+            m_allocator->DeallocateBatch(size, n, in);
+        }
+
+        Allocator& GetAllocator() const noexcept { return *m_allocator; }
+
+        bool operator==(const InstanceBackend& other) const noexcept { return m_allocator == other.m_allocator; }
+        bool operator!=(const InstanceBackend& other) const noexcept { return m_allocator != other.m_allocator; }
+
+    private:
+        Allocator* m_allocator;
+    };
+
+    /// Same, over one fixed allocator (BasicFixedAllocator or
+    /// BasicCtmFixedAllocator, any chunk engine): one block size, every
+    /// size asked must fit in it. Ctm ones: owner thread only.
+
+    template<typename Fixed>
+    class FixedInstanceBackend {
+    public:
+
+        explicit FixedInstanceBackend(Fixed& allocator) noexcept
+            : m_allocator(&allocator) {
+        }
+
+        void* Allocate(std::size_t size) const {
+            assert(size <= m_allocator->GetBlockSize());
+            if (size == 0) return nullptr;
+            return m_allocator->Allocate();
+        }
+
+        void Free(void* p, std::size_t size) const noexcept {
+
+            if (!p) return;
+
+            assert(size <= m_allocator->GetBlockSize());
+            m_allocator->Deallocate(p);
+            return;
+        }
+
+        std::size_t AllocateBatch(std::size_t size, std::size_t n, void** out) const {
+            assert(size <= m_allocator->GetBlockSize());
+            if (size == 0) return 0;
+            return m_allocator->AllocateBatch(n, out);
+        }
+
+        void FreeBatch(std::size_t size, std::size_t n, void** in) const noexcept {
+            assert(size <= m_allocator->GetBlockSize());
+            m_allocator->DeallocateBatch(n, in);
+        }
+
+        Fixed& GetAllocator() const noexcept { return *m_allocator; }
+
+    private:
+        Fixed* m_allocator;
+    };
+
+    using SOAInstanceBackend = InstanceBackend<soa::SmallObjAllocator>;
+    using CtmSOAInstanceBackend = InstanceBackend<soa::CtmSmallObjAllocator>;
+
+    // free is a no-op, memory comes back with Reset()/Release() of the arena
+    using MonotonicBackend = InstanceBackend<soa::MonotonicArena>;
+
+    // free gives back the last block only, memory comes back with Rollback()
+    using StackBackend = InstanceBackend<soa::StackArena>;
+}
+
+
+#endif // !INSTANCE_BACKEND_H
@@ -0,0 +1,73 @@
+#ifndef MEMORY_RESOURCE_H
+#define MEMORY_RESOURCE_H
+
+#include <memory_resource>
+#include <new>
+#include <type_traits>
+#include "mema\SoaBacked.h"
+#include "mema\CtmSOABackend.h"
+#include "mema\ThreadCacheBackend.h"
+#include "mema\InstanceBackend.h"
+
+namespace mema {
+
+    /// std::pmr::memory_resource over a backend, for std::pmr containers and
+    /// as upstream of the std::pmr pool resources.
+    /// - Alignment is forwarded to the backend: over-aligned requests are
+    ///   served as by STLAllocator.
+    /// - Requests over maxObjectSize (the chunks of an upstream pool) take the
+    ///   system path of the small object allocators.
+    /// - Stateless backends: every resource of the type is equal. Stateful ones
+    ///   (InstanceBackend) are equal when they share the instance.
+    /// - As thread-safe as the backend: only the ThreadCache backends are.
+
+    template<typename Backend>
+    class BackendResource final : public std::pmr::memory_resource {
+    public:
+
+        BackendResource() = default;
+
+        explicit BackendResource(const Backend& backend) noexcept
+            : m_backend(backend) {
+        }
+
+        const Backend& GetBackend() const noexcept { return m_backend; }
+
+    private:
+
+        // 0 bytes still gets a distinct block
+        void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+            void* p = m_backend.Allocate(bytes ? bytes : 1, alignment);
+            if (!p) throw std::bad_alloc();
+            return p;
+        }
+
+        void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override {
+            m_backend.Free(p, bytes ? bytes : 1, alignment);
+        }
+
+        bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+            const auto* resource = dynamic_cast<const BackendResource*>(&other);
+            if (!resource) return false;
+
+            if constexpr (std::is_empty_v<Backend>) return true;
+            else return m_backend == resource->m_backend;
+        }
+
+        Backend m_backend{};
+    };
+
+    using SoaResource = BackendResource<SOABackend>;
+    using CtmSoaResource = BackendResource<CtmSOABackend>;
+    using TcSoaResource = BackendResource<TcSOABackend>;
+    using TcCtmSoaResource = BackendResource<TcCtmSOABackend>;
+
+    // one allocator instance / arena each, built from its backend
+    using SoaInstanceResource = BackendResource<SOAInstanceBackend>;
+    using CtmSoaInstanceResource = BackendResource<CtmSOAInstanceBackend>;
+    using MonotonicResource = BackendResource<MonotonicBackend>;
+    using StackResource = BackendResource<StackBackend>;
+}
+
+
+#endif // !MEMORY_RESOURCE_H
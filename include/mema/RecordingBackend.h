@@ -0,0 +1,87 @@
+#ifndef RECORDING_BACKEND_H
+#define RECORDING_BACKEND_H
+
+#include <cstddef>
+#include <type_traits>
+#include "mema\AllocationTrace.h"
+
+namespace mema {
+
+    /// Stateful backend: forwards to Backend and records every successful
+    /// operation in a TraceWriter, for bmk::ReplayTrace.
+    /// Frees are recorded before the block goes back to Backend (another
+    /// thread could get the same address right after).
+    /// Copies record to the same writer, which must outlive them. As thread
+    /// safe as Backend: the writer has its own lock.
+
+    template<typename Backend>
+    class RecordingBackend {
+    public:
+
+        explicit RecordingBackend(TraceWriter& writer) noexcept
+            : m_writer(&writer) {
+        }
+
+        RecordingBackend(TraceWriter& writer, const Backend& backend) noexcept
+            : m_backend(backend), m_writer(&writer) {
+        }
+
+        void* Allocate(std::size_t size) const {
+            void* p = m_backend.Allocate(size);
+            if (p) m_writer->RecordAllocate(p, size);
+            return p;
+        }
+
+        void Free(void* p, std::size_t size) const noexcept {
+
+            if (!p) return;
+
+            m_writer->RecordFree(p, size);
+            m_backend.Free(p, size);
+            return;
+        }
+
+        void* Allocate(std::size_t size, std::size_t alignment) const {
+            void* p = m_backend.Allocate(size, alignment);
+            if (p) m_writer->RecordAllocate(p, size, alignment);
+            return p;
+        }
+
+        void Free(void* p, std::size_t size, std::size_t alignment) const noexcept {
+
+            if (!p) return;
+
+            m_writer->RecordFree(p, size, alignment);
+            m_backend.Free(p, size, alignment);
+            return;
+        }
+
+        std::size_t AllocateBatch(std::size_t size, std::size_t n, void** out) const {
+            const std::size_t count = m_backend.AllocateBatch(size, n, out);
+            for (std::size_t i = 0; i < count; ++i) m_writer->RecordAllocate(out[i], size);
+            return count;
+        }
+
+        void FreeBatch(std::size_t size, std::size_t n, void** in) const noexcept {
+            for (std::size_t i = 0; i < n; ++i) m_writer->RecordFree(in[i], size);
+            m_backend.FreeBatch(size, n, in);
+        }
+
+        const Backend& GetBackend() const noexcept { return m_backend; }
+        TraceWriter& GetWriter() const noexcept { return *m_writer; }
+
+        bool operator==(const RecordingBackend& other) const noexcept {
+            if constexpr (std::is_empty_v<Backend>) return m_writer == other.m_writer;
+            else return m_writer == other.m_writer && m_backend == other.m_backend;
+        }
+
+        bool operator!=(const RecordingBackend& other) const noexcept { return !(*this == other); }
+
+    private:
+        Backend m_backend{};
+        TraceWriter* m_writer;
+    };
+}
+
+
+#endif // !RECORDING_BACKEND_H
@@ -6,12 +6,37 @@
 #include <type_traits>
 #include <new>
 #include <cassert>
+#include <limits>
+
+#ifdef _MSC_VER
+#define MEMA_NO_UNIQUE_ADDRESS [[msvc::no_unique_address]]
+#else
+#define MEMA_NO_UNIQUE_ADDRESS [[no_unique_address]]
+#endif
 
 namespace mema {
 
+	/// The backend is held by value.
+	/// - Stateless backends (empty, static functions) take no space, every
+	///   allocator compares equal: std::allocator behaviour.
+	/// - Stateful ones (InstanceBackend over an allocator or an arena) are
+	///   compared, and follow the container on copy/move assignment and swap:
+	///   memory always goes back to the backend it came from.
+	///   Copies and rebinds share the backend state.
+
 	template<typename T, typename AllocBackend>
 	class STLAllocator {
 
+		static constexpr bool STATELESS = std::is_empty_v<AllocBackend>;
+
+		// a function: T may still be incomplete when the allocator type is
+		static constexpr bool HasNodePath() {
+			return requires(AllocBackend& backend, void* p) {
+				backend.template AllocateNode<sizeof(T), alignof(T)>();
+				backend.template FreeNode<sizeof(T), alignof(T)>(p);
+			};
+		}
+
 	public:
 
 		using value_type = T;
@@ -20,25 +45,51 @@ namespace mema {
 		using pointer = T*;
 		using const_pointer = const T*;
 
+		using propagate_on_container_copy_assignment = std::bool_constant<!STATELESS>;
+		using propagate_on_container_move_assignment = std::true_type;
+		using propagate_on_container_swap = std::bool_constant<!STATELESS>;
+		using is_always_equal = std::bool_constant<STATELESS>;
+
 		template<typename U>
 		struct rebind { using other = STLAllocator<U, AllocBackend>; };
 		
-		STLAllocator() noexcept = default;
+		STLAllocator() = default;
 		//STLAllocator(const STLAllocator&) noexcept = default;
 
+		explicit STLAllocator(const AllocBackend& backend) noexcept
+			: m_backend(backend) {
+		}
+
 		template<typename U>
-		STLAllocator(const STLAllocator<U, AllocBackend>&) noexcept {}
+		STLAllocator(const STLAllocator<U, AllocBackend>& other) noexcept
+			: m_backend(other.GetBackend()) {
+		}
 
+		// alignof(T) is forwarded: over-aligned types get suitably aligned blocks.
+		// n == 1 goes to AllocateNode/FreeNode when the backend has them: the
+		// size is a constant there (node containers only allocate that way)
 		pointer allocate(size_type n) {
-			void* ptr = AllocBackend::Allocate(n * sizeof(T));
+			void* ptr;
+			if constexpr (HasNodePath()) {
+				ptr = n == 1 ? m_backend.template AllocateNode<sizeof(T), alignof(T)>()
+					: m_backend.Allocate(n * sizeof(T), alignof(T));
+			}
+			else {
+				ptr = m_backend.Allocate(n * sizeof(T), alignof(T));
+			}
 			if (!ptr) throw std::bad_alloc();
 			return static_cast<pointer>(ptr);
 		}
 
 		void deallocate(pointer p, size_type n) noexcept {
-			AllocBackend::Free(p, n * sizeof(T));
+			if constexpr (HasNodePath()) {
+				if (n == 1) return m_backend.template FreeNode<sizeof(T), alignof(T)>(p);
+			}
+			m_backend.Free(p, n * sizeof(T), alignof(T));
 		}
 
+		const AllocBackend& GetBackend() const noexcept { return m_backend; }
+
 		// max size
 		size_type max_size() const noexcept {
 			return (std::numeric_limits<size_type>::max)() / sizeof(T);
@@ -46,10 +97,16 @@ namespace mema {
 
 		// equality operators (templated)
 		template<typename U>
-		bool operator==(const STLAllocator<U, AllocBackend>&) const noexcept { return true; }
+		bool operator==(const STLAllocator<U, AllocBackend>& other) const noexcept {
+			if constexpr (STATELESS) return true;
+			else return m_backend == other.GetBackend();
+		}
 
 		template<typename U>
 		bool operator!=(const STLAllocator<U, AllocBackend>& other) const noexcept { return !(*this == other); }
+
+	private:
+		MEMA_NO_UNIQUE_ADDRESS AllocBackend m_backend{};
 	};
 }
 
@@ -2,7 +2,9 @@
 #define SYSTEM_BACKEND_H
 
 #include <cstddef>
+#include <cstdlib>
 #include <new>
+#include "SmallObjAllocator\SOA_memory.h"
 
 struct SystemBackend {
     
@@ -15,6 +17,27 @@ struct SystemBackend {
     static void Free(void* p, std::size_t) noexcept {
         std::free(p);
     }
+
+    static void* Allocate(std::size_t n, std::size_t alignment) {
+        if (alignment <= alignof(std::max_align_t)) return Allocate(n);
+        void* p = soa::AlignedMalloc(soa::AlignUp(n, alignment), alignment);
+        if (!p && n != 0) throw std::bad_alloc();
+        return p;
+    }
+
+    static void Free(void* p, std::size_t n, std::size_t alignment) noexcept {
+        if (alignment <= alignof(std::max_align_t)) return Free(p, n);
+        soa::AlignedFree(p);
+    }
+
+    static std::size_t AllocateBatch(std::size_t size, std::size_t n, void** out) {
+        for (std::size_t i = 0; i < n; ++i) out[i] = Allocate(size);
+        return n;
+    }
+
+    static void FreeBatch(std::size_t size, std::size_t n, void** in) noexcept {
+        for (std::size_t i = 0; i < n; ++i) Free(in[i], size);
+    }
 };
 
 
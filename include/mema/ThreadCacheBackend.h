@@ -0,0 +1,89 @@
+#ifndef THREAD_CACHE_BACKEND_H
+#define THREAD_CACHE_BACKEND_H
+
+#include "SmallObjAllocator\ThreadCache.h"
+#include "SmallObjAllocator\SmallObjAllocator.h"
+#include "CustomSmallObjAllocator\CtmSmallObjAllocator.h"
+
+namespace mema {
+
+    /// Backend safe to use from many threads at once.
+    /// Every request goes through the calling thread's cache, the shared
+    /// allocator is reached only to refill or drain a whole batch.
+    /// Destructors of thread_local and static objects that run after the
+    /// cache of their thread is gone go straight to the shared allocator,
+    /// under the lock of the caches (see ThreadCache::Current).
+
+    template<typename Allocator>
+    struct ThreadCacheBackend {
+
+        using Cache = soa::ThreadCache<Allocator>;
+
+        static void* Allocate(std::size_t size) noexcept {
+            if (size == 0) return nullptr;
+
+            if (Cache* cache = Cache::Current())
+                return cache->Allocate(size);
+
+            typename Cache::SerializedLock lock;
+            return Allocator::Instance().Allocate(size);
+        }
+
+        static void Free(void* p, std::size_t size) noexcept {
+
+            if (!p) return;
+
+            if (Cache* cache = Cache::Current())
+                return cache->Deallocate(p, size);
+
+            typename Cache::SerializedLock lock;
+            Allocator::Instance().Deallocate(p, size);
+        }
+
+        static void* Allocate(std::size_t size, std::size_t alignment) noexcept {
+            if (size == 0) return nullptr;
+
+            if (Cache* cache = Cache::Current())
+                return cache->Allocate(size, alignment);
+
+            typename Cache::SerializedLock lock;
+            return Allocator::Instance().Allocate(size, alignment);
+        }
+
+        static void Free(void* p, std::size_t size, std::size_t alignment) noexcept {
+
+            if (!p) return;
+
+            if (Cache* cache = Cache::Current())
+                return cache->Deallocate(p, size, alignment);
+
+            typename Cache::SerializedLock lock;
+            Allocator::Instance().Deallocate(p, size, alignment);
+        }
+
+        static std::size_t AllocateBatch(std::size_t size, std::size_t n, void** out) noexcept {
+            if (size == 0) return 0;
+
+            if (Cache* cache = Cache::Current())
+                return cache->AllocateBatch(size, n, out);
+
+            typename Cache::SerializedLock lock;
+            return Allocator::Instance().AllocateBatch(size, n, out);
+        }
+
+        static void FreeBatch(std::size_t size, std::size_t n, void** in) noexcept {
+
+            if (Cache* cache = Cache::Current())
+                return cache->DeallocateBatch(size, n, in);
+
+            typename Cache::SerializedLock lock;
+            Allocator::Instance().DeallocateBatch(size, n, in);
+        }
+    };
+
+    using TcSOABackend = ThreadCacheBackend<soa::SmallObjAllocator>;
+    using TcCtmSOABackend = ThreadCacheBackend<soa::CtmSmallObjAllocator>;
+}
+
+
+#endif // !THREAD_CACHE_BACKEND_H
@@ -5,6 +5,19 @@ namespace tst {
 
 	void TestAllocatorsWithVector();
 
+	// the releases of the RetentionPolicy bring the resident memory back
+	// down without any Trim(), true if they do
+	bool TestRetentionReleasesMemory();
+
+	// Chunk8/16/32 and BitmapChunk behind FixedAllocator and CtmFixedAllocator:
+	// no duplicate blocks, full/empty transitions, batch round-trips
+	bool TestChunkEngines();
+
+#ifdef SOA_HARDENED
+	// every detection path of Hardened.h, true if each misuse is reported once
+	bool TestHardened();
+#endif
+
 }
 
 
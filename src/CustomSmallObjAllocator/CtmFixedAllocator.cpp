@@ -1,85 +1,178 @@
+#include <algorithm>
+#include <bit>
 #include <cassert>
 #include <cstdint> // uintptr_t
+#include <cstring>
+#include <new>
 #include <stdexcept>
 #include "CustomSmallObjAllocator\CtmFixedAllocator.h"
 #include "SmallObjAllocator\SOA_defaults.h"
+#include "SmallObjAllocator\SOA_memory.h"
+#include "SmallObjAllocator\Hardened.h"
 #include "SmallObjAllocator\SOA_debug.h"
 
 /// -----------------------------------------------------------------------------
 /// CtmFixedAllocator ctor
 /// -----------------------------------------------------------------------------
-
-soa::CtmFixedAllocator::CtmFixedAllocator(std::size_t blockSize)
-	: m_blockSize(blockSize)
+/// In aligned mode the storage size is rounded up to a power of two,
+/// blocks fill it up to the trailer holding the owning Chunk* (and up to
+/// the occupancy shadow of a hardened Chunk, see StorageBytes).
+
+template<typename ChunkT>
+soa::BasicCtmFixedAllocator<ChunkT>::BasicCtmFixedAllocator(std::size_t blockSize, std::size_t chunkSize,
+	CtmChunkLookup lookup, PageProvider* provider, const RetentionPolicy& retention)
+	: m_blockSize(blockSize + DEFAULT_REDZONE_SIZE)
+	, m_lookup(lookup)
+	, m_provider(provider ? provider : &DefaultPageProvider())
+	, m_retention(retention)
+	, m_owner(std::this_thread::get_id())
 {
+	assert(m_retention.m_lowWatermark <= m_retention.m_highWatermark);
 	assert(m_blockSize > 0);
+	assert(m_blockSize >= sizeof(void*)); // a freed block must hold a remote list link
+	assert(m_blockSize >= sizeof(IndexT));
+
+	constexpr std::size_t maxBlocks = ChunkT::MAX_BLOCKS;
+
+	std::size_t numBlocks = chunkSize / m_blockSize;
+	if (numBlocks == 0) numBlocks = 8 * blockSize;
+	if (numBlocks > maxBlocks) numBlocks = maxBlocks;
+
+	if (m_lookup == CtmChunkLookup::Aligned)
+	{
+		m_chunkAlignment = (std::max)(NextPowerOfTwo(ChunkT::StorageBytes(m_blockSize, numBlocks) + sizeof(ChunkNode*)),
+			DEFAULT_PAGE_MAP_PAGE);
 
-	std::size_t numBlocks = DEFAULT_CHUNK_SIZE / blockSize;
-	if (numBlocks > UCHAR_MAX) numBlocks = UCHAR_MAX;
-	else if (numBlocks == 0) numBlocks = 8 * blockSize;
+		numBlocks = (m_chunkAlignment - sizeof(ChunkNode*)) / m_blockSize;
+		if (numBlocks > maxBlocks) numBlocks = maxBlocks;
+
+		while (ChunkT::StorageBytes(m_blockSize, numBlocks) + sizeof(ChunkNode*) > m_chunkAlignment)
+			--numBlocks;
+	}
+
+	else
+	{
+		m_chunkAlignment = DEFAULT_PAGE_MAP_PAGE;
+	}
 
-	m_numBlocks = static_cast<unsigned char>(numBlocks);
+	m_numBlocks = static_cast<IndexT>(numBlocks);
 
 	assert(m_numBlocks == numBlocks);
+
+	// rounded down: a partial chunk never reaches NUM_PARTIAL_BUCKETS
+	m_bucketScale = (std::uint64_t(NUM_PARTIAL_BUCKETS) << 32) / m_numBlocks;
+
+	m_chunkBytes = m_lookup == CtmChunkLookup::Aligned
+		? m_chunkAlignment
+		: AlignUp(ChunkT::StorageBytes(m_blockSize, numBlocks), m_chunkAlignment);
 }
 
 /// -----------------------------------------------------------------------------
 /// CtmFixedAllocator dtor
 /// -----------------------------------------------------------------------------
 
-soa::CtmFixedAllocator::~CtmFixedAllocator()
+template<typename ChunkT>
+soa::BasicCtmFixedAllocator<ChunkT>::~BasicCtmFixedAllocator()
 {
 	SOA_LOG_OSS("Fixed Destructor");
-	std::deque<Chunk>::iterator i = m_chunks.begin();
+
+	// blocks freed remotely after the last allocation are still pending
+	DrainRemoteFrees();
+
+	auto i = m_chunks.begin();
 	for (; i != m_chunks.end(); ++i)
 	{
+		// storage already released
+		if (!i->m_pData) continue;
+
 		SOA_LOG_OSS("Chunk: blocks available: " << static_cast<int>(i->m_blocksAvailable));
 		assert(i->m_blocksAvailable == m_numBlocks);
-		i->Release();
+		ReleaseChunk(*i);
 	}
 
 	m_chunks.clear();
-	m_chunkMap.clear();
 }
 
 /// -----------------------------------------------------------------------------
 /// CtmFixedAllocator move ctor
 /// -----------------------------------------------------------------------------
 
-soa::CtmFixedAllocator::CtmFixedAllocator(CtmFixedAllocator&& other) noexcept
+template<typename ChunkT>
+soa::BasicCtmFixedAllocator<ChunkT>::BasicCtmFixedAllocator(BasicCtmFixedAllocator&& other) noexcept
 	: m_blockSize(other.m_blockSize)
 	, m_numBlocks(other.m_numBlocks)
+	, m_bucketScale(other.m_bucketScale)
+	, m_lookup(other.m_lookup)
+	, m_chunkAlignment(other.m_chunkAlignment)
+	, m_chunkBytes(other.m_chunkBytes)
+	, m_provider(other.m_provider)
 	, m_chunks(std::move(other.m_chunks))
+	, m_freeChunks(std::move(other.m_freeChunks))
+	, m_releasedChunks(std::move(other.m_releasedChunks))
+	, m_partialMask(other.m_partialMask)
+	, m_retention(other.m_retention)
+	, m_emptySince(other.m_emptySince)
 	, m_allocChunk(other.m_allocChunk)
 	, m_deallocChunk(other.m_deallocChunk)
-	, m_chunkMap(std::move(other.m_chunkMap))
+	, m_owner(other.m_owner)
+	, m_remoteFrees(other.m_remoteFrees.exchange(nullptr, std::memory_order_acquire))
+	, m_stats(other.m_stats)
 {
+	std::copy(std::begin(other.m_partial), std::end(other.m_partial), m_partial);
+
+#ifdef SOA_HARDENED
+	for (ChunkNode& chunk : m_chunks) chunk.m_allocator = this;
+#endif
+
 	// steal approach
 	other.m_allocChunk = nullptr;
 	other.m_deallocChunk = nullptr;
 	other.m_blockSize = 0;
 	other.m_numBlocks = 0;
+	std::fill(std::begin(other.m_partial), std::end(other.m_partial), nullptr);
+	other.m_partialMask = 0;
 }
 
 /// -----------------------------------------------------------------------------
 /// CtmFixedAllocator move assignment
 /// -----------------------------------------------------------------------------
 
-soa::CtmFixedAllocator& soa::CtmFixedAllocator::operator=(CtmFixedAllocator&& other) noexcept
+template<typename ChunkT>
+soa::BasicCtmFixedAllocator<ChunkT>& soa::BasicCtmFixedAllocator<ChunkT>::operator=(BasicCtmFixedAllocator&& other) noexcept
 {
 	if (this != &other) {
 		
 		m_blockSize = other.m_blockSize;
 		m_numBlocks = other.m_numBlocks;
+		m_bucketScale = other.m_bucketScale;
+		m_lookup = other.m_lookup;
+		m_chunkAlignment = other.m_chunkAlignment;
+		m_chunkBytes = other.m_chunkBytes;
+		m_provider = other.m_provider;
 		m_chunks = std::move(other.m_chunks);
 		m_allocChunk = other.m_allocChunk;
 		m_deallocChunk = other.m_deallocChunk;
-		m_chunkMap = std::move(other.m_chunkMap);
+		m_freeChunks = std::move(other.m_freeChunks);
+		m_releasedChunks = std::move(other.m_releasedChunks);
+		std::copy(std::begin(other.m_partial), std::end(other.m_partial), m_partial);
+		m_partialMask = other.m_partialMask;
+		m_retention = other.m_retention;
+		m_emptySince = other.m_emptySince;
+		m_owner = other.m_owner;
+		m_remoteFrees.store(other.m_remoteFrees.exchange(nullptr, std::memory_order_acquire),
+			std::memory_order_relaxed);
+		m_stats = other.m_stats;
+
+#ifdef SOA_HARDENED
+		for (ChunkNode& chunk : m_chunks) chunk.m_allocator = this;
+#endif
 
 		other.m_allocChunk = nullptr;
 		other.m_deallocChunk = nullptr;
 		other.m_blockSize = 0;
 		other.m_numBlocks = 0;
+		std::fill(std::begin(other.m_partial), std::end(other.m_partial), nullptr);
+		other.m_partialMask = 0;
 	}
 	return *this;
 }
@@ -88,111 +181,220 @@ soa::CtmFixedAllocator& soa::CtmFixedAllocator::operator=(CtmFixedAllocator&& ot
 /// CtmFixedAllocator::Allocate
 /// -----------------------------------------------------------------------------
 
-void* soa::CtmFixedAllocator::Allocate()
+template<typename ChunkT>
+void* soa::BasicCtmFixedAllocator<ChunkT>::Allocate()
 {
-	// current allocChunk has no available blocks
+	assert(IsOwnerThread());
+
+	// first give back to their chunks the blocks freed by other threads,
+	// it can make m_allocChunk usable again
+	DrainPendingRemoteFrees();
+
+	// current allocChunk has no available blocks: it stays on no list
+	// until a deallocation makes it partial again
 	if (!m_allocChunk || m_allocChunk->m_blocksAvailable == 0)
 	{
-		// current chunk is full, so increment the number of full chunks
-		if(!m_chunks.empty())
+		// fullest partial chunk first
+		if (m_partialMask)
 		{
-			++m_numFullChunks;
+			const std::size_t bucket = std::bit_width(m_partialMask) - 1;
+			m_allocChunk = m_partial[bucket];
+			UnlinkPartial(m_allocChunk);
 		}
-		
-		assert(m_numFullChunks <= m_chunks.size());
-
-		// first checks if there is an empty free block for faster allocation
-		// I think could improve "a little" in some scenarios, if you deallocate
-		// completely some chunks at a some point. But obviously it depends from
-		// real case scenarios. For now, I just like to think and take different
-		// approaches for exercise.
 
-		if (!m_freeChunks.empty())
+		// then an empty chunk: faster than a new one, the storage is
+		// already there
+		else if (!m_freeChunks.empty())
 		{
 			m_allocChunk = m_freeChunks.back();
 			m_freeChunks.pop_back();
+		}
 
-			// add the key to the map
-			std::uintptr_t key = reinterpret_cast<uintptr_t>(m_allocChunk->m_pData);
-			m_chunkMap[key] = m_allocChunk;
+		// all full, allocate new Chunk
+		else
+		{
+			m_allocChunk = NewChunk();
+			m_deallocChunk = &m_chunks.front(); // m_deallocChunk = m_allocChunk; 
 		}
 
-		// no empty chunks? Check if all of them are full, if that so
-		// immediately create a new chunk.
+		PublishChunks();
+	}
 
-		else if(m_chunks.size() == m_numFullChunks)
-		{
-			// all full, allocate new Chunk
-			
-			m_chunks.emplace_back();
-			Chunk* newChunkPtr = &m_chunks.back();
-			newChunkPtr->Init(m_blockSize, m_numBlocks);
+	assert(m_allocChunk);
+	assert(m_allocChunk->m_blocksAvailable > 0);
 
-			// register to the map
-			std::uintptr_t key = reinterpret_cast<uintptr_t>(newChunkPtr->m_pData);
-			m_chunkMap[key] = newChunkPtr;
+	const bool wasEmpty = m_allocChunk->m_blocksAvailable == m_numBlocks;
 
-			m_allocChunk = newChunkPtr;
-			m_deallocChunk = &m_chunks.front(); // m_deallocChunk = m_allocChunk; 
-		}
+	void* p = m_allocChunk->Allocate(m_blockSize);
+
+	// an empty allocChunk is going to be used
+	if (wasEmpty) PublishChunks();
 
-		// some chunks are not full, so find the right one
-		else 
+#ifdef SOA_HARDENED
+	// corrupt free list reported: the chunk is out of blocks, next one
+	if (!p) return Allocate();
+#endif
+
+	m_stats.OnAllocate();
+	return p;
+}
+
+/// -----------------------------------------------------------------------------
+/// CtmFixedAllocator::AllocateBatch
+/// -----------------------------------------------------------------------------
+/// Drains allocChunk with a single Chunk::AllocateBatch, the Allocate slow
+/// path picks the next chunk (and drains the remote frees) when it is full.
+/// Throws std::bad_alloc as Allocate does.
+
+template<typename ChunkT>
+std::size_t soa::BasicCtmFixedAllocator<ChunkT>::AllocateBatch(std::size_t n, void** out)
+{
+	assert(IsOwnerThread());
+
+	DrainPendingRemoteFrees();
+
+	std::size_t taken = 0;
+
+	while (taken < n)
+	{
+		if (!m_allocChunk || m_allocChunk->m_blocksAvailable == 0)
 		{
-			for (auto& [base, chunk] : m_chunkMap) {
-				if (chunk->m_blocksAvailable > 0) {
-					m_allocChunk = chunk;
-					break;
-				}
-			}
+			out[taken++] = Allocate();
+			continue;
 		}
+
+		const bool wasEmpty = m_allocChunk->m_blocksAvailable == m_numBlocks;
+
+		const std::size_t count = m_allocChunk->AllocateBatch(m_blockSize, n - taken, out + taken);
+		if (wasEmpty) PublishChunks();
+
+		m_stats.OnAllocate(count);
+		taken += count;
 	}
 
-	assert(m_allocChunk);
-	assert(m_allocChunk->m_blocksAvailable > 0);
+	return taken;
+}
+
+/// -----------------------------------------------------------------------------
+/// CtmFixedAllocator::DeallocateBatch
+/// -----------------------------------------------------------------------------
+
+template<typename ChunkT>
+void soa::BasicCtmFixedAllocator<ChunkT>::DeallocateBatch(std::size_t n, void** in)
+{
+#ifdef SOA_HARDENED
+	// one Deallocate per block, every one is checked
+	for (std::size_t i = 0; i < n; ++i) Deallocate(in[i]);
+#else
+	if (n == 0) return;
 
-	return m_allocChunk->Allocate(m_blockSize);
+	if (!IsOwnerThread())
+	{
+		RemoteDeallocateBatch(n, in);
+		return;
+	}
+
+	DrainPendingRemoteFrees();
+	OwnerDeallocateBatch(n, in);
+#endif
 }
 
 /// -----------------------------------------------------------------------------
 /// CtmFixedAllocator::Deallocate
 /// -----------------------------------------------------------------------------
+/// Blocks freed by a thread different from the owner are deferred
+/// to the owner with RemoteDeallocate. The owner side (owner thread or
+/// SerializedOwnerScope) gives back the pending ones first.
+/// Hardened: a block waiting on the remote list is marked in its redzone,
+/// freeing it again (from any thread) is a double free.
+
+template<typename ChunkT>
+void soa::BasicCtmFixedAllocator<ChunkT>::Deallocate(void* p)
+{
+#ifdef SOA_HARDENED
+	if (!hardened::CheckOwnership(p, GetBlockSize()))
+		return;
+#endif
+
+	if (!IsOwnerThread())
+	{
+#ifdef SOA_HARDENED
+		if (!hardened::MarkRemoteFree(static_cast<unsigned char*>(p), m_blockSize))
+			return;
+#endif
+		RemoteDeallocate(p);
+		return;
+	}
+
+	DrainPendingRemoteFrees();
+	OwnerDeallocate(p);
+}
+
+/// -----------------------------------------------------------------------------
+/// CtmFixedAllocator::OwnerDeallocate
+/// -----------------------------------------------------------------------------
 /// From cpp reference: https://en.cppreference.com/w/cpp/types/integer.html
 /// uintptr_t: unsigned integer type capable of holding a pointer to void.
+/// 
+/// [NOTE] m_deallocChunk can't be checked against the front/back addresses
+/// of m_chunks: deque elements are not stored contiguously.
 
-void soa::CtmFixedAllocator::Deallocate(void* p)
+template<typename ChunkT>
+void soa::BasicCtmFixedAllocator<ChunkT>::OwnerDeallocate(void* p)
 {
+#ifdef SOA_HARDENED
+	// nullptr: a block of another allocator of the same size class
+	ChunkNode* chunk = m_chunks.empty() ? nullptr : FindChunk(p);
+	if (!chunk)
+		return ReportHardened(HardenedError::ForeignPointer, p, GetBlockSize());
+
+	if (hardened::IsMarkedRemoteFree(static_cast<unsigned char*>(p), m_blockSize))
+		return ReportHardened(HardenedError::DoubleFree, p, GetBlockSize());
+
+	m_deallocChunk = chunk;
+#else
 	assert(!m_chunks.empty());
-	assert(&m_chunks.front() <= m_deallocChunk);
-	assert(&m_chunks.back() >= m_deallocChunk);
+	assert(m_deallocChunk);
 
-	std::uintptr_t addr = reinterpret_cast<std::uintptr_t>(p);
+	m_deallocChunk = FindChunk(p);
+#endif
 
-	// find chunk with upper_bound
-	auto it = m_chunkMap.upper_bound(addr);
-	if (it == m_chunkMap.begin()) {
-		throw std::runtime_error("Pointer not in any chunk");
-	}
-	--it;
+	DoDeallocate(p);
+	m_stats.OnFree();
+}
 
-	Chunk* chunk = it->second;
+/// -----------------------------------------------------------------------------
+/// CtmFixedAllocator::OwnerDeallocateBatch
+/// -----------------------------------------------------------------------------
+/// Runs of blocks of the same chunk are given back with a single
+/// Chunk::DeallocateBatch, the chunk is looked up once per run.
+/// Hardened: one OwnerDeallocate per block.
 
-	std::uintptr_t base = reinterpret_cast<std::uintptr_t>(chunk->m_pData);
-	std::uintptr_t end = base + m_numBlocks * m_blockSize;
+template<typename ChunkT>
+void soa::BasicCtmFixedAllocator<ChunkT>::OwnerDeallocateBatch(std::size_t n, void** in)
+{
+#ifdef SOA_HARDENED
+	for (std::size_t i = 0; i < n; ++i) OwnerDeallocate(in[i]);
+#else
+	assert(!m_chunks.empty());
 
-	assert(addr >= base && addr < end);
+	std::size_t i = 0;
 
-	m_deallocChunk = chunk;
+	while (i < n)
+	{
+		m_deallocChunk = FindChunk(in[i]);
 
-	bool b_IsChunkFullBeforeDeallocation = m_deallocChunk->m_blocksAvailable == 0 ? true : false;
+		std::size_t run = 1;
+		while (i + run < n && ChunkContains(*m_deallocChunk, in[i + run])) ++run;
 
-	DoDeallocate(p);
+		m_deallocChunk->DeallocateBatch(m_blockSize, run, in + i);
+		RequeueDeallocChunk();
 
-	// if the chunk was full decrease m_numFullChunks
-	if (b_IsChunkFullBeforeDeallocation)
-	{
-		--m_numFullChunks;
+		i += run;
 	}
+
+	m_stats.OnFree(n);
+#endif
 }
 
 /// -----------------------------------------------------------------------------
@@ -200,24 +402,474 @@ void soa::CtmFixedAllocator::Deallocate(void* p)
 /// -----------------------------------------------------------------------------
 /// Performs deallocation. Assumes deallocChunk_ points to the correct chunk
 /// 
-/// For now just checks if the chunk is empty, remove for map and add it to
-/// the vector of empty chunks
+/// Then the chunk goes to the list of its new occupancy, see RequeueDeallocChunk.
 
-void soa::CtmFixedAllocator::DoDeallocate(void* p)
+template<typename ChunkT>
+void soa::BasicCtmFixedAllocator<ChunkT>::DoDeallocate(void* p)
 {
 	assert(m_deallocChunk->m_pData <= p);
 	assert(m_deallocChunk->m_pData + m_numBlocks * m_blockSize > p);
 
 	m_deallocChunk->Deallocate(p, m_blockSize);
 
-	// Check if the Chunk is empty
-	if (m_deallocChunk->m_blocksAvailable == m_numBlocks)
+	RequeueDeallocChunk();
+}
+
+/// -----------------------------------------------------------------------------
+/// CtmFixedAllocator::RequeueDeallocChunk
+/// -----------------------------------------------------------------------------
+/// Called after blocks went back to deallocChunk.
+/// - allocChunk stays where it is: it keeps serving allocations and must not
+///   be handed out a second time from a list or from m_freeChunks. Empty,
+///   it is counted as such in the stats.
+/// - Still partial: moved to the bucket of its occupancy (it was on no list
+///   if it was full).
+/// - Empty: added to the vector of empty chunks.
+
+template<typename ChunkT>
+void soa::BasicCtmFixedAllocator<ChunkT>::RequeueDeallocChunk()
+{
+	if (m_deallocChunk == m_allocChunk)
 	{
-		// remove from map
-		std::uintptr_t pt = reinterpret_cast<std::uintptr_t>(m_deallocChunk->m_pData);
-		m_chunkMap.erase(pt);
+		if (m_allocChunk->m_blocksAvailable == m_numBlocks) PublishChunks();
+		return;
+	}
+
+	if (m_deallocChunk->m_blocksAvailable != m_numBlocks)
+	{
+		LinkPartial(m_deallocChunk);
+		return;
+	}
+
+	UnlinkPartial(m_deallocChunk);
+
+	m_freeChunks.push_back(m_deallocChunk);
+	m_deallocChunk = &m_chunks.front();
+	PublishChunks();
+
+	if (MustRelease())
+		ReleaseEmptyChunks(m_retention.m_lowWatermark);
+}
+
+/// -----------------------------------------------------------------------------
+/// CtmFixedAllocator::LinkPartial
+/// -----------------------------------------------------------------------------
+/// Puts a partial chunk at the head of the list of its occupancy.
+/// Already there? Nothing to do, that's the common case.
+
+template<typename ChunkT>
+void soa::BasicCtmFixedAllocator<ChunkT>::LinkPartial(ChunkNode* chunk)
+{
+	assert(chunk->m_blocksAvailable > 0 && chunk->m_blocksAvailable < m_numBlocks);
+
+	const std::size_t used = m_numBlocks - chunk->m_blocksAvailable;
+	const std::uint8_t bucket = static_cast<std::uint8_t>((used * m_bucketScale) >> 32);
+
+	assert(bucket < NUM_PARTIAL_BUCKETS);
+
+	if (chunk->m_bucket == bucket)
+		return;
+
+	UnlinkPartial(chunk);
+
+	chunk->m_bucket = bucket;
+	chunk->m_prevPartial = nullptr;
+	chunk->m_nextPartial = m_partial[bucket];
+
+	if (m_partial[bucket])
+		m_partial[bucket]->m_prevPartial = chunk;
+
+	m_partial[bucket] = chunk;
+	m_partialMask |= std::uint32_t(1) << bucket;
+}
+
+/// -----------------------------------------------------------------------------
+/// CtmFixedAllocator::UnlinkPartial
+/// -----------------------------------------------------------------------------
+
+template<typename ChunkT>
+void soa::BasicCtmFixedAllocator<ChunkT>::UnlinkPartial(ChunkNode* chunk)
+{
+	const std::uint8_t bucket = chunk->m_bucket;
+
+	if (bucket == NO_BUCKET)
+		return;
+
+	if (chunk->m_prevPartial)
+		chunk->m_prevPartial->m_nextPartial = chunk->m_nextPartial;
+	else
+		m_partial[bucket] = chunk->m_nextPartial;
+
+	if (chunk->m_nextPartial)
+		chunk->m_nextPartial->m_prevPartial = chunk->m_prevPartial;
+
+	if (!m_partial[bucket])
+		m_partialMask &= ~(std::uint32_t(1) << bucket);
+
+	chunk->m_bucket = NO_BUCKET;
+	chunk->m_prevPartial = chunk->m_nextPartial = nullptr;
+}
+
+/// -----------------------------------------------------------------------------
+/// CtmFixedAllocator::MustRelease
+/// -----------------------------------------------------------------------------
+/// Over the high watermark, or over the low one for longer than the decay
+/// (since m_emptySince, see StampEmptySince).
+/// The clock is read only with a decay and more than low empty chunks.
+
+template<typename ChunkT>
+bool soa::BasicCtmFixedAllocator<ChunkT>::MustRelease()
+{
+	const std::size_t numEmpty = m_freeChunks.size();
+
+	if (numEmpty > m_retention.m_highWatermark)
+		return true;
+
+	if (m_retention.m_decay.count() == 0 || numEmpty <= m_retention.m_lowWatermark)
+		return false;
+
+	return std::chrono::steady_clock::now() - m_emptySince >= m_retention.m_decay;
+}
+
+/// -----------------------------------------------------------------------------
+/// CtmFixedAllocator::ReleaseEmptyChunks
+/// -----------------------------------------------------------------------------
+/// The oldest empty chunks go first: Allocate reuses from the back.
+/// Nothing points to the chunk anymore once its storage is released: its
+/// PageMap entry is cleared, and in aligned mode the trailer goes with it.
+
+template<typename ChunkT>
+std::size_t soa::BasicCtmFixedAllocator<ChunkT>::ReleaseEmptyChunks(std::size_t keep)
+{
+	if (m_freeChunks.size() <= keep)
+		return 0;
+
+	const std::size_t released = m_freeChunks.size() - keep;
+
+	for (std::size_t i = 0; i < released; ++i)
+	{
+		ChunkNode* chunk = m_freeChunks[i];
+
+		ReleaseChunk(*chunk);
+		chunk->m_pData = nullptr;
 
-		m_freeChunks.push_back(m_deallocChunk);
-		m_deallocChunk = &m_chunks.front();
+		m_releasedChunks.push_back(chunk);
 	}
-}
\ No newline at end of file
+
+	m_freeChunks.erase(m_freeChunks.begin(), m_freeChunks.begin() + released);
+	PublishChunks();
+
+	SOA_LOG_OSS("CtmFixedAllocator (" << m_blockSize << "): released " << released << " chunks");
+
+	return released;
+}
+
+/// -----------------------------------------------------------------------------
+/// CtmFixedAllocator::Trim
+/// -----------------------------------------------------------------------------
+/// An empty m_allocChunk is an empty chunk like the others: it goes to the
+/// back of m_freeChunks, the last one released, the first one reused.
+
+template<typename ChunkT>
+std::size_t soa::BasicCtmFixedAllocator<ChunkT>::Trim(std::size_t keep)
+{
+	assert(IsOwnerThread());
+
+	DrainRemoteFrees();
+
+	if (m_allocChunk && m_allocChunk->m_blocksAvailable == m_numBlocks)
+	{
+		m_freeChunks.push_back(m_allocChunk);
+		m_allocChunk = nullptr;
+	}
+
+	return ReleaseEmptyChunks(keep);
+}
+
+/// -----------------------------------------------------------------------------
+/// CtmFixedAllocator::Reset
+/// -----------------------------------------------------------------------------
+/// Every chunk with storage goes to m_freeChunks (on no partial list),
+/// then the retention policy trims them
+
+template<typename ChunkT>
+void soa::BasicCtmFixedAllocator<ChunkT>::Reset()
+{
+	assert(IsOwnerThread());
+
+	ClearLists();
+
+	for (ChunkNode& chunk : m_chunks)
+	{
+		if (!chunk.m_pData) continue; // already in m_releasedChunks
+
+		chunk.Reset(m_blockSize, m_numBlocks);
+		m_freeChunks.push_back(&chunk);
+	}
+
+	m_allocChunk = nullptr;
+	m_deallocChunk = m_chunks.empty() ? nullptr : &m_chunks.front();
+
+	m_stats.OnFreeAll();
+	PublishChunks();
+
+	ReleaseEmptyChunks(m_retention.m_highWatermark);
+}
+
+/// -----------------------------------------------------------------------------
+/// CtmFixedAllocator::Release
+/// -----------------------------------------------------------------------------
+/// The chunks stay in the deque as placeholders, reused by NewChunk
+
+template<typename ChunkT>
+std::size_t soa::BasicCtmFixedAllocator<ChunkT>::Release()
+{
+	assert(IsOwnerThread());
+
+	ClearLists();
+
+	std::size_t released = 0;
+
+	for (ChunkNode& chunk : m_chunks)
+	{
+		if (!chunk.m_pData) continue;
+
+		ReleaseChunk(chunk);
+		chunk.m_pData = nullptr;
+		m_releasedChunks.push_back(&chunk);
+		++released;
+	}
+
+	m_allocChunk = m_deallocChunk = nullptr;
+
+	m_stats.OnFreeAll();
+	PublishChunks();
+
+	SOA_LOG_OSS("CtmFixedAllocator (" << m_blockSize << "): released " << released << " chunks");
+
+	return released;
+}
+
+/// -----------------------------------------------------------------------------
+/// CtmFixedAllocator::ClearLists
+/// -----------------------------------------------------------------------------
+/// Empties partial lists, m_freeChunks and the remote frees, whose
+/// blocks belong to chunks that are being reset or released
+
+template<typename ChunkT>
+void soa::BasicCtmFixedAllocator<ChunkT>::ClearLists()
+{
+	m_remoteFrees.store(nullptr, std::memory_order_relaxed);
+
+	m_freeChunks.clear();
+
+	std::fill(std::begin(m_partial), std::end(m_partial), nullptr);
+	m_partialMask = 0;
+
+	for (ChunkNode& chunk : m_chunks)
+	{
+		chunk.m_bucket = NO_BUCKET;
+		chunk.m_prevPartial = chunk.m_nextPartial = nullptr;
+	}
+}
+
+/// -----------------------------------------------------------------------------
+/// CtmFixedAllocator::SetRetentionPolicy
+/// -----------------------------------------------------------------------------
+/// Owner side only, applies the new high watermark right away
+
+template<typename ChunkT>
+void soa::BasicCtmFixedAllocator<ChunkT>::SetRetentionPolicy(const RetentionPolicy& retention)
+{
+	assert(IsOwnerThread());
+	assert(retention.m_lowWatermark <= retention.m_highWatermark);
+
+	DrainPendingRemoteFrees();
+
+	m_retention = retention;
+	StampEmptySince(m_freeChunks.size()); // the low watermark may have moved
+
+	if (m_freeChunks.size() > m_retention.m_highWatermark)
+		ReleaseEmptyChunks(m_retention.m_lowWatermark);
+}
+
+/// -----------------------------------------------------------------------------
+/// CtmFixedAllocator::NewChunk
+/// -----------------------------------------------------------------------------
+/// Appends a new chunk and registers it for the deallocation lookup.
+/// Deque: the address of the new Chunk is stable, so it can be stored 
+/// as PageMap tag and in the storage trailer.
+/// A chunk whose storage was released is reused before appending.
+
+template<typename ChunkT>
+typename soa::BasicCtmFixedAllocator<ChunkT>::ChunkNode* soa::BasicCtmFixedAllocator<ChunkT>::NewChunk()
+{
+	unsigned char* storage = static_cast<unsigned char*>(
+		m_provider->AllocatePages(m_chunkBytes, m_chunkAlignment));
+
+	if (!storage)
+		throw std::bad_alloc();
+
+	ChunkNode* newChunkPtr;
+
+	if (!m_releasedChunks.empty())
+	{
+		newChunkPtr = m_releasedChunks.back();
+		m_releasedChunks.pop_back();
+	}
+	else
+	{
+		m_chunks.emplace_back();
+		newChunkPtr = &m_chunks.back();
+	}
+
+	if (!PageMap::Instance().Register(storage, m_chunkBytes, GetBlockSize(),
+		reinterpret_cast<std::uintptr_t>(newChunkPtr)))
+	{
+		m_provider->ReleasePages(storage, m_chunkBytes);
+		m_releasedChunks.push_back(newChunkPtr); // placeholder for the next NewChunk
+		throw std::bad_alloc();
+	}
+
+	newChunkPtr->Init(storage, m_blockSize, m_numBlocks);
+
+#ifdef SOA_HARDENED
+	newChunkPtr->m_allocator = this;
+#endif
+
+	if (m_lookup == CtmChunkLookup::Aligned)
+	{
+		// trailer: the owning chunk, found back by masking any block address
+		ChunkNode** trailer = reinterpret_cast<ChunkNode**>(storage + m_chunkAlignment - sizeof(ChunkNode*));
+		*trailer = newChunkPtr;
+	}
+
+	return newChunkPtr;
+}
+
+/// -----------------------------------------------------------------------------
+/// CtmFixedAllocator::ReleaseChunk
+/// -----------------------------------------------------------------------------
+
+template<typename ChunkT>
+void soa::BasicCtmFixedAllocator<ChunkT>::ReleaseChunk(ChunkNode& chunk)
+{
+	PageMap::Instance().Unregister(chunk.m_pData, m_chunkBytes);
+	m_provider->ReleasePages(chunk.m_pData, m_chunkBytes);
+}
+
+/// -----------------------------------------------------------------------------
+/// CtmFixedAllocator::FindChunk
+/// -----------------------------------------------------------------------------
+/// Owning chunk of a block.
+/// - Aligned: mask the address down to the storage base, read the trailer.
+/// - Map: the chunk tag of the PageMap entry of the address.
+/// Hardened: nullptr if the chunk found is not one of this allocator, or
+/// doesn't hold p.
+
+template<typename ChunkT>
+typename soa::BasicCtmFixedAllocator<ChunkT>::ChunkNode* soa::BasicCtmFixedAllocator<ChunkT>::FindChunk(void* p) const
+{
+	std::uintptr_t addr = reinterpret_cast<std::uintptr_t>(p);
+	ChunkNode* chunk;
+
+	if (m_lookup == CtmChunkLookup::Aligned)
+	{
+		std::uintptr_t base = addr & ~(static_cast<std::uintptr_t>(m_chunkAlignment) - 1);
+		chunk = *reinterpret_cast<ChunkNode* const*>(base + m_chunkAlignment - sizeof(ChunkNode*));
+	}
+	else
+	{
+		const std::uintptr_t tag = PageMap::Instance().Chunk(p);
+		chunk = PageMap::IsIndexTag(tag) ? nullptr : reinterpret_cast<ChunkNode*>(tag); // odd: a FixedAllocator chunk
+	}
+
+#ifdef SOA_HARDENED
+	if (!chunk || chunk->m_allocator != this || !ChunkContains(*chunk, p)) return nullptr;
+#else
+	if (!chunk)
+		throw std::runtime_error("Pointer not in any chunk");
+#endif
+
+	assert(ChunkContains(*chunk, p));
+	return chunk;
+}
+
+/// -----------------------------------------------------------------------------
+/// CtmFixedAllocator::RemoteDeallocate
+/// -----------------------------------------------------------------------------
+/// Lock-free push (multiple producers) on the remote free list.
+/// The block is still allocated for its chunk, so we can store the link
+/// inside it. memcpy because blocks are not guaranteed to be pointer aligned.
+
+template<typename ChunkT>
+void soa::BasicCtmFixedAllocator<ChunkT>::RemoteDeallocate(void* p) noexcept
+{
+	void* head = m_remoteFrees.load(std::memory_order_relaxed);
+	do {
+		std::memcpy(p, &head, sizeof(void*));
+	} while (!m_remoteFrees.compare_exchange_weak(head, p,
+		std::memory_order_release, std::memory_order_relaxed));
+}
+
+/// -----------------------------------------------------------------------------
+/// CtmFixedAllocator::RemoteDeallocateBatch
+/// -----------------------------------------------------------------------------
+/// Links the blocks together first, then publishes the whole list with a
+/// single CAS
+
+template<typename ChunkT>
+void soa::BasicCtmFixedAllocator<ChunkT>::RemoteDeallocateBatch(std::size_t n, void** in) noexcept
+{
+	for (std::size_t i = 0; i + 1 < n; ++i)
+		std::memcpy(in[i], &in[i + 1], sizeof(void*));
+
+	void* head = m_remoteFrees.load(std::memory_order_relaxed);
+	do {
+		std::memcpy(in[n - 1], &head, sizeof(void*));
+	} while (!m_remoteFrees.compare_exchange_weak(head, in[0],
+		std::memory_order_release, std::memory_order_relaxed));
+}
+
+/// -----------------------------------------------------------------------------
+/// CtmFixedAllocator::DrainRemoteFrees
+/// -----------------------------------------------------------------------------
+/// Single consumer: the owner detaches the whole list at once and
+/// deallocates its blocks in batch, with no further synchronization.
+/// Blocks freed together by a remote DeallocateBatch are still adjacent
+/// in the list, OwnerDeallocateBatch handles them one chunk at a time.
+
+template<typename ChunkT>
+void soa::BasicCtmFixedAllocator<ChunkT>::DrainRemoteFrees()
+{
+	void* p = m_remoteFrees.exchange(nullptr, std::memory_order_acquire);
+
+	constexpr std::size_t batchSize = 64;
+	void* batch[batchSize];
+	std::size_t count = 0;
+
+	while (p)
+	{
+		batch[count++] = p;
+		std::memcpy(&p, p, sizeof(void*));
+
+#ifdef SOA_HARDENED
+		hardened::UnmarkRemoteFree(static_cast<unsigned char*>(batch[count - 1]), m_blockSize);
+#endif
+
+		if (count == batchSize || !p)
+		{
+			OwnerDeallocateBatch(count, batch);
+			count = 0;
+		}
+	}
+}
+
+/// -----------------------------------------------------------------------------
+/// Explicit instantiations
+/// -----------------------------------------------------------------------------
+
+template class soa::BasicCtmFixedAllocator<soa::Chunk8>;
+template class soa::BasicCtmFixedAllocator<soa::Chunk16>;
+template class soa::BasicCtmFixedAllocator<soa::Chunk32>;
+template class soa::BasicCtmFixedAllocator<soa::BitmapChunk>;
\ No newline at end of file
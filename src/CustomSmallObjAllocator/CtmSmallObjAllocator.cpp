@@ -1,5 +1,10 @@
 #include <cassert>
+#include <cstdlib>
 #include "CustomSmallObjAllocator\CtmSmallObjAllocator.h"
+#include "SmallObjAllocator\PageMap.h"
+#include "SmallObjAllocator\HeapProfiler.h"
+#include "SmallObjAllocator\Hardened.h"
+#include "SmallObjAllocator\SOA_memory.h"
 #include "SmallObjAllocator\SOA_debug.h"
 
 /// -----------------------------------------------------------------------------
@@ -7,23 +12,42 @@
 /// ctor
 /// -----------------------------------------------------------------------------
 
-soa::CtmSmallObjAllocator::CtmSmallObjAllocator(std::size_t chunkSize, std::size_t maxObjectSize)
-	: m_chunkSize(chunkSize), m_maxObjSize(maxObjectSize)
+soa::CtmSmallObjAllocator::CtmSmallObjAllocator(std::size_t chunkSize, std::size_t maxObjectSize,
+	CtmChunkLookup lookup, PageProvider* provider, const RetentionPolicy& retention)
+	: m_table(SizeClassIndex(maxObjectSize) + 1)
+	, m_chunkSize(chunkSize), m_maxObjSize(maxObjectSize), m_lookup(lookup), m_provider(provider)
+	, m_retention(retention)
 {
+	// CtmFixedAllocator blocks must be able to hold a pointer (remote free list)
+	static_assert(DEFAULT_SIZE_GRANULARITY >= sizeof(void*));
 }
 
 /// -----------------------------------------------------------------------------
-/// Functor
+/// CtmSmallObjAllocator::CreateFixedAllocator
 /// -----------------------------------------------------------------------------
 
-namespace {
+soa::CtmFixedAllocator& soa::CtmSmallObjAllocator::CreateFixedAllocator(std::size_t index)
+{
+	assert(index > 0 && index < m_table.size());
+	assert(!m_table[index].load(std::memory_order_relaxed));
 
-	struct CompareCtmFixedAllocatorSize {
+	m_Pool.emplace_back(SizeClassBytes(index), m_chunkSize, m_lookup, m_provider, m_retention);
+	m_table[index].store(&m_Pool.back(), std::memory_order_release);
+	return m_Pool.back();
+}
 
-		bool operator()(const soa::CtmFixedAllocator& x, std::size_t numBytes) const noexcept {
-			return x.GetBlockSize() < numBytes;
-		}
-	};
+/// -----------------------------------------------------------------------------
+/// CtmSmallObjAllocator::GetFixedAllocator
+/// -----------------------------------------------------------------------------
+
+soa::CtmFixedAllocator& soa::CtmSmallObjAllocator::GetFixedAllocator(std::size_t numBytes)
+{
+	assert(numBytes <= m_maxObjSize);
+
+	const std::size_t index = SizeClassIndex(numBytes);
+	CtmFixedAllocator* fixed = m_table[index].load(std::memory_order_acquire);
+
+	return fixed ? *fixed : CreateFixedAllocator(index);
 }
 
 /// -----------------------------------------------------------------------------
@@ -38,61 +62,263 @@ void* soa::CtmSmallObjAllocator::Allocate(std::size_t numBytes)
 		return std::malloc(numBytes); // previous: return operator new(numBytes); Bad with global overrides
 	}
 
+	const std::size_t index = SizeClassIndex(numBytes);
+	CtmFixedAllocator* fixed = m_table[index].load(std::memory_order_acquire);
+
+	if (!fixed)
+		fixed = &CreateFixedAllocator(index);
+
+	SOA_LOG("Soa allocate called");
+	void* p = fixed->Allocate();
+
+	if (HeapProfiler::Tick(SizeClassBytes(index))) [[unlikely]]
+		HeapProfiler::Instance().RecordAllocation(this, p, SizeClassBytes(index));
+
+	return p;
+}
+
+/// -----------------------------------------------------------------------------
+/// CtmSmallObjAllocator::Deallocate
+/// -----------------------------------------------------------------------------
+/// Can be called from a thread that doesn't own the size class: the fixed 
+/// allocator defers the block to its owner. The table is only read here.
 
-	if (m_pLastAlloc && m_pLastAlloc->GetBlockSize() == numBytes)
+void soa::CtmSmallObjAllocator::Deallocate(void* p, std::size_t numBytes)
+{
+	if (numBytes > m_maxObjSize)
 	{
-		SOA_LOG("Soa allocate called");
-		return m_pLastAlloc->Allocate();
+#ifdef SOA_HARDENED
+		if (!hardened::CheckNotInChunk(p)) return;
+#endif
+		SOA_LOG("std::free called");
+		return std::free(p);
 	}
 
-	std::vector<CtmFixedAllocator>::iterator it = std::lower_bound(
-		m_Pool.begin(),
-		m_Pool.end(),
-		numBytes,
-		CompareCtmFixedAllocatorSize{});
+	CtmFixedAllocator* fixed = m_table[SizeClassIndex(numBytes)].load(std::memory_order_acquire);
 
-	if (it == m_Pool.end() || it->GetBlockSize() != numBytes)
+	assert(fixed);
+
+	SOA_LOG("Soa deallocate called");
+	HeapProfiler::OnFree(p);
+	fixed->Deallocate(p);
+}
+
+/// -----------------------------------------------------------------------------
+/// CtmSmallObjAllocator::Deallocate (size-less)
+/// -----------------------------------------------------------------------------
+/// The PageMap gives the size class, then the fixed allocator reads the
+/// chunk tag of the same entry: no search of its chunks. A block of another
+/// allocator would be given to the fixed allocator of its size here: don't
+/// mix them.
+
+void soa::CtmSmallObjAllocator::Deallocate(void* p)
+{
+	if (!p) return;
+
+	const std::size_t blockSize = PageMap::Instance().BlockSize(p);
+
+	if (!blockSize)
 	{
-		it = m_Pool.insert(it, CtmFixedAllocator(numBytes));
-		m_pLastDealloc = &*m_Pool.begin();
+		SOA_LOG("std::free called");
+		return std::free(p);
 	}
 
-	m_pLastAlloc = &*it;
+	assert(blockSize <= m_maxObjSize);
 
-	SOA_LOG("Soa allocate called");
-	return m_pLastAlloc->Allocate();
+	CtmFixedAllocator* fixed = m_table[SizeClassIndex(blockSize)].load(std::memory_order_acquire);
+
+	assert(fixed && fixed->GetBlockSize() == blockSize);
+
+	SOA_LOG("Soa deallocate called");
+	HeapProfiler::OnFree(p);
+	fixed->Deallocate(p);
 }
 
 /// -----------------------------------------------------------------------------
-/// CtmSmallObjAllocator::Deallocate
+/// CtmSmallObjAllocator::AllocateBatch
 /// -----------------------------------------------------------------------------
+/// One size check and one table lookup for the whole batch, then the fixed
+/// allocator fills out chunk by chunk.
+/// Returns how many objects were allocated: less than n only when out of memory.
 
-void soa::CtmSmallObjAllocator::Deallocate(void* p, std::size_t numBytes)
+std::size_t soa::CtmSmallObjAllocator::AllocateBatch(std::size_t numBytes, std::size_t n, void** out)
 {
 	if (numBytes > m_maxObjSize)
 	{
-		SOA_LOG("std::free called");
-		return std::free(p);
+		SOA_LOG("std::malloc called");
+		for (std::size_t i = 0; i < n; ++i)
+		{
+			out[i] = std::malloc(numBytes);
+			if (!out[i]) return i;
+		}
+		return n;
 	}
 
-	if (m_pLastDealloc && m_pLastDealloc->GetBlockSize() == numBytes)
+	const std::size_t index = SizeClassIndex(numBytes);
+	CtmFixedAllocator* fixed = m_table[index].load(std::memory_order_acquire);
+
+	if (!fixed)
+		fixed = &CreateFixedAllocator(index);
+
+	SOA_LOG("Soa allocate batch called");
+	return fixed->AllocateBatch(n, out);
+}
+
+/// -----------------------------------------------------------------------------
+/// CtmSmallObjAllocator::DeallocateBatch
+/// -----------------------------------------------------------------------------
+
+void soa::CtmSmallObjAllocator::DeallocateBatch(std::size_t numBytes, std::size_t n, void** in)
+{
+	if (numBytes > m_maxObjSize)
 	{
-		SOA_LOG("Soa deallocate called");
-		m_pLastDealloc->Deallocate(p);
+		SOA_LOG("std::free called");
+		for (std::size_t i = 0; i < n; ++i) std::free(in[i]);
 		return;
 	}
 
-	std::vector<CtmFixedAllocator>::iterator it = std::lower_bound(
-		m_Pool.begin(),
-		m_Pool.end(),
-		numBytes,
-		CompareCtmFixedAllocatorSize{});
+	CtmFixedAllocator* fixed = m_table[SizeClassIndex(numBytes)].load(std::memory_order_acquire);
 
-	assert(it != m_Pool.end());
-	assert(it->GetBlockSize() == numBytes);
+	assert(fixed);
 
-	m_pLastDealloc = &*it;
+	SOA_LOG("Soa deallocate batch called");
+	for (std::size_t i = 0; i < n; ++i) HeapProfiler::OnFree(in[i]);
+	fixed->DeallocateBatch(n, in);
+}
 
-	SOA_LOG("Soa deallocate called");
-	m_pLastDealloc->Deallocate(p);
-}
\ No newline at end of file
+/// -----------------------------------------------------------------------------
+/// CtmSmallObjAllocator::Allocate (aligned)
+/// -----------------------------------------------------------------------------
+/// Chunks are DEFAULT_CHUNK_ALIGNMENT aligned, so every block of a size class
+/// multiple of alignment is aligned as well: round the request up and take
+/// the usual path (e.g. 48 bytes aligned to 64 are served by the 64 class).
+/// Alignments the size classes can't guarantee go to AlignedMalloc.
+
+void* soa::CtmSmallObjAllocator::Allocate(std::size_t numBytes, std::size_t alignment)
+{
+	assert(IsPowerOfTwo(alignment));
+
+	if (IsDefaultAligned(numBytes, alignment, m_maxObjSize))
+		return Allocate(AlignUp(numBytes, alignment));
+
+	SOA_LOG("AlignedMalloc called");
+	return AlignedMalloc(AlignUp(numBytes, alignment), alignment);
+}
+
+/// -----------------------------------------------------------------------------
+/// CtmSmallObjAllocator::Deallocate (aligned)
+/// -----------------------------------------------------------------------------
+
+void soa::CtmSmallObjAllocator::Deallocate(void* p, std::size_t numBytes, std::size_t alignment)
+{
+	assert(IsPowerOfTwo(alignment));
+
+	if (IsDefaultAligned(numBytes, alignment, m_maxObjSize))
+		return Deallocate(p, AlignUp(numBytes, alignment));
+
+	SOA_LOG("AlignedFree called");
+	AlignedFree(p);
+}
+
+/// -----------------------------------------------------------------------------
+/// CtmSmallObjAllocator::Snapshot
+/// -----------------------------------------------------------------------------
+/// Walks the table rather than the pool: entries are published with release
+/// semantics, a size class created concurrently is either seen whole or not.
+
+soa::AllocatorSnapshot soa::CtmSmallObjAllocator::Snapshot() const
+{
+	AllocatorSnapshot snapshot;
+
+	for (std::size_t index = 1; index < m_table.size(); ++index)
+	{
+		if (const CtmFixedAllocator* fixed = m_table[index].load(std::memory_order_acquire))
+			AddSizeClass(snapshot, fixed->GetStats());
+	}
+
+	return snapshot;
+}
+
+/// -----------------------------------------------------------------------------
+/// CtmSmallObjAllocator::Trim
+/// -----------------------------------------------------------------------------
+/// Returns to the provider the storage of the empty chunks, and asks it to
+/// give the physical pages back to the OS: after a spike this is what brings
+/// the footprint down (with VirtualPageProvider, malloc may keep it).
+/// Walks the table as Snapshot does: with the thread caches, workers create
+/// size classes under ThreadCache::SerializedLock, and the pool is never
+/// iterated while it may grow. The fixed allocators are trimmed on their
+/// owner side only: size classes created by workers need the lock.
+
+std::size_t soa::CtmSmallObjAllocator::Trim()
+{
+	std::size_t released = 0;
+
+	for (std::size_t index = 1; index < m_table.size(); ++index)
+	{
+		if (CtmFixedAllocator* fixed = m_table[index].load(std::memory_order_acquire))
+			released += fixed->Trim();
+	}
+
+	PageProvider& provider = m_provider ? *m_provider : DefaultPageProvider();
+	provider.Decommit();
+
+	SOA_LOG_OSS("CtmSmallObjAllocator::Trim: released " << released << " chunks");
+
+	return released;
+}
+
+/// -----------------------------------------------------------------------------
+/// CtmSmallObjAllocator::Reset
+/// -----------------------------------------------------------------------------
+/// One pass over the chunks of every size class: a request-scoped arena
+/// drops everything it allocated without walking its objects.
+/// Owner thread of every size class only, see CtmFixedAllocator::Reset.
+
+void soa::CtmSmallObjAllocator::Reset()
+{
+	HeapProfiler::Instance().DropOwner(this);
+
+	for (CtmFixedAllocator& fixed : m_Pool)
+	{
+		fixed.Reset();
+	}
+}
+
+/// -----------------------------------------------------------------------------
+/// CtmSmallObjAllocator::Release
+/// -----------------------------------------------------------------------------
+/// The size classes stay, their chunks are allocated again on demand
+
+std::size_t soa::CtmSmallObjAllocator::Release()
+{
+	HeapProfiler::Instance().DropOwner(this);
+
+	std::size_t released = 0;
+
+	for (CtmFixedAllocator& fixed : m_Pool)
+	{
+		released += fixed.Release();
+	}
+
+	SOA_LOG_OSS("CtmSmallObjAllocator::Release: released " << released << " chunks");
+
+	return released;
+}
+
+/// -----------------------------------------------------------------------------
+/// CtmSmallObjAllocator::SetRetentionPolicy
+/// -----------------------------------------------------------------------------
+/// Same rule of Trim. m_retention is read by CreateFixedAllocator: under the
+/// lock, no worker can create a size class while it changes.
+
+void soa::CtmSmallObjAllocator::SetRetentionPolicy(const RetentionPolicy& retention)
+{
+	m_retention = retention;
+
+	for (std::size_t index = 1; index < m_table.size(); ++index)
+	{
+		if (CtmFixedAllocator* fixed = m_table[index].load(std::memory_order_acquire))
+			fixed->SetRetentionPolicy(retention);
+	}
+}
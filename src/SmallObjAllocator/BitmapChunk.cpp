@@ -0,0 +1,288 @@
+#include <bit>
+#include <cassert>
+#include <cstring>
+#include "SmallObjAllocator\BitmapChunk.h"
+#include "SmallObjAllocator\SOA_memory.h"
+#include "SmallObjAllocator\Hardened.h"
+#include "SmallObjAllocator\SOA_debug.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+/// -----------------------------------------------------------------------------
+/// BitmapChunk::Init
+/// -----------------------------------------------------------------------------
+/// Same storage of Chunk::Init, DEFAULT_CHUNK_ALIGNMENT aligned
+
+template<std::size_t Words>
+void soa::BasicBitmapChunk<Words>::Init(std::size_t blockSize, index_type blocks)
+{
+	assert(blockSize > 0);
+	assert(blocks > 0);
+
+	SOA_LOG_OSS("BitmapChunk (" << blockSize << " (blockSize), " << blocks << " (blocks)) - Init");
+
+	m_pData = static_cast<unsigned char*>(AlignedMalloc(
+		AlignUp(blockSize * blocks, DEFAULT_CHUNK_ALIGNMENT), DEFAULT_CHUNK_ALIGNMENT));
+
+	Reset(blockSize, blocks);
+}
+
+/// -----------------------------------------------------------------------------
+/// BitmapChunk::Init (external storage)
+/// -----------------------------------------------------------------------------
+
+template<std::size_t Words>
+void soa::BasicBitmapChunk<Words>::Init(void* pData, std::size_t blockSize, index_type blocks)
+{
+	assert(pData);
+	assert(blockSize > 0);
+	assert(blocks > 0);
+
+	m_pData = static_cast<unsigned char*>(pData);
+
+	Reset(blockSize, blocks);
+}
+
+/// -----------------------------------------------------------------------------
+/// BitmapChunk::Reset
+/// -----------------------------------------------------------------------------
+/// Marks the first blocks bits as free, the bits past the last block stay 0
+/// so they are never found by the scan
+
+template<std::size_t Words>
+void soa::BasicBitmapChunk<Words>::Reset([[maybe_unused]] std::size_t blockSize, index_type blocks)
+{
+	assert(blocks <= MAX_BLOCKS);
+
+	const std::size_t fullWords = blocks / 64;
+	const std::size_t tailBits = blocks % 64;
+
+	for (std::size_t w = 0; w < Words; ++w)
+	{
+		if (w < fullWords)
+			m_freeMask[w] = ~std::uint64_t(0);
+		else if (w == fullWords && tailBits)
+			m_freeMask[w] = (std::uint64_t(1) << tailBits) - 1;
+		else
+			m_freeMask[w] = 0;
+	}
+
+	m_blocksAvailable = blocks;
+	m_searchWord = 0;
+
+#ifdef SOA_HARDENED
+	m_numBlocks = blocks;
+	std::memset(m_pData, hardened::FREE_POISON, blockSize * blocks);
+#endif
+}
+
+/// -----------------------------------------------------------------------------
+/// BitmapChunk::FindFreeWord
+/// -----------------------------------------------------------------------------
+/// Index of the first word with a free bit, Words if none.
+/// Words below m_searchWord are full, so the AVX2 path can start from the
+/// group holding it without masking the lanes before it.
+
+template<std::size_t Words>
+std::size_t soa::BasicBitmapChunk<Words>::FindFreeWord() const
+{
+#if defined(__AVX2__)
+	if constexpr (Words % 4 == 0)
+	{
+		const __m256i zero = _mm256_setzero_si256();
+		for (std::size_t w = m_searchWord & ~std::size_t(3); w < Words; w += 4)
+		{
+			const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(m_freeMask + w));
+			if (_mm256_testz_si256(v, v)) continue;
+
+			const int fullLanes = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(v, zero)));
+			return w + std::countr_zero(static_cast<unsigned>(~fullLanes & 0xF));
+		}
+		return Words;
+	}
+#endif
+	std::size_t w = m_searchWord;
+	while (w < Words && !m_freeMask[w]) ++w;
+	return w;
+}
+
+/// -----------------------------------------------------------------------------
+/// BitmapChunk::Allocate
+/// -----------------------------------------------------------------------------
+/// Takes the lowest free block: x & (x - 1) clears the bit (blsr).
+/// Hardened: the whole block must still be poisoned.
+
+template<std::size_t Words>
+void* soa::BasicBitmapChunk<Words>::Allocate(std::size_t blockSize)
+{
+	if (!m_blocksAvailable)
+		return nullptr;
+
+	const std::size_t w = FindFreeWord();
+	assert(w < Words);
+
+	std::uint64_t& word = m_freeMask[w];
+	const std::size_t index = w * 64 + std::countr_zero(word);
+	word &= word - 1;
+
+	m_searchWord = static_cast<index_type>(w);
+	--m_blocksAvailable;
+
+	unsigned char* pResult = m_pData + index * blockSize;
+
+#ifdef SOA_HARDENED
+	if (!hardened::IsPoisoned(pResult, 0, blockSize))
+		ReportHardened(HardenedError::WriteAfterFree, pResult, blockSize - DEFAULT_REDZONE_SIZE);
+
+	hardened::WriteCanary(pResult, blockSize);
+#endif
+
+	return pResult;
+}
+
+/// -----------------------------------------------------------------------------
+/// BitmapChunk::Deallocate
+/// -----------------------------------------------------------------------------
+/// Hardened: bad frees are reported and skipped, the block is poisoned
+
+template<std::size_t Words>
+void soa::BasicBitmapChunk<Words>::Deallocate(void* p, std::size_t blockSize)
+{
+	const std::size_t offset = static_cast<std::size_t>(static_cast<unsigned char*>(p) - m_pData);
+	const std::size_t index = offset / blockSize;
+	const std::size_t w = index / 64;
+	const std::uint64_t bit = std::uint64_t(1) << (index % 64);
+
+#ifdef SOA_HARDENED
+	if (p < m_pData || offset % blockSize || index >= m_numBlocks)
+		return ReportHardened(HardenedError::ForeignPointer, p, blockSize - DEFAULT_REDZONE_SIZE);
+
+	if (m_freeMask[w] & bit)
+		return ReportHardened(HardenedError::DoubleFree, p, blockSize - DEFAULT_REDZONE_SIZE);
+
+	if (!hardened::CheckCanary(static_cast<unsigned char*>(p), blockSize))
+		ReportHardened(HardenedError::Overflow, p, blockSize - DEFAULT_REDZONE_SIZE);
+
+	hardened::Poison(static_cast<unsigned char*>(p), 0, blockSize);
+#endif
+
+	assert(p >= m_pData);
+	assert(offset % blockSize == 0);
+	assert(w < Words);
+	assert(!(m_freeMask[w] & bit)); // double free
+
+	m_freeMask[w] |= bit;
+
+	if (w < m_searchWord) m_searchWord = static_cast<index_type>(w);
+	++m_blocksAvailable;
+}
+
+/// -----------------------------------------------------------------------------
+/// BitmapChunk::AllocateBatch
+/// -----------------------------------------------------------------------------
+/// Walks the set bits of a word in a register and writes the word back once.
+/// Hardened: one block at a time, every one is checked.
+
+template<std::size_t Words>
+std::size_t soa::BasicBitmapChunk<Words>::AllocateBatch(std::size_t blockSize, std::size_t n, void** out)
+{
+#ifdef SOA_HARDENED
+	std::size_t taken = 0;
+	while (taken < n && (out[taken] = Allocate(blockSize)) != nullptr) ++taken;
+	return taken;
+#else
+	std::size_t taken = 0;
+
+	while (taken < n && m_blocksAvailable)
+	{
+		const std::size_t w = FindFreeWord();
+		assert(w < Words);
+
+		const std::uint64_t before = m_freeMask[w];
+		std::uint64_t bits = before;
+
+		for (; bits && taken < n; bits &= bits - 1)
+			out[taken++] = m_pData + (w * 64 + std::countr_zero(bits)) * blockSize;
+
+		m_freeMask[w] = bits;
+		m_searchWord = static_cast<index_type>(w);
+		m_blocksAvailable = static_cast<index_type>(m_blocksAvailable - std::popcount(before ^ bits));
+	}
+
+	return taken;
+#endif
+}
+
+/// -----------------------------------------------------------------------------
+/// BitmapChunk::DeallocateBatch
+/// -----------------------------------------------------------------------------
+/// Collects the freed bits per word, then one OR per touched word.
+/// Hardened: one block at a time, every one is checked.
+
+template<std::size_t Words>
+void soa::BasicBitmapChunk<Words>::DeallocateBatch(std::size_t blockSize, std::size_t n, void** in)
+{
+#ifdef SOA_HARDENED
+	for (std::size_t i = 0; i < n; ++i) Deallocate(in[i], blockSize);
+#else
+	std::uint64_t freed[Words]{};
+
+	for (std::size_t i = 0; i < n; ++i)
+	{
+		assert(in[i] >= m_pData);
+
+		const std::size_t index =
+			static_cast<std::size_t>(static_cast<unsigned char*>(in[i]) - m_pData) / blockSize;
+
+		assert(index < MAX_BLOCKS);
+		freed[index / 64] |= std::uint64_t(1) << (index % 64);
+	}
+
+	for (std::size_t w = 0; w < Words; ++w)
+	{
+		if (!freed[w]) continue;
+
+		assert(!(m_freeMask[w] & freed[w])); // double free
+
+		m_freeMask[w] |= freed[w];
+		if (w < m_searchWord) m_searchWord = static_cast<index_type>(w);
+	}
+
+	m_blocksAvailable = static_cast<index_type>(m_blocksAvailable + n);
+#endif
+}
+
+/// -----------------------------------------------------------------------------
+/// BitmapChunk::CountAvailable
+/// -----------------------------------------------------------------------------
+
+template<std::size_t Words>
+std::size_t soa::BasicBitmapChunk<Words>::CountAvailable() const
+{
+	std::size_t available = 0;
+	for (std::size_t w = 0; w < Words; ++w)
+		available += std::popcount(m_freeMask[w]);
+	return available;
+}
+
+/// -----------------------------------------------------------------------------
+/// BitmapChunk::Release
+/// -----------------------------------------------------------------------------
+
+template<std::size_t Words>
+void soa::BasicBitmapChunk<Words>::Release()
+{
+	SOA_LOG_OSS("BitmapChunk - Release");
+
+	AlignedFree(m_pData);
+}
+
+/// -----------------------------------------------------------------------------
+/// Explicit instantiations
+/// -----------------------------------------------------------------------------
+
+template struct soa::BasicBitmapChunk<4>;
+template struct soa::BasicBitmapChunk<8>;
+template struct soa::BasicBitmapChunk<16>;
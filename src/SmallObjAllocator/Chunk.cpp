@@ -1,14 +1,19 @@
 #include <cassert>
 #include <cstdlib>
+#include <cstring>
 #include "SmallObjAllocator\Chunk.h"
+#include "SmallObjAllocator\SOA_memory.h"
+#include "SmallObjAllocator\Hardened.h"
 #include "SmallObjAllocator\SOA_debug.h"
 
 /// -----------------------------------------------------------------------------
 /// FixedAllocator::Chunk::Init
 /// -----------------------------------------------------------------------------
-/// Initializes a chunk object
+/// Initializes a chunk object.
+/// Storage is DEFAULT_CHUNK_ALIGNMENT aligned, see IsDefaultAligned.
 
-void soa::Chunk::Init(std::size_t blockSize, unsigned char blocks)
+template<typename IndexT>
+void soa::BasicChunk<IndexT>::Init(std::size_t blockSize, IndexT blocks)
 {
 	assert(blockSize > 0);
 	assert(blocks > 0);
@@ -17,7 +22,25 @@ void soa::Chunk::Init(std::size_t blockSize, unsigned char blocks)
 	SOA_LOG_OSS("Chunk (" << blockSize << " (blockSize), " << static_cast<int>(blocks) << " (blocks)) - Init");
 	SOA_LOG_OSS("Chunk total Size: " << blockSize * blocks);
 
-	m_pData = static_cast<unsigned char*>(std::malloc(blockSize * blocks)); // m_pData = new unsigned char[blockSize * blocks];
+	m_pData = static_cast<unsigned char*>(AlignedMalloc(
+		AlignUp(StorageBytes(blockSize, blocks), DEFAULT_CHUNK_ALIGNMENT), DEFAULT_CHUNK_ALIGNMENT)); // m_pData = new unsigned char[blockSize * blocks];
+
+	Reset(blockSize, blocks);
+}
+
+/// -----------------------------------------------------------------------------
+/// FixedAllocator::Chunk::Init (external storage)
+/// -----------------------------------------------------------------------------
+/// Initializes a chunk object over pData, that must hold StorageBytes(blockSize, blocks)
+
+template<typename IndexT>
+void soa::BasicChunk<IndexT>::Init(void* pData, std::size_t blockSize, IndexT blocks)
+{
+	assert(pData);
+	assert(blockSize > 0);
+	assert(blocks > 0);
+
+	m_pData = static_cast<unsigned char*>(pData);
 
 	Reset(blockSize, blocks);
 }
@@ -29,8 +52,13 @@ void soa::Chunk::Init(std::size_t blockSize, unsigned char blocks)
 /// Since in m_firstAvailableBlock is stored the index of the next available
 /// block, when you allocate a new one, you can update the next available
 /// using the index stored in the previous available (the current).
+/// memcpy: blocks are not guaranteed to be aligned for IndexT.
+/// 
+/// Hardened: a head used or out of the chunk means a free block link was
+/// overwritten, the chunk gives no more blocks (nullptr, m_blocksAvailable 0).
 
-void* soa::Chunk::Allocate(std::size_t blockSize)
+template<typename IndexT>
+void* soa::BasicChunk<IndexT>::Allocate(std::size_t blockSize)
 {
 	if (!m_blocksAvailable)
 		return nullptr;
@@ -40,9 +68,27 @@ void* soa::Chunk::Allocate(std::size_t blockSize)
 
 	unsigned char* pResult = m_pData + m_firstAvailableBlock * blockSize;
 
-	m_firstAvailableBlock = *pResult;
+#ifdef SOA_HARDENED
+	if (m_firstAvailableBlock >= m_numBlocks || IsUsed(m_firstAvailableBlock))
+	{
+		ReportHardened(HardenedError::CorruptFreeList, pResult, blockSize - DEFAULT_REDZONE_SIZE);
+		m_blocksAvailable = 0;
+		return nullptr;
+	}
+
+	SetUsed(m_firstAvailableBlock);
+#endif
+
+	std::memcpy(&m_firstAvailableBlock, pResult, sizeof(IndexT));
 	--m_blocksAvailable;
 
+#ifdef SOA_HARDENED
+	if (!hardened::IsPoisoned(pResult, sizeof(IndexT), blockSize))
+		ReportHardened(HardenedError::WriteAfterFree, pResult, blockSize - DEFAULT_REDZONE_SIZE);
+
+	hardened::WriteCanary(pResult, blockSize);
+#endif
+
 	return pResult;
 }
 
@@ -50,39 +96,129 @@ void* soa::Chunk::Allocate(std::size_t blockSize)
 /// FixedAllocator::Chunk::Deallocate
 /// -----------------------------------------------------------------------------
 /// Deallocates a block from a chunk
+/// 
+/// Hardened: bad frees are reported and skipped, the block is poisoned
+/// after its index.
 
-void soa::Chunk::Deallocate(void* p, std::size_t blockSize)
+template<typename IndexT>
+void soa::BasicChunk<IndexT>::Deallocate(void* p, std::size_t blockSize)
 {
-	assert(p >= m_pData);
-
 	unsigned char* pToRelease = static_cast<unsigned char*>(p);
 
+#ifdef SOA_HARDENED
+	const std::size_t offset = static_cast<std::size_t>(pToRelease - m_pData);
+	const std::size_t index = offset / blockSize;
+
+	if (pToRelease < m_pData || offset % blockSize || index >= m_numBlocks)
+		return ReportHardened(HardenedError::ForeignPointer, p, blockSize - DEFAULT_REDZONE_SIZE);
+
+	if (!IsUsed(index))
+		return ReportHardened(HardenedError::DoubleFree, p, blockSize - DEFAULT_REDZONE_SIZE);
+
+	if (!hardened::CheckCanary(pToRelease, blockSize))
+		ReportHardened(HardenedError::Overflow, p, blockSize - DEFAULT_REDZONE_SIZE);
+
+	ClearUsed(index);
+	hardened::Poison(pToRelease, sizeof(IndexT), blockSize);
+#endif
+
+	assert(p >= m_pData);
 	assert((pToRelease - m_pData) % blockSize == 0);
 
-	*pToRelease = m_firstAvailableBlock;
-	m_firstAvailableBlock = static_cast<unsigned char>(
+	std::memcpy(pToRelease, &m_firstAvailableBlock, sizeof(IndexT));
+	m_firstAvailableBlock = static_cast<IndexT>(
 		(pToRelease - m_pData) / blockSize);
 
-	assert(m_firstAvailableBlock == (pToRelease - m_pData) / blockSize);
+	assert(m_firstAvailableBlock == static_cast<std::size_t>(pToRelease - m_pData) / blockSize);
 
 	++m_blocksAvailable;
 }
 
+/// -----------------------------------------------------------------------------
+/// FixedAllocator::Chunk::AllocateBatch
+/// -----------------------------------------------------------------------------
+/// Pops up to n blocks from the free list in one tight loop, the counter
+/// and the head are written back once.
+/// Hardened: one block at a time, every one is checked.
+
+template<typename IndexT>
+std::size_t soa::BasicChunk<IndexT>::AllocateBatch(std::size_t blockSize, std::size_t n, void** out)
+{
+#ifdef SOA_HARDENED
+	std::size_t taken = 0;
+	while (taken < n && (out[taken] = Allocate(blockSize)) != nullptr) ++taken;
+	return taken;
+#else
+	const std::size_t count = n < m_blocksAvailable ? n : m_blocksAvailable;
+
+	IndexT next = m_firstAvailableBlock;
+	for (std::size_t i = 0; i < count; ++i)
+	{
+		unsigned char* pResult = m_pData + next * blockSize;
+		std::memcpy(&next, pResult, sizeof(IndexT));
+		out[i] = pResult;
+	}
+
+	m_firstAvailableBlock = next;
+	m_blocksAvailable = static_cast<IndexT>(m_blocksAvailable - count);
+
+	return count;
+#endif
+}
+
+/// -----------------------------------------------------------------------------
+/// FixedAllocator::Chunk::DeallocateBatch
+/// -----------------------------------------------------------------------------
+
+template<typename IndexT>
+void soa::BasicChunk<IndexT>::DeallocateBatch(std::size_t blockSize, std::size_t n, void** in)
+{
+#ifdef SOA_HARDENED
+	for (std::size_t i = 0; i < n; ++i) Deallocate(in[i], blockSize);
+#else
+	IndexT head = m_firstAvailableBlock;
+	for (std::size_t i = 0; i < n; ++i)
+	{
+		unsigned char* pToRelease = static_cast<unsigned char*>(in[i]);
+
+		assert(pToRelease >= m_pData);
+		assert((pToRelease - m_pData) % blockSize == 0);
+
+		std::memcpy(pToRelease, &head, sizeof(IndexT));
+		head = static_cast<IndexT>((pToRelease - m_pData) / blockSize);
+	}
+
+	m_firstAvailableBlock = head;
+	m_blocksAvailable = static_cast<IndexT>(m_blocksAvailable + n);
+#endif
+}
+
 /// -----------------------------------------------------------------------------
 /// FixedAllocator::Chunk::Reset
 /// -----------------------------------------------------------------------------
 /// Clears an already allocated chunk and init the free list
 
-void soa::Chunk::Reset(std::size_t blockSize, unsigned char blocks)
+template<typename IndexT>
+void soa::BasicChunk<IndexT>::Reset(std::size_t blockSize, IndexT blocks)
 {
+	assert(blockSize >= sizeof(IndexT));
+
 	m_firstAvailableBlock = 0;
 	m_blocksAvailable = blocks;
 
-	unsigned char i = 0;
+#ifdef SOA_HARDENED
+	m_numBlocks = blocks;
+	m_shadow = reinterpret_cast<std::uint64_t*>(m_pData + AlignUp(blockSize * blocks, sizeof(std::uint64_t)));
+	std::memset(m_shadow, 0, (blocks + 63) / 64 * sizeof(std::uint64_t));
+	std::memset(m_pData, hardened::FREE_POISON, blockSize * blocks);
+#endif
+
+	IndexT i = 0;
 	unsigned char* p = m_pData;
 	for (; i != blocks; p += blockSize)
 	{
-		*p = ++i;
+		++i;
+		std::memcpy(p, &i, sizeof(IndexT));
 	}
 }
 
@@ -91,10 +227,19 @@ void soa::Chunk::Reset(std::size_t blockSize, unsigned char blocks)
 /// -----------------------------------------------------------------------------
 /// Releases the data managed by a chunk
 
-void soa::Chunk::Release()
+template<typename IndexT>
+void soa::BasicChunk<IndexT>::Release()
 {
 	SOA_LOG_OSS("Chunk - Release");
 	SOA_LOG_OSS("Chunk: blocksAvailable: " << static_cast<int>(m_blocksAvailable));
 	
-	std::free(m_pData); //delete[] m_pData;
-}
\ No newline at end of file
+	AlignedFree(m_pData); //delete[] m_pData;
+}
+
+/// -----------------------------------------------------------------------------
+/// Explicit instantiations
+/// -----------------------------------------------------------------------------
+
+template struct soa::BasicChunk<std::uint8_t>;
+template struct soa::BasicChunk<std::uint16_t>;
+template struct soa::BasicChunk<std::uint32_t>;
\ No newline at end of file
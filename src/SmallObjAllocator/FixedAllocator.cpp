@@ -1,24 +1,33 @@
 #include <cassert>
 #include "SmallObjAllocator\SOA_defaults.h"
 #include "SmallObjAllocator\FixedAllocator.h"
+#include "SmallObjAllocator\Hardened.h"
 #include "SmallObjAllocator\SOA_debug.h"
 
 /// -----------------------------------------------------------------------------
 /// FixedAllocator explicit ctor
 /// -----------------------------------------------------------------------------
 
-soa::FixedAllocator::FixedAllocator(std::size_t blockSize)
-	: m_blockSize(blockSize)
+template<typename ChunkT>
+soa::BasicFixedAllocator<ChunkT>::BasicFixedAllocator(std::size_t blockSize, std::size_t chunkSize,
+	PageProvider* provider, const RetentionPolicy& retention)
+	: m_blockSize(blockSize + DEFAULT_REDZONE_SIZE)
+	, m_provider(provider ? provider : &DefaultPageProvider())
+	, m_retention(retention)
 {
 	assert(m_blockSize > 0);
+	assert(m_retention.m_lowWatermark <= m_retention.m_highWatermark);
+	assert(m_blockSize >= sizeof(IndexT));
 
 	m_prev = m_next = this;
 
-	std::size_t numBlocks = DEFAULT_CHUNK_SIZE / blockSize;
-	if (numBlocks > UCHAR_MAX) numBlocks = UCHAR_MAX;
-	else if (numBlocks == 0) numBlocks = 8 * blockSize;
+	constexpr std::size_t maxBlocks = ChunkT::MAX_BLOCKS;
 
-	m_numBlocks = static_cast<unsigned char>(numBlocks);
+	std::size_t numBlocks = chunkSize / m_blockSize;
+	if (numBlocks == 0) numBlocks = 8 * blockSize;
+	if (numBlocks > maxBlocks) numBlocks = maxBlocks;
+
+	m_numBlocks = static_cast<IndexT>(numBlocks);
 
 	assert(m_numBlocks == numBlocks);
 }
@@ -29,10 +38,16 @@ soa::FixedAllocator::FixedAllocator(std::size_t blockSize)
 /// Uses a double linked list system to prevent releasing resources
 /// when dtor is called, if a FixedAllocator is copied
 
-soa::FixedAllocator::FixedAllocator(const FixedAllocator& i_other)
+template<typename ChunkT>
+soa::BasicFixedAllocator<ChunkT>::BasicFixedAllocator(const BasicFixedAllocator& i_other)
 	: m_blockSize(i_other.m_blockSize)
 	, m_numBlocks(i_other.m_numBlocks)
 	, m_chunks(i_other.m_chunks)
+	, m_provider(i_other.m_provider)
+	, m_retention(i_other.m_retention)
+	, m_emptyChunks(i_other.m_emptyChunks)
+	, m_emptySince(i_other.m_emptySince)
+	, m_stats(i_other.m_stats)
 {
 	m_prev = &i_other;
 	m_next = i_other.m_next;
@@ -53,9 +68,10 @@ soa::FixedAllocator::FixedAllocator(const FixedAllocator& i_other)
 /// FixedAllocator assignment operator
 /// -----------------------------------------------------------------------------
 
-soa::FixedAllocator& soa::FixedAllocator::operator=(const FixedAllocator& i_other)
+template<typename ChunkT>
+soa::BasicFixedAllocator<ChunkT>& soa::BasicFixedAllocator<ChunkT>::operator=(const BasicFixedAllocator& i_other)
 {
-	FixedAllocator copy(i_other);
+	BasicFixedAllocator copy(i_other);
 	copy.Swap(*this);
 	return *this;
 }
@@ -65,7 +81,8 @@ soa::FixedAllocator& soa::FixedAllocator::operator=(const FixedAllocator& i_othe
 /// -----------------------------------------------------------------------------
 /// It prevents memory deallocation if the FixedAllocator is copied
 
-soa::FixedAllocator::~FixedAllocator()
+template<typename ChunkT>
+soa::BasicFixedAllocator<ChunkT>::~BasicFixedAllocator()
 {
 	if (m_prev != this)
 	{
@@ -76,11 +93,11 @@ soa::FixedAllocator::~FixedAllocator()
 
 	assert(m_prev == m_next);
 
-	std::vector<Chunk>::iterator i = m_chunks.begin();
+	auto i = m_chunks.begin();
 	for (; i != m_chunks.end(); ++i)
 	{
 		assert(i->m_blocksAvailable == m_numBlocks);
-		i->Release();
+		ReleaseChunk(*i);
 	}
 }
 
@@ -88,7 +105,8 @@ soa::FixedAllocator::~FixedAllocator()
 /// FixedAllocator::Swap
 /// -----------------------------------------------------------------------------
 
-void soa::FixedAllocator::Swap(FixedAllocator& rhs)
+template<typename ChunkT>
+void soa::BasicFixedAllocator<ChunkT>::Swap(BasicFixedAllocator& rhs)
 {
 	using namespace std;
 	swap(m_blockSize, rhs.m_blockSize);
@@ -96,6 +114,11 @@ void soa::FixedAllocator::Swap(FixedAllocator& rhs)
 	m_chunks.swap(rhs.m_chunks);
 	swap(m_allocChunk, rhs.m_allocChunk);
 	swap(m_deallocChunk, rhs.m_deallocChunk);
+	swap(m_provider, rhs.m_provider);
+	swap(m_retention, rhs.m_retention);
+	swap(m_emptyChunks, rhs.m_emptyChunks);
+	swap(m_emptySince, rhs.m_emptySince);
+	m_stats.Swap(rhs.m_stats);
 }
 
 /// -----------------------------------------------------------------------------
@@ -108,24 +131,36 @@ void soa::FixedAllocator::Swap(FixedAllocator& rhs)
 /// Don't forget that every allocator has
 /// an Achilles' heel.
 
-void* soa::FixedAllocator::Allocate()
+template<typename ChunkT>
+void* soa::BasicFixedAllocator<ChunkT>::Allocate()
 {
 	if (!m_allocChunk || m_allocChunk->m_blocksAvailable == 0)
 	{
-		std::vector<Chunk>::iterator it = m_chunks.begin();
+		auto it = m_chunks.begin();
 
 		for (;; ++it)
 		{
 			// allocate new chunk
 			if (it == m_chunks.end())
 			{
+				void* storage = m_provider->AllocatePages(ChunkBytes(), DEFAULT_PAGE_MAP_PAGE);
+				if (!storage) return nullptr;
+
+				if (!PageMap::Instance().Register(storage, ChunkBytes(), GetBlockSize(), PageMap::IndexTag(m_chunks.size())))
+				{
+					m_provider->ReleasePages(storage, ChunkBytes());
+					return nullptr;
+				}
+
 				m_chunks.reserve(m_chunks.size() + 1);
-				Chunk newChunk;
-				newChunk.Init(m_blockSize, m_numBlocks);
+				ChunkT newChunk;
+				newChunk.Init(storage, m_blockSize, m_numBlocks);
 				m_chunks.push_back(newChunk); // copy
+				++m_emptyChunks;
 
 				m_allocChunk = &m_chunks.back();
 				m_deallocChunk = m_allocChunk;   // &m_chunks.front();
+				PublishChunks();
 				break;
 			}
 
@@ -141,117 +176,354 @@ void* soa::FixedAllocator::Allocate()
 	assert(m_allocChunk);
 	assert(m_allocChunk->m_blocksAvailable > 0);
 
-	return m_allocChunk->Allocate(m_blockSize);
+	// an empty chunk is going to be used
+	if (m_allocChunk->m_blocksAvailable == m_numBlocks)
+	{
+		--m_emptyChunks;
+		PublishChunks();
+	}
+
+	void* p = m_allocChunk->Allocate(m_blockSize);
+
+#ifdef SOA_HARDENED
+	// corrupt free list reported: the chunk is out of blocks, next one
+	if (!p) return Allocate();
+#endif
+
+	m_stats.OnAllocate();
+	return p;
 }
 
 /// -----------------------------------------------------------------------------
 /// FixedAllocator::Deallocate
 /// -----------------------------------------------------------------------------
 /// Deallocates a block previously allocated with Allocate
-/// (undefined behavior if called with the wrong pointer)
+/// (undefined behavior if called with the wrong pointer, reported
+/// in hardened mode)
 
-void soa::FixedAllocator::Deallocate(void* p)
+template<typename ChunkT>
+void soa::BasicFixedAllocator<ChunkT>::Deallocate(void* p)
 {
+#ifdef SOA_HARDENED
+	if (!hardened::CheckOwnership(p, GetBlockSize()))
+		return;
+
+	// nullptr: a block of another allocator of the same size class
+	ChunkT* chunk = FindChunk(p);
+	if (!chunk)
+		return ReportHardened(HardenedError::ForeignPointer, p, GetBlockSize());
+
+	m_deallocChunk = chunk;
+#else
 	assert(!m_chunks.empty());
-	assert(&m_chunks.front() <= m_deallocChunk);
-	assert(&m_chunks.back() >= m_deallocChunk);
 
-	m_deallocChunk = VicinityFind(p);
+	m_deallocChunk = FindChunk(p);
 
 	assert(m_deallocChunk);
+#endif
 
 	DoDeallocate(p);
+	m_stats.OnFree();
 }
 
 /// -----------------------------------------------------------------------------
-/// FixedAllocator::VicinityFind 
+/// FixedAllocator::AllocateBatch
 /// -----------------------------------------------------------------------------
+/// Drains the free list of allocChunk with a single Chunk::AllocateBatch,
+/// then lets the Allocate slow path find (or add) the next chunk.
+/// Returns how many blocks were written to out: less than n only if the
+/// system is out of memory.
 
-soa::Chunk* soa::FixedAllocator::VicinityFind(void* p)
+template<typename ChunkT>
+std::size_t soa::BasicFixedAllocator<ChunkT>::AllocateBatch(std::size_t n, void** out)
 {
-	assert(!m_chunks.empty());
-	assert(m_deallocChunk);
-
-	const std::size_t chunkLength = m_blockSize * m_numBlocks;
+	std::size_t taken = 0;
 
-	Chunk* low = m_deallocChunk;
-	Chunk* high = m_deallocChunk + 1;
-	Chunk* lowBound = &m_chunks.front();
-	Chunk* highBound = &m_chunks.back() + 1;
-
-	// special case, deallocChunk last in vector
-	if (high == highBound) high = nullptr;
-
-	for (;;)
+	while (taken < n)
 	{
-		if (low)
+		if (!m_allocChunk || m_allocChunk->m_blocksAvailable == 0)
 		{
-			// check if p is in the current chunk evaluated
-			if (p >= low->m_pData && p < low->m_pData + chunkLength)
-			{
-				return low;
-			}
-			if (low == lowBound) low = nullptr;
-			else --low;
+			void* p = Allocate();
+			if (!p) break;
+			out[taken++] = p;
+			continue;
 		}
 
-		if (high)
+		if (m_allocChunk->m_blocksAvailable == m_numBlocks)
 		{
-			if (p >= high->m_pData && p < high->m_pData + chunkLength)
-			{
-				return high;
-			}
-			if (++high == highBound) high = nullptr;
+			--m_emptyChunks;
+			PublishChunks();
 		}
+
+		const std::size_t count = m_allocChunk->AllocateBatch(m_blockSize, n - taken, out + taken);
+		m_stats.OnAllocate(count);
+		taken += count;
+	}
+
+	return taken;
+}
+
+/// -----------------------------------------------------------------------------
+/// FixedAllocator::DeallocateBatch
+/// -----------------------------------------------------------------------------
+/// Consecutive blocks of the same chunk (the common case for objects
+/// allocated together) are given back with a single Chunk::DeallocateBatch,
+/// the chunk is searched once per run.
+/// Hardened: one Deallocate per block, every one is checked.
+
+template<typename ChunkT>
+void soa::BasicFixedAllocator<ChunkT>::DeallocateBatch(std::size_t n, void** in)
+{
+#ifdef SOA_HARDENED
+	for (std::size_t i = 0; i < n; ++i) Deallocate(in[i]);
+#else
+	std::size_t i = 0;
+
+	while (i < n)
+	{
+		assert(!m_chunks.empty());
+
+		m_deallocChunk = FindChunk(in[i]);
+		assert(m_deallocChunk);
+
+		std::size_t run = 1;
+		while (i + run < n && ChunkContains(*m_deallocChunk, in[i + run])) ++run;
+
+		m_deallocChunk->DeallocateBatch(m_blockSize, run, in + i);
+		ReleaseEmptyChunk();
+
+		i += run;
 	}
 
-	assert(false);
-	return nullptr;
+	m_stats.OnFree(n);
+#endif
+}
+
+/// -----------------------------------------------------------------------------
+/// FixedAllocator::FindChunk
+/// -----------------------------------------------------------------------------
+/// deallocChunk first (runs of frees in the same chunk), then the chunk
+/// index in the PageMap. nullptr if p is in no chunk of this allocator:
+/// the tag of a chunk of another allocator is not an index, or indexes a
+/// chunk that doesn't hold p.
+
+template<typename ChunkT>
+ChunkT* soa::BasicFixedAllocator<ChunkT>::FindChunk(const void* p)
+{
+	if (m_deallocChunk && ChunkContains(*m_deallocChunk, p))
+		return m_deallocChunk;
+
+	const std::uintptr_t tag = PageMap::Instance().Chunk(p);
+	const std::size_t index = tag >> 1;
+
+	if (!PageMap::IsIndexTag(tag) || index >= m_chunks.size() || !ChunkContains(m_chunks[index], p))
+		return nullptr;
+
+	return &m_chunks[index];
 }
 
 /// -----------------------------------------------------------------------------
 /// FixedAllocator::DoDeallocate
 /// -----------------------------------------------------------------------------
 /// Performs deallocation. Assumes deallocChunk_ points to the correct chunk
-/// Heuristic: when we have two empty chunks, realese one
 
-void soa::FixedAllocator::DoDeallocate(void* p)
+template<typename ChunkT>
+void soa::BasicFixedAllocator<ChunkT>::DoDeallocate(void* p)
 {
 	assert(m_deallocChunk->m_pData <= p);
 	assert(m_deallocChunk->m_pData + m_numBlocks * m_blockSize > p);
 
 	m_deallocChunk->Deallocate(p, m_blockSize);
 
-	// check if we need release it
-	if (m_deallocChunk->m_blocksAvailable == m_numBlocks)
+	ReleaseEmptyChunk();
+}
+
+/// -----------------------------------------------------------------------------
+/// FixedAllocator::ReleaseEmptyChunk
+/// -----------------------------------------------------------------------------
+/// Called after blocks went back to deallocChunk.
+/// An empty chunk is moved to the end, so the linear search of Allocate
+/// finds the partially filled ones first, and counted for the RetentionPolicy.
+
+template<typename ChunkT>
+void soa::BasicFixedAllocator<ChunkT>::ReleaseEmptyChunk()
+{
+	if (m_deallocChunk->m_blocksAvailable != m_numBlocks)
+		return;
+
+	++m_emptyChunks;
+	PublishChunks();
+
+	ChunkT& lastChunk = m_chunks.back();
+
+	if (&lastChunk != m_deallocChunk && lastChunk.m_blocksAvailable != m_numBlocks)
 	{
-		Chunk& lastChunk = m_chunks.back();
+		// we want empties to the end
+		std::swap(*m_deallocChunk, lastChunk);
+		TagChunk(*m_deallocChunk);
+		TagChunk(lastChunk);
+		m_allocChunk = &m_chunks.back(); // empty, so ready for new allocations
+	}
 
-		if (&lastChunk == m_deallocChunk)
-		{
-			if (m_chunks.size() > 1 &&
-				m_deallocChunk[-1].m_blocksAvailable == m_numBlocks)
-			{
-				// two chunks empty
-				lastChunk.Release();
-				m_chunks.pop_back();
-				m_allocChunk = m_deallocChunk = &m_chunks.front();
-			}
-			return;
-		}
+	if (MustRelease())
+		ReleaseEmptyChunks(m_retention.m_lowWatermark);
+}
 
-		if (lastChunk.m_blocksAvailable == m_numBlocks)
-		{
-			// two empty
-			lastChunk.Release();
-			m_chunks.pop_back();
-			m_allocChunk = m_deallocChunk;
-		}
-		else
-		{
-			// we want empties to the end
-			std::swap(*m_deallocChunk, lastChunk);
-			m_allocChunk = &m_chunks.back(); // empty, so ready for new allocations
-		}
+/// -----------------------------------------------------------------------------
+/// FixedAllocator::MustRelease
+/// -----------------------------------------------------------------------------
+/// Over the high watermark, or over the low one for longer than the decay
+/// (since m_emptySince, see StampEmptySince).
+/// The clock is read only with a decay and more than low empty chunks.
+
+template<typename ChunkT>
+bool soa::BasicFixedAllocator<ChunkT>::MustRelease()
+{
+	if (m_emptyChunks > m_retention.m_highWatermark)
+		return true;
+
+	if (m_retention.m_decay.count() == 0 || m_emptyChunks <= m_retention.m_lowWatermark)
+		return false;
+
+	return std::chrono::steady_clock::now() - m_emptySince >= m_retention.m_decay;
+}
+
+/// -----------------------------------------------------------------------------
+/// FixedAllocator::ReleaseEmptyChunks
+/// -----------------------------------------------------------------------------
+/// Frees empty chunks until keep are left, from the end where they gather.
+/// A freed chunk is replaced by the last one, already visited and in use
+/// (and tagged with its new index).
+/// Chunks are moved around: allocChunk and deallocChunk are reset.
+
+template<typename ChunkT>
+std::size_t soa::BasicFixedAllocator<ChunkT>::ReleaseEmptyChunks(std::size_t keep)
+{
+	std::size_t released = 0;
+
+	for (std::size_t i = m_chunks.size(); i > 0 && m_emptyChunks > keep; --i)
+	{
+		ChunkT& chunk = m_chunks[i - 1];
+		if (chunk.m_blocksAvailable != m_numBlocks) continue;
+
+		ReleaseChunk(chunk);
+		chunk = m_chunks.back();
+		m_chunks.pop_back();
+
+		if (i - 1 < m_chunks.size()) TagChunk(chunk);
+
+		--m_emptyChunks;
+		++released;
+	}
+
+	if (released)
+	{
+		SOA_LOG_OSS("FixedAllocator (" << m_blockSize << "): released " << released << " chunks");
+
+		m_allocChunk = m_deallocChunk = m_chunks.empty() ? nullptr : &m_chunks.front();
+		PublishChunks();
+	}
+
+	return released;
+}
+
+/// -----------------------------------------------------------------------------
+/// FixedAllocator::Trim
+/// -----------------------------------------------------------------------------
+
+template<typename ChunkT>
+std::size_t soa::BasicFixedAllocator<ChunkT>::Trim(std::size_t keep)
+{
+	return ReleaseEmptyChunks(keep);
+}
+
+/// -----------------------------------------------------------------------------
+/// FixedAllocator::Reset
+/// -----------------------------------------------------------------------------
+/// Chunk::Reset rebuilds the free list of each chunk. The chunks must not
+/// be shared with copies.
+
+template<typename ChunkT>
+void soa::BasicFixedAllocator<ChunkT>::Reset()
+{
+	assert(m_prev == this);
+
+	for (ChunkT& chunk : m_chunks)
+	{
+		chunk.Reset(m_blockSize, m_numBlocks);
+	}
+
+	m_emptyChunks = m_chunks.size();
+	m_allocChunk = m_deallocChunk = m_chunks.empty() ? nullptr : &m_chunks.front();
+
+	m_stats.OnFreeAll();
+	PublishChunks();
+
+	ReleaseEmptyChunks(m_retention.m_highWatermark);
+}
+
+/// -----------------------------------------------------------------------------
+/// FixedAllocator::Release
+/// -----------------------------------------------------------------------------
+
+template<typename ChunkT>
+std::size_t soa::BasicFixedAllocator<ChunkT>::Release()
+{
+	assert(m_prev == this);
+
+	const std::size_t released = m_chunks.size();
+
+	for (ChunkT& chunk : m_chunks)
+	{
+		ReleaseChunk(chunk);
 	}
-}
\ No newline at end of file
+
+	m_chunks.clear();
+	m_emptyChunks = 0;
+	m_allocChunk = m_deallocChunk = nullptr;
+
+	m_stats.OnFreeAll();
+	PublishChunks();
+
+	SOA_LOG_OSS("FixedAllocator (" << m_blockSize << "): released " << released << " chunks");
+
+	return released;
+}
+
+/// -----------------------------------------------------------------------------
+/// FixedAllocator::SetRetentionPolicy
+/// -----------------------------------------------------------------------------
+/// Applies the new high watermark right away
+
+template<typename ChunkT>
+void soa::BasicFixedAllocator<ChunkT>::SetRetentionPolicy(const RetentionPolicy& retention)
+{
+	assert(retention.m_lowWatermark <= retention.m_highWatermark);
+
+	m_retention = retention;
+	StampEmptySince(m_emptyChunks); // the low watermark may have moved
+
+	if (m_emptyChunks > m_retention.m_highWatermark)
+		ReleaseEmptyChunks(m_retention.m_lowWatermark);
+}
+
+/// -----------------------------------------------------------------------------
+/// FixedAllocator::ReleaseChunk
+/// -----------------------------------------------------------------------------
+/// Gives the chunk storage back to its provider
+
+template<typename ChunkT>
+void soa::BasicFixedAllocator<ChunkT>::ReleaseChunk(ChunkT& chunk)
+{
+	PageMap::Instance().Unregister(chunk.m_pData, ChunkBytes());
+	m_provider->ReleasePages(chunk.m_pData, ChunkBytes());
+}
+
+/// -----------------------------------------------------------------------------
+/// Explicit instantiations
+/// -----------------------------------------------------------------------------
+
+template class soa::BasicFixedAllocator<soa::Chunk8>;
+template class soa::BasicFixedAllocator<soa::Chunk16>;
+template class soa::BasicFixedAllocator<soa::Chunk32>;
+template class soa::BasicFixedAllocator<soa::BitmapChunk>;
\ No newline at end of file
@@ -0,0 +1,62 @@
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include "SmallObjAllocator\Hardened.h"
+
+namespace {
+
+	std::atomic<soa::HardenedHandler> s_handler{ &soa::DefaultHardenedHandler };
+}
+
+/// -----------------------------------------------------------------------------
+/// SetHardenedHandler
+/// -----------------------------------------------------------------------------
+
+soa::HardenedHandler soa::SetHardenedHandler(HardenedHandler handler) noexcept
+{
+	return s_handler.exchange(handler ? handler : &DefaultHardenedHandler);
+}
+
+/// -----------------------------------------------------------------------------
+/// DefaultHardenedHandler
+/// -----------------------------------------------------------------------------
+/// stderr is unbuffered: fprintf doesn't allocate, the heap may be corrupt
+
+void soa::DefaultHardenedHandler(const HardenedReport& report) noexcept
+{
+	std::fprintf(stderr, "soa hardened: %s, block %p, size class %zu\n",
+		ToString(report.m_error), report.m_pointer, report.m_blockSize);
+	std::abort();
+}
+
+/// -----------------------------------------------------------------------------
+/// ReportHardened
+/// -----------------------------------------------------------------------------
+
+void soa::ReportHardened(HardenedError error, const void* p, std::size_t blockSize) noexcept
+{
+	HardenedReport report;
+	report.m_error = error;
+	report.m_pointer = p;
+	report.m_blockSize = blockSize;
+
+	s_handler.load()(report);
+}
+
+/// -----------------------------------------------------------------------------
+/// ToString
+/// -----------------------------------------------------------------------------
+
+const char* soa::ToString(HardenedError error) noexcept
+{
+	switch (error)
+	{
+	case HardenedError::DoubleFree:      return "double free";
+	case HardenedError::ForeignPointer:  return "free of a pointer not allocated here";
+	case HardenedError::WrongSizeClass:  return "free into the wrong size class";
+	case HardenedError::Overflow:        return "write past the end of the block";
+	case HardenedError::WriteAfterFree:  return "write after free";
+	case HardenedError::CorruptFreeList: return "corrupt free list";
+	}
+	return "unknown error";
+}
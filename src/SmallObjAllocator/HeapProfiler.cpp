@@ -0,0 +1,450 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <new>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "SmallObjAllocator\HeapProfiler.h"
+#include "SmallObjAllocator\SOA_memory.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#if __has_include(<execinfo.h>)
+#include <execinfo.h>
+#define SOA_PROFILER_BACKTRACE
+#endif
+#if __has_include(<dlfcn.h>)
+#include <dlfcn.h>
+#define SOA_PROFILER_DLADDR
+#endif
+#if __has_include(<cxxabi.h>)
+#include <cxxabi.h>
+#define SOA_PROFILER_DEMANGLE
+#endif
+#endif
+
+namespace {
+
+	/// true while the thread is inside the profiler: allocations made by
+	/// the stack unwinder or by the tables are neither sampled nor looked up
+
+	thread_local bool t_inProfiler = false;
+
+	struct ReentryGuard {
+		ReentryGuard() noexcept { t_inProfiler = true; }
+		~ReentryGuard() { t_inProfiler = false; }
+	};
+
+	/// xorshift64*, one state per thread: sampling must not synchronize
+
+	std::uint64_t NextRandom() noexcept
+	{
+		thread_local std::uint64_t state = 0;
+
+		if (state == 0)
+			state = reinterpret_cast<std::uintptr_t>(&state) * 0x9E3779B97F4A7C15ull | 1;
+
+		state ^= state >> 12;
+		state ^= state << 25;
+		state ^= state >> 27;
+		return state * 0x2545F4914F6CDD1Dull;
+	}
+
+	/// Unsampling factor of a block of size bytes: with exponential intervals
+	/// of mean rate, it is sampled with probability 1 - e^(-size/rate)
+
+	double SampleWeight(std::size_t size, std::size_t rate) noexcept
+	{
+		if (rate == 0) return 1.0;
+		return 1.0 / (1.0 - std::exp(-static_cast<double>(size) / static_cast<double>(rate)));
+	}
+
+	/// Name of a return address for the folded stacks: symbol when the
+	/// platform can resolve it, hex address otherwise
+
+	std::string FrameName(void* frame)
+	{
+#ifdef SOA_PROFILER_DLADDR
+		Dl_info info;
+		if (dladdr(frame, &info) && info.dli_sname)
+		{
+#ifdef SOA_PROFILER_DEMANGLE
+			int status = 0;
+			if (char* demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status))
+			{
+				std::string name(demangled);
+				std::free(demangled);
+				return name;
+			}
+#endif
+			return info.dli_sname;
+		}
+#endif
+		char buffer[2 + 2 * sizeof(void*) + 1];
+		std::snprintf(buffer, sizeof(buffer), "0x%llx",
+			static_cast<unsigned long long>(reinterpret_cast<std::uintptr_t>(frame)));
+		return buffer;
+	}
+}
+
+/// Call stack and size class of a group of samples
+
+struct soa::HeapProfiler::Bucket {
+	void* m_frames[DEFAULT_PROFILER_MAX_FRAMES]{}; // innermost first
+	std::size_t m_depth{};
+	std::size_t m_blockSize{};
+
+	bool operator==(const Bucket& rhs) const noexcept
+	{
+		return m_depth == rhs.m_depth && m_blockSize == rhs.m_blockSize
+			&& std::memcmp(m_frames, rhs.m_frames, m_depth * sizeof(void*)) == 0;
+	}
+};
+
+struct soa::HeapProfiler::Tables {
+
+	struct BucketHash {
+		std::size_t operator()(const Bucket& bucket) const noexcept
+		{
+			std::uint64_t h = bucket.m_blockSize;
+			for (std::size_t i = 0; i < bucket.m_depth; ++i)
+				h = (h ^ reinterpret_cast<std::uintptr_t>(bucket.m_frames[i])) * 0x100000001B3ull;
+			return static_cast<std::size_t>(h);
+		}
+	};
+
+	struct Counts {
+		std::size_t m_live{};
+		std::size_t m_total{};
+	};
+
+	struct LiveSample {
+		Counts* m_counts;
+		const void* m_owner;
+	};
+
+	template<typename K, typename V, typename H = std::hash<K>>
+	using Map = std::unordered_map<K, V, H, std::equal_to<K>, MallocAllocator<std::pair<const K, V>>>;
+
+	// copy of the buckets taken by the dumps
+	using BucketCopy = std::vector<std::pair<Bucket, Counts>, MallocAllocator<std::pair<Bucket, Counts>>>;
+
+	Map<Bucket, Counts, BucketHash> m_buckets;
+	Map<const void*, LiveSample> m_live;
+	std::size_t m_sampleBytes{}; // interval of the last sample, for the dumps
+};
+
+/// -----------------------------------------------------------------------------
+/// HeapProfiler::Instance
+/// -----------------------------------------------------------------------------
+/// Never destroyed, see PreloadAllocator
+
+soa::HeapProfiler& soa::HeapProfiler::Instance() noexcept
+{
+	alignas(HeapProfiler) static unsigned char storage[sizeof(HeapProfiler)];
+	static HeapProfiler* profiler = new(storage) HeapProfiler();
+	return *profiler;
+}
+
+/// -----------------------------------------------------------------------------
+/// HeapProfiler::Start / Stop
+/// -----------------------------------------------------------------------------
+
+void soa::HeapProfiler::Start(std::size_t sampleBytes) noexcept
+{
+	m_sampleBytes.store(sampleBytes ? sampleBytes : DEFAULT_PROFILER_SAMPLE_BYTES, std::memory_order_relaxed);
+}
+
+void soa::HeapProfiler::Stop() noexcept
+{
+	m_sampleBytes.store(0, std::memory_order_relaxed);
+}
+
+/// -----------------------------------------------------------------------------
+/// HeapProfiler::Clear
+/// -----------------------------------------------------------------------------
+
+void soa::HeapProfiler::Clear() noexcept
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (!m_tables) return;
+
+	for (const auto& live : m_tables->m_live)
+		s_filter[FilterSlot(live.first)].fetch_sub(1, std::memory_order_relaxed);
+
+	m_tables->m_live.clear();
+	m_tables->m_buckets.clear();
+	m_numLive.store(0, std::memory_order_relaxed);
+}
+
+/// -----------------------------------------------------------------------------
+/// HeapProfiler::NextInterval
+/// -----------------------------------------------------------------------------
+/// Exponential with mean the sample interval. Stopped: the default one,
+/// the countdown only brings the thread back here from time to time.
+
+std::ptrdiff_t soa::HeapProfiler::NextInterval() noexcept
+{
+	std::size_t mean = m_sampleBytes.load(std::memory_order_relaxed);
+	if (!mean) return static_cast<std::ptrdiff_t>(DEFAULT_PROFILER_SAMPLE_BYTES);
+
+	// uniform in (0, 1]
+	const double u = static_cast<double>((NextRandom() >> 11) + 1) * 0x1.0p-53;
+	const double interval = -std::log(u) * static_cast<double>(mean);
+
+	const double maxInterval = 64.0 * static_cast<double>(mean);
+	return static_cast<std::ptrdiff_t>(interval < 1.0 ? 1.0 : (interval > maxInterval ? maxInterval : interval));
+}
+
+/// -----------------------------------------------------------------------------
+/// HeapProfiler::RecordAllocation
+/// -----------------------------------------------------------------------------
+/// Slow path of Tick. The address goes in the filter before the block is
+/// returned: any thread that later frees it got it through a happens-before,
+/// so it sees the slot set.
+
+void soa::HeapProfiler::RecordAllocation(const void* owner, void* p, std::size_t blockSize) noexcept
+{
+	s_bytesUntilSample = NextInterval();
+
+	const std::size_t sampleBytes = m_sampleBytes.load(std::memory_order_relaxed);
+	if (!p || !sampleBytes || t_inProfiler)
+		return;
+
+	ReentryGuard guard;
+
+	Bucket key;
+	key.m_blockSize = blockSize;
+
+	// first frame: this function
+#if defined(_WIN32)
+	key.m_depth = CaptureStackBackTrace(1, static_cast<DWORD>(DEFAULT_PROFILER_MAX_FRAMES), key.m_frames, nullptr);
+#elif defined(SOA_PROFILER_BACKTRACE)
+	void* frames[DEFAULT_PROFILER_MAX_FRAMES + 1];
+	const int depth = backtrace(frames, static_cast<int>(DEFAULT_PROFILER_MAX_FRAMES + 1));
+	if (depth > 1)
+	{
+		key.m_depth = static_cast<std::size_t>(depth - 1);
+		std::memcpy(key.m_frames, frames + 1, key.m_depth * sizeof(void*));
+	}
+#endif
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (!m_tables)
+	{
+		void* storage = std::malloc(sizeof(Tables));
+		if (!storage) return;
+		m_tables = new(storage) Tables();
+	}
+
+	try
+	{
+		// still there: its free was not seen (made inside the profiler)
+		RemoveLocked(p);
+
+		auto bucket = m_tables->m_buckets.try_emplace(key).first;
+		m_tables->m_live.emplace(p, Tables::LiveSample{ &bucket->second, owner });
+
+		++bucket->second.m_live;
+		++bucket->second.m_total;
+	}
+	catch (const std::bad_alloc&)
+	{
+		return; // sample lost
+	}
+
+	m_tables->m_sampleBytes = sampleBytes;
+
+	s_filter[FilterSlot(p)].fetch_add(1, std::memory_order_relaxed);
+	m_numLive.fetch_add(1, std::memory_order_relaxed);
+}
+
+/// -----------------------------------------------------------------------------
+/// HeapProfiler::RecordFree
+/// -----------------------------------------------------------------------------
+/// The filter slot was set: p is sampled, or shares the slot with a sample
+
+void soa::HeapProfiler::RecordFree(const void* p) noexcept
+{
+	if (t_inProfiler) return;
+
+	ReentryGuard guard;
+	std::lock_guard<std::mutex> lock(m_mutex);
+	RemoveLocked(p);
+}
+
+/// -----------------------------------------------------------------------------
+/// HeapProfiler::RemoveLocked
+/// -----------------------------------------------------------------------------
+
+void soa::HeapProfiler::RemoveLocked(const void* p) noexcept
+{
+	if (!m_tables) return;
+
+	auto live = m_tables->m_live.find(p);
+	if (live == m_tables->m_live.end()) return;
+
+	--live->second.m_counts->m_live;
+	m_tables->m_live.erase(live);
+
+	s_filter[FilterSlot(p)].fetch_sub(1, std::memory_order_relaxed);
+	m_numLive.fetch_sub(1, std::memory_order_relaxed);
+}
+
+/// -----------------------------------------------------------------------------
+/// HeapProfiler::DropOwner
+/// -----------------------------------------------------------------------------
+
+void soa::HeapProfiler::DropOwner(const void* owner) noexcept
+{
+	if (!m_numLive.load(std::memory_order_relaxed))
+		return;
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (!m_tables) return;
+
+	for (auto live = m_tables->m_live.begin(); live != m_tables->m_live.end(); )
+	{
+		if (live->second.m_owner != owner)
+		{
+			++live;
+			continue;
+		}
+
+		--live->second.m_counts->m_live;
+		s_filter[FilterSlot(live->first)].fetch_sub(1, std::memory_order_relaxed);
+		m_numLive.fetch_sub(1, std::memory_order_relaxed);
+		live = m_tables->m_live.erase(live);
+	}
+}
+
+/// -----------------------------------------------------------------------------
+/// HeapProfiler::WritePprof
+/// -----------------------------------------------------------------------------
+/// Legacy heap profile of gperftools, read by pprof:
+///
+///     heap profile: <live>: <live bytes> [<total>: <total bytes>] @ heap_v2/<interval>
+///     <live>: <live bytes> [<total>: <total bytes>] @ 0x... 0x...
+///     ...
+///     MAPPED_LIBRARIES:
+///     <contents of /proc/self/maps>
+///
+/// Counts are the samples themselves, heap_v2 tells pprof how to scale them.
+/// The buckets are copied under the lock (malloc'ed, as the tables) and
+/// written without it: the stream can allocate through operator new.
+
+void soa::HeapProfiler::WritePprof(std::ostream& os) const
+{
+	Tables::BucketCopy buckets;
+	std::size_t sampleBytes = GetSampleInterval();
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_tables)
+		{
+			buckets.assign(m_tables->m_buckets.begin(), m_tables->m_buckets.end());
+			if (m_tables->m_sampleBytes) sampleBytes = m_tables->m_sampleBytes;
+		}
+	}
+
+	if (!sampleBytes) sampleBytes = DEFAULT_PROFILER_SAMPLE_BYTES;
+
+	Tables::Counts total{};
+	std::size_t liveBytes = 0, totalBytes = 0;
+	for (const auto& bucket : buckets)
+	{
+		total.m_live += bucket.second.m_live;
+		total.m_total += bucket.second.m_total;
+		liveBytes += bucket.second.m_live * bucket.first.m_blockSize;
+		totalBytes += bucket.second.m_total * bucket.first.m_blockSize;
+	}
+
+	os << "heap profile: " << total.m_live << ": " << liveBytes
+		<< " [" << total.m_total << ": " << totalBytes << "] @ heap_v2/" << sampleBytes << '\n';
+
+	for (const auto& bucket : buckets)
+	{
+		const std::size_t blockSize = bucket.first.m_blockSize;
+
+		os << bucket.second.m_live << ": " << bucket.second.m_live * blockSize
+			<< " [" << bucket.second.m_total << ": " << bucket.second.m_total * blockSize << "] @";
+
+		for (std::size_t i = 0; i < bucket.first.m_depth; ++i)
+			os << " 0x" << std::hex << reinterpret_cast<std::uintptr_t>(bucket.first.m_frames[i]) << std::dec;
+
+		os << '\n';
+	}
+
+#ifdef __linux__
+	std::ifstream maps("/proc/self/maps");
+	if (maps)
+		os << "\nMAPPED_LIBRARIES:\n" << maps.rdbuf();
+#endif
+}
+
+/// -----------------------------------------------------------------------------
+/// HeapProfiler::WriteFolded
+/// -----------------------------------------------------------------------------
+/// One line per bucket with live samples, outermost frame first and the size
+/// class as leaf, then the estimated live bytes:
+///
+///     main;BuildTree;Node::Node;size 32 1048576
+
+void soa::HeapProfiler::WriteFolded(std::ostream& os) const
+{
+	Tables::BucketCopy buckets;
+	std::size_t sampleBytes = GetSampleInterval();
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_tables)
+		{
+			buckets.assign(m_tables->m_buckets.begin(), m_tables->m_buckets.end());
+			if (m_tables->m_sampleBytes) sampleBytes = m_tables->m_sampleBytes;
+		}
+	}
+
+	for (const auto& bucket : buckets)
+	{
+		if (!bucket.second.m_live) continue;
+
+		for (std::size_t i = bucket.first.m_depth; i-- > 0; )
+			os << FrameName(bucket.first.m_frames[i]) << ';';
+
+		const std::size_t blockSize = bucket.first.m_blockSize;
+		const double bytes = static_cast<double>(bucket.second.m_live * blockSize) * SampleWeight(blockSize, sampleBytes);
+
+		os << "size " << blockSize << ' ' << static_cast<unsigned long long>(bytes + 0.5) << '\n';
+	}
+}
+
+/// -----------------------------------------------------------------------------
+/// HeapProfiler::DumpPprof / DumpFolded
+/// -----------------------------------------------------------------------------
+
+bool soa::HeapProfiler::DumpPprof(const char* path) const
+{
+	std::ofstream file(path);
+	if (!file) return false;
+
+	WritePprof(file);
+	return static_cast<bool>(file);
+}
+
+bool soa::HeapProfiler::DumpFolded(const char* path) const
+{
+	std::ofstream file(path);
+	if (!file) return false;
+
+	WriteFolded(file);
+	return static_cast<bool>(file);
+}
@@ -0,0 +1,203 @@
+#include <algorithm>
+#include <cassert>
+#include <cstdint> // uintptr_t
+#include <limits>
+#include <new>
+#include "SmallObjAllocator\MonotonicArena.h"
+
+/// -----------------------------------------------------------------------------
+/// MonotonicArena::MonotonicArena
+/// -----------------------------------------------------------------------------
+
+soa::MonotonicArena::MonotonicArena(std::size_t bufferSize, PageProvider* provider)
+	: MonotonicArena(nullptr, 0, bufferSize, provider)
+{
+}
+
+soa::MonotonicArena::MonotonicArena(void* initialBuffer, std::size_t initialSize,
+	std::size_t bufferSize, PageProvider* provider)
+	: m_cur(nullptr)
+	, m_end(nullptr)
+	, m_current(nullptr)
+	, m_provider(provider ? provider : &MallocPageProvider::Instance())
+	, m_head(nullptr)
+	, m_tail(nullptr)
+	, m_initialBuffer(static_cast<char*>(initialBuffer))
+	, m_initialSize(initialBuffer ? initialSize : 0)
+	, m_bufferSize((std::max)(bufferSize, 2 * HEADER_SIZE))
+	, m_nextSize(m_bufferSize)
+{
+	Reset();
+}
+
+/// -----------------------------------------------------------------------------
+/// MonotonicArena::~MonotonicArena
+/// -----------------------------------------------------------------------------
+
+soa::MonotonicArena::~MonotonicArena()
+{
+	Release();
+}
+
+/// -----------------------------------------------------------------------------
+/// MonotonicArena::Allocate
+/// -----------------------------------------------------------------------------
+
+void* soa::MonotonicArena::Allocate(std::size_t numBytes)
+{
+	return Allocate(numBytes, alignof(std::max_align_t));
+}
+
+void* soa::MonotonicArena::Allocate(std::size_t numBytes, std::size_t alignment)
+{
+	assert(IsPowerOfTwo(alignment));
+
+	if (numBytes == 0) numBytes = 1;
+
+	// fast path: m_cur == m_end == nullptr before the first buffer
+	const std::uintptr_t cur = reinterpret_cast<std::uintptr_t>(m_cur);
+	std::size_t padding = AlignUp(cur, alignment) - cur;
+
+	if (padding + numBytes > static_cast<std::size_t>(m_end - m_cur))
+	{
+		Grow(numBytes, alignment);
+		padding = AlignUp(reinterpret_cast<std::uintptr_t>(m_cur), alignment) - reinterpret_cast<std::uintptr_t>(m_cur);
+	}
+
+	char* p = m_cur + padding;
+	m_cur = p + numBytes;
+	return p;
+}
+
+/// -----------------------------------------------------------------------------
+/// MonotonicArena::AllocateBatch
+/// -----------------------------------------------------------------------------
+/// Contiguous blocks of AlignUp(numBytes, max_align_t) bytes
+
+std::size_t soa::MonotonicArena::AllocateBatch(std::size_t numBytes, std::size_t n, void** out)
+{
+	const std::size_t stride = AlignUp(numBytes ? numBytes : 1, alignof(std::max_align_t));
+
+	if (n == 0) return 0;
+	if (stride > (std::numeric_limits<std::size_t>::max)() / n) throw std::bad_alloc();
+
+	char* p = static_cast<char*>(Allocate(stride * n, alignof(std::max_align_t)));
+	for (std::size_t i = 0; i < n; ++i, p += stride)
+		out[i] = p;
+
+	return n;
+}
+
+/// -----------------------------------------------------------------------------
+/// MonotonicArena::Grow
+/// -----------------------------------------------------------------------------
+/// Buffers kept by Reset (or by a StackArena rollback) come first. Too small
+/// ones are skipped, they are used again after the next Reset.
+
+void soa::MonotonicArena::Grow(std::size_t numBytes, std::size_t alignment)
+{
+	const std::size_t alignPad = alignment > alignof(std::max_align_t) ? alignment : 0;
+	if (numBytes > (std::numeric_limits<std::size_t>::max)() - HEADER_SIZE - alignPad - DEFAULT_PAGE_MAP_PAGE)
+		throw std::bad_alloc();
+
+	const std::size_t needed = HEADER_SIZE + alignPad + numBytes;
+
+	Buffer* next = m_current ? m_current->m_next : m_head;
+	while (next && next->m_size < needed)
+		next = next->m_next;
+
+	if (!next)
+	{
+		const std::size_t size = AlignUp((std::max)(m_nextSize, needed), DEFAULT_PAGE_MAP_PAGE);
+
+		void* storage = m_provider->AllocatePages(size, DEFAULT_CHUNK_ALIGNMENT);
+		if (!storage) throw std::bad_alloc();
+
+		next = static_cast<Buffer*>(storage);
+		next->m_next = nullptr;
+		next->m_size = size;
+
+		if (m_tail) m_tail->m_next = next;
+		else m_head = next;
+		m_tail = next;
+
+		m_nextSize = (std::min)(m_nextSize * 2, (std::max)(m_bufferSize, DEFAULT_ARENA_MAX_BUFFER_SIZE));
+	}
+
+	MoveTo(next, Begin(next));
+}
+
+/// -----------------------------------------------------------------------------
+/// MonotonicArena::MoveTo
+/// -----------------------------------------------------------------------------
+
+void soa::MonotonicArena::MoveTo(Buffer* buffer, char* cur) noexcept
+{
+	m_current = buffer;
+	m_cur = cur;
+	m_end = buffer ? End(buffer) : m_initialBuffer + m_initialSize;
+
+	assert(m_cur <= m_end);
+}
+
+/// -----------------------------------------------------------------------------
+/// MonotonicArena::Reset
+/// -----------------------------------------------------------------------------
+/// Every block is gone, the buffers stay
+
+void soa::MonotonicArena::Reset() noexcept
+{
+	MoveTo(nullptr, m_initialBuffer);
+}
+
+/// -----------------------------------------------------------------------------
+/// MonotonicArena::Release
+/// -----------------------------------------------------------------------------
+/// Gives every buffer back to the provider, returns how many
+
+std::size_t soa::MonotonicArena::Release() noexcept
+{
+	std::size_t released = 0;
+
+	for (Buffer* buffer = m_head; buffer; ++released)
+	{
+		Buffer* next = buffer->m_next;
+		m_provider->ReleasePages(buffer, buffer->m_size);
+		buffer = next;
+	}
+
+	m_head = m_tail = nullptr;
+	m_nextSize = m_bufferSize;
+	Reset();
+
+	return released;
+}
+
+/// -----------------------------------------------------------------------------
+/// MonotonicArena::BytesUsed
+/// -----------------------------------------------------------------------------
+
+std::size_t soa::MonotonicArena::BytesUsed() const noexcept
+{
+	if (!m_current)
+		return static_cast<std::size_t>(m_cur - m_initialBuffer);
+
+	std::size_t used = m_initialSize;
+	for (Buffer* buffer = m_head; buffer != m_current; buffer = buffer->m_next)
+		used += buffer->m_size - HEADER_SIZE;
+
+	return used + static_cast<std::size_t>(m_cur - Begin(m_current));
+}
+
+/// -----------------------------------------------------------------------------
+/// MonotonicArena::BytesReserved
+/// -----------------------------------------------------------------------------
+
+std::size_t soa::MonotonicArena::BytesReserved() const noexcept
+{
+	std::size_t reserved = m_initialSize;
+	for (Buffer* buffer = m_head; buffer; buffer = buffer->m_next)
+		reserved += buffer->m_size;
+
+	return reserved;
+}
@@ -0,0 +1,111 @@
+#include <cassert>
+#include <cstdlib>
+#include "SmallObjAllocator\PageMap.h"
+#include "SmallObjAllocator\SOA_debug.h"
+
+/// -----------------------------------------------------------------------------
+/// PageMap::GetLeaf
+/// -----------------------------------------------------------------------------
+/// Creates the leaf on first use. Two threads creating the same leaf:
+/// the loser frees its copy and takes the published one.
+/// calloc: a leaf is 4 MB, its pages are only touched when written.
+
+soa::PageMap::Leaf* soa::PageMap::GetLeaf(std::size_t rootIndex) noexcept
+{
+	Leaf* leaf = m_root[rootIndex].load(std::memory_order_acquire);
+	if (leaf) return leaf;
+
+	Leaf* newLeaf = static_cast<Leaf*>(std::calloc(1, sizeof(Leaf)));
+	if (!newLeaf) return nullptr;
+
+	if (m_root[rootIndex].compare_exchange_strong(leaf, newLeaf,
+		std::memory_order_acq_rel, std::memory_order_acquire))
+	{
+		SOA_LOG_OSS("PageMap: new leaf " << rootIndex);
+		return newLeaf;
+	}
+
+	std::free(newLeaf);
+	return leaf;
+}
+
+/// -----------------------------------------------------------------------------
+/// PageMap::Store
+/// -----------------------------------------------------------------------------
+/// Leaves of the range must exist
+
+void soa::PageMap::Store(const void* p, std::size_t size, std::uint32_t blockSize, std::uintptr_t chunk) noexcept
+{
+	const std::uintptr_t first = reinterpret_cast<std::uintptr_t>(p) >> DEFAULT_PAGE_MAP_SHIFT;
+	const std::uintptr_t last = first + (size >> DEFAULT_PAGE_MAP_SHIFT);
+
+	for (std::uintptr_t page = first; page < last; ++page)
+	{
+		Leaf* leaf = m_root[page >> LEAF_BITS].load(std::memory_order_relaxed);
+		assert(leaf);
+		Entry& entry = leaf->m_entries[page & (LEAF_PAGES - 1)];
+		entry.m_chunk.store(chunk, std::memory_order_relaxed);
+		entry.m_blockSize.store(blockSize, std::memory_order_relaxed);
+	}
+}
+
+/// -----------------------------------------------------------------------------
+/// PageMap::Register
+/// -----------------------------------------------------------------------------
+
+bool soa::PageMap::Register(const void* p, std::size_t size, std::size_t blockSize, std::uintptr_t chunk) noexcept
+{
+	const std::uintptr_t addr = reinterpret_cast<std::uintptr_t>(p);
+
+	assert(addr % DEFAULT_PAGE_MAP_PAGE == 0);
+	assert(size > 0 && size % DEFAULT_PAGE_MAP_PAGE == 0);
+	assert(blockSize > 0 && blockSize <= UINT32_MAX);
+	assert(((addr + size - 1) >> DEFAULT_PAGE_MAP_SHIFT) >> (ROOT_BITS + LEAF_BITS) == 0);
+
+	const std::uintptr_t first = addr >> DEFAULT_PAGE_MAP_SHIFT;
+	const std::uintptr_t last = (addr + size - 1) >> DEFAULT_PAGE_MAP_SHIFT;
+
+	for (std::uintptr_t root = first >> LEAF_BITS; root <= last >> LEAF_BITS; ++root)
+	{
+		if (!GetLeaf(root)) return false;
+	}
+
+	Store(p, size, static_cast<std::uint32_t>(blockSize), chunk);
+	return true;
+}
+
+/// -----------------------------------------------------------------------------
+/// PageMap::Unregister
+/// -----------------------------------------------------------------------------
+
+void soa::PageMap::Unregister(const void* p, std::size_t size) noexcept
+{
+	if (!p) return;
+
+	assert(reinterpret_cast<std::uintptr_t>(p) % DEFAULT_PAGE_MAP_PAGE == 0);
+	assert(size % DEFAULT_PAGE_MAP_PAGE == 0);
+
+	Store(p, size, 0, 0);
+}
+
+/// -----------------------------------------------------------------------------
+/// PageMap::SetChunk
+/// -----------------------------------------------------------------------------
+/// Same range as the Register of the chunk, the block size is kept
+
+void soa::PageMap::SetChunk(const void* p, std::size_t size, std::uintptr_t chunk) noexcept
+{
+	assert(reinterpret_cast<std::uintptr_t>(p) % DEFAULT_PAGE_MAP_PAGE == 0);
+	assert(size % DEFAULT_PAGE_MAP_PAGE == 0);
+	assert(BlockSize(p) != 0);
+
+	const std::uintptr_t first = reinterpret_cast<std::uintptr_t>(p) >> DEFAULT_PAGE_MAP_SHIFT;
+	const std::uintptr_t last = first + (size >> DEFAULT_PAGE_MAP_SHIFT);
+
+	for (std::uintptr_t page = first; page < last; ++page)
+	{
+		Leaf* leaf = m_root[page >> LEAF_BITS].load(std::memory_order_relaxed);
+		assert(leaf);
+		leaf->m_entries[page & (LEAF_PAGES - 1)].m_chunk.store(chunk, std::memory_order_relaxed);
+	}
+}
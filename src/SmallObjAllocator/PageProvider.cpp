@@ -0,0 +1,357 @@
+#include <algorithm>
+#include <cassert>
+#include <cstdint> // uintptr_t
+#include <new>
+#include "SmallObjAllocator\PageProvider.h"
+#include "SmallObjAllocator\SOA_memory.h"
+#include "SmallObjAllocator\SOA_debug.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+	constexpr std::size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+	/// -----------------------------------------------------------------------------
+	/// OS layer
+	/// -----------------------------------------------------------------------------
+
+	std::size_t OsPageSize() noexcept
+	{
+#ifdef _WIN32
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		return info.dwPageSize;
+#else
+		return static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+#endif
+	}
+
+	/// Maps size bytes (page multiple) of read/write memory aligned to alignment.
+	/// nullptr on failure.
+
+	void* OsMap(std::size_t size, std::size_t alignment, soa::HugePages hugePages) noexcept
+	{
+#ifdef _WIN32
+		if (hugePages == soa::HugePages::Explicit)
+		{
+			const std::size_t largePage = GetLargePageMinimum();
+			if (largePage && alignment <= largePage)
+			{
+				void* p = VirtualAlloc(nullptr, soa::AlignUp(size, largePage),
+					MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+				if (p) return p;
+			}
+		}
+
+		// VirtualAlloc bases are aligned to the allocation granularity (64 KB),
+		// for more reserve a bigger range, give it back and map again inside it
+		for (int attempt = 0; attempt < 8; ++attempt)
+		{
+			void* p = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+			if (!p) return nullptr;
+			if (reinterpret_cast<std::uintptr_t>(p) % alignment == 0) return p;
+
+			VirtualFree(p, 0, MEM_RELEASE);
+
+			void* range = VirtualAlloc(nullptr, size + alignment, MEM_RESERVE, PAGE_NOACCESS);
+			if (!range) return nullptr;
+			VirtualFree(range, 0, MEM_RELEASE);
+
+			void* aligned = reinterpret_cast<void*>(
+				soa::AlignUp(reinterpret_cast<std::uintptr_t>(range), alignment));
+			p = VirtualAlloc(aligned, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+			if (p) return p;
+			// another thread took the range in the meantime, try again
+		}
+		return nullptr;
+#else
+#ifdef MAP_HUGETLB
+		if (hugePages == soa::HugePages::Explicit && alignment <= HUGE_PAGE_SIZE)
+		{
+			void* p = mmap(nullptr, soa::AlignUp(size, HUGE_PAGE_SIZE), PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+			if (p != MAP_FAILED) return p;
+		}
+#endif
+		// mmap is only page aligned: map more and unmap the misaligned head and tail
+		const std::size_t extra = alignment > OsPageSize() ? alignment : 0;
+
+		void* raw = mmap(nullptr, size + extra, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (raw == MAP_FAILED) return nullptr;
+
+		unsigned char* base = static_cast<unsigned char*>(raw);
+		unsigned char* aligned = reinterpret_cast<unsigned char*>(
+			soa::AlignUp(reinterpret_cast<std::uintptr_t>(base), alignment));
+
+		const std::size_t head = static_cast<std::size_t>(aligned - base);
+		if (head) munmap(base, head);
+		if (extra - head) munmap(aligned + size, extra - head);
+
+#ifdef MADV_HUGEPAGE
+		if (hugePages != soa::HugePages::None)
+			madvise(aligned, size, MADV_HUGEPAGE);
+#endif
+		return aligned;
+#endif
+	}
+
+	void OsUnmap(void* p, std::size_t size) noexcept
+	{
+#ifdef _WIN32
+		(void)size;
+		VirtualFree(p, 0, MEM_RELEASE);
+#else
+		munmap(p, size);
+#endif
+	}
+
+	/// Drops the physical pages fully inside [p, p + size), keeps the range usable
+
+	void OsDecommit(void* p, std::size_t size) noexcept
+	{
+		const std::size_t pageSize = OsPageSize();
+		const std::uintptr_t begin = soa::AlignUp(reinterpret_cast<std::uintptr_t>(p), pageSize);
+		const std::uintptr_t end = (reinterpret_cast<std::uintptr_t>(p) + size) & ~(pageSize - 1);
+
+		if (begin >= end) return;
+
+#ifdef _WIN32
+		VirtualAlloc(reinterpret_cast<void*>(begin), end - begin, MEM_RESET, PAGE_READWRITE);
+#else
+		madvise(reinterpret_cast<void*>(begin), end - begin, MADV_DONTNEED);
+#endif
+	}
+}
+
+/// -----------------------------------------------------------------------------
+/// MallocPageProvider::Instance
+/// -----------------------------------------------------------------------------
+/// Never destroyed, like VirtualPageProvider::Instance
+
+soa::MallocPageProvider& soa::MallocPageProvider::Instance() noexcept
+{
+	alignas(MallocPageProvider) static unsigned char storage[sizeof(MallocPageProvider)];
+	static MallocPageProvider* provider = new(storage) MallocPageProvider();
+	return *provider;
+}
+
+/// -----------------------------------------------------------------------------
+/// MallocPageProvider::AllocatePages
+/// -----------------------------------------------------------------------------
+
+void* soa::MallocPageProvider::AllocatePages(std::size_t size, std::size_t alignment)
+{
+	assert(IsPowerOfTwo(alignment));
+	return AlignedMalloc(AlignUp(size, alignment), alignment);
+}
+
+/// -----------------------------------------------------------------------------
+/// MallocPageProvider::ReleasePages
+/// -----------------------------------------------------------------------------
+
+void soa::MallocPageProvider::ReleasePages(void* p, std::size_t)
+{
+	AlignedFree(p);
+}
+
+/// -----------------------------------------------------------------------------
+/// VirtualPageProvider ctor
+/// -----------------------------------------------------------------------------
+/// Superblocks are mapped lazily, on the first request
+
+soa::VirtualPageProvider::VirtualPageProvider(HugePages hugePages, std::size_t superblockSize,
+	std::size_t cacheBytes)
+	: m_hugePages(hugePages)
+	, m_pageSize(hugePages == HugePages::None ? OsPageSize() : HUGE_PAGE_SIZE)
+	, m_superblockSize(AlignUp(superblockSize, m_pageSize))
+	, m_cacheBytes(cacheBytes)
+{
+	assert(superblockSize > 0);
+}
+
+/// -----------------------------------------------------------------------------
+/// VirtualPageProvider dtor
+/// -----------------------------------------------------------------------------
+/// Unmaps everything: storage still in use by some chunk becomes invalid
+
+soa::VirtualPageProvider::~VirtualPageProvider()
+{
+	SOA_LOG_OSS("VirtualPageProvider: unmapping " << m_regions.size() << " regions");
+
+	for (const Region& region : m_regions)
+		OsUnmap(region.m_base, region.m_size);
+}
+
+/// -----------------------------------------------------------------------------
+/// VirtualPageProvider::Instance
+/// -----------------------------------------------------------------------------
+
+soa::VirtualPageProvider& soa::VirtualPageProvider::Instance() noexcept
+{
+	alignas(VirtualPageProvider) static unsigned char storage[sizeof(VirtualPageProvider)];
+	static VirtualPageProvider* provider = new(storage) VirtualPageProvider();
+	return *provider;
+}
+
+/// -----------------------------------------------------------------------------
+/// VirtualPageProvider::AllocatePages
+/// -----------------------------------------------------------------------------
+/// - Released span of the same size? Reuse it.
+/// - Bigger than a superblock? Map it on its own.
+/// - Otherwise carve it from the current superblock, mapping a new one when
+///   it doesn't fit: the tail of the old one is left unused.
+
+void* soa::VirtualPageProvider::AllocatePages(std::size_t size, std::size_t alignment)
+{
+	assert(size > 0);
+	assert(IsPowerOfTwo(alignment));
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (void* p = TakeFreeSpan(size, alignment))
+		return p;
+
+	if (AlignUp(size, alignment) > m_superblockSize)
+		return MapRegion(AlignUp(size, m_pageSize), (std::max)(alignment, m_pageSize));
+
+	unsigned char* p = reinterpret_cast<unsigned char*>(
+		AlignUp(reinterpret_cast<std::uintptr_t>(m_cursor), alignment));
+
+	if (!m_cursor || p + size > m_end)
+	{
+		p = static_cast<unsigned char*>(MapRegion(m_superblockSize, (std::max)(alignment, m_pageSize)));
+		if (!p) return nullptr;
+
+		m_end = p + m_superblockSize;
+	}
+
+	m_cursor = p + size;
+	return p;
+}
+
+/// -----------------------------------------------------------------------------
+/// VirtualPageProvider::ReleasePages
+/// -----------------------------------------------------------------------------
+/// Past the cache bound the oldest spans are decommitted down to half of it:
+/// the syscalls are amortized over the releases in between.
+
+void soa::VirtualPageProvider::ReleasePages(void* p, std::size_t size)
+{
+	if (!p) return;
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_freeSpans[size].push_back(Span{ p, true });
+	m_committedFreeBytes += size;
+
+	if (m_committedFreeBytes > m_cacheBytes)
+		DecommitDownTo(m_cacheBytes / 2);
+}
+
+/// -----------------------------------------------------------------------------
+/// VirtualPageProvider::Decommit
+/// -----------------------------------------------------------------------------
+
+void soa::VirtualPageProvider::Decommit()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	DecommitDownTo(0);
+}
+
+/// -----------------------------------------------------------------------------
+/// VirtualPageProvider::GetCommittedFreeBytes
+/// -----------------------------------------------------------------------------
+
+std::size_t soa::VirtualPageProvider::GetCommittedFreeBytes()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_committedFreeBytes;
+}
+
+/// -----------------------------------------------------------------------------
+/// VirtualPageProvider::DecommitDownTo
+/// -----------------------------------------------------------------------------
+/// Oldest spans of each size first: TakeFreeSpan reuses from the back.
+/// Requires the lock.
+
+void soa::VirtualPageProvider::DecommitDownTo(std::size_t bytes)
+{
+	for (auto& sizeSpans : m_freeSpans)
+	{
+		for (Span& span : sizeSpans.second)
+		{
+			if (m_committedFreeBytes <= bytes) return;
+			if (!span.m_committed) continue;
+
+			OsDecommit(span.m_p, sizeSpans.first);
+			span.m_committed = false;
+			m_committedFreeBytes -= sizeSpans.first;
+		}
+	}
+}
+
+/// -----------------------------------------------------------------------------
+/// VirtualPageProvider::TakeFreeSpan
+/// -----------------------------------------------------------------------------
+/// Last released first: it is the most likely to be still in cache.
+/// Requires the lock.
+
+void* soa::VirtualPageProvider::TakeFreeSpan(std::size_t size, std::size_t alignment)
+{
+	auto found = m_freeSpans.find(size);
+	if (found == m_freeSpans.end()) return nullptr;
+
+	SpanList& spans = found->second;
+	for (std::size_t i = spans.size(); i > 0; --i)
+	{
+		void* p = spans[i - 1].m_p;
+		if (reinterpret_cast<std::uintptr_t>(p) % alignment) continue;
+
+		if (spans[i - 1].m_committed) m_committedFreeBytes -= size;
+
+		spans[i - 1] = spans.back();
+		spans.pop_back();
+		return p;
+	}
+	return nullptr;
+}
+
+/// -----------------------------------------------------------------------------
+/// VirtualPageProvider::MapRegion
+/// -----------------------------------------------------------------------------
+/// Requires the lock
+
+void* soa::VirtualPageProvider::MapRegion(std::size_t size, std::size_t alignment)
+{
+	void* p = OsMap(size, alignment, m_hugePages);
+	if (!p) return nullptr;
+
+	SOA_LOG_OSS("VirtualPageProvider: mapped " << size << " bytes");
+
+	m_regions.push_back(Region{ p, size });
+	return p;
+}
+
+/// -----------------------------------------------------------------------------
+/// DefaultPageProvider
+/// -----------------------------------------------------------------------------
+/// Chunk storage is page aligned for the PageMap: carved from superblocks it
+/// costs nothing, one AlignedMalloc per chunk pays the heap padding every time
+
+soa::PageProvider& soa::DefaultPageProvider() noexcept
+{
+#ifdef SOA_MALLOC_PAGES
+	return MallocPageProvider::Instance();
+#else
+	return VirtualPageProvider::Instance();
+#endif
+}
@@ -0,0 +1,292 @@
+/// -----------------------------------------------------------------------------
+/// Global operator new/delete replacement
+/// -----------------------------------------------------------------------------
+/// Compiled only with USE_SMALL_OBJ_ALLOC defined: link this translation unit
+/// into a program and every new/delete expression of it (the standard library
+/// included) goes through the small object allocator.
+///
+/// - Every replaceable overload: plain, nothrow, sized, aligned, array.
+/// - Requests up to DEFAULT_MAX_OBJ_SIZE come from a per-thread ThreadCache
+///   over a shared SmallObjAllocator, bigger ones fall back to std::malloc
+///   (AlignedMalloc past the default alignment).
+/// - Blocks bigger than 8 bytes are __STDCPP_DEFAULT_NEW_ALIGNMENT__ aligned,
+///   as operator new must guarantee for any object that fits.
+/// - Arrays need no size header: new[] is new, the unsized deletes find the
+///   size class in the PageMap, and anything not in a chunk is a fallback.
+/// - The allocators keep their metadata in MallocAllocator containers, the
+///   PageMap and the cache bins use calloc/malloc: nothing here recurses into
+///   operator new.
+/// - The shared allocator is never destroyed, so destructors of static
+///   objects can free until the process exits. Threads whose cache is already
+///   gone go to it under the shared lock.
+/// - Out of memory: std::new_handler loop, then std::bad_alloc or nullptr.
+
+#ifdef USE_SMALL_OBJ_ALLOC
+
+#include <cstddef>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include "SmallObjAllocator\SOA_defaults.h"
+#include "SmallObjAllocator\SOA_memory.h"
+#include "SmallObjAllocator\PageMap.h"
+#include "SmallObjAllocator\SmallObjAllocator.h"
+#include "SmallObjAllocator\ThreadCache.h"
+
+#ifdef SOA_DEBUG_LOG_ENABLED
+#error "SOA_DEBUG_LOG_ENABLED logs through iostreams, that allocate: not usable with USE_SMALL_OBJ_ALLOC"
+#endif
+
+namespace {
+
+	/// Allocator behind the replacement, never destroyed
+	/// (same pattern of the page providers)
+
+	struct GlobalAllocator {
+		static soa::SmallObjAllocator& Instance() noexcept
+		{
+			alignas(soa::SmallObjAllocator) static unsigned char storage[sizeof(soa::SmallObjAllocator)];
+			static soa::SmallObjAllocator* allocator =
+				new(storage) soa::SmallObjAllocator(soa::DEFAULT_CHUNK_SIZE, soa::DEFAULT_MAX_OBJ_SIZE);
+			return *allocator;
+		}
+	};
+
+	using Cache = soa::ThreadCache<GlobalAllocator>;
+
+	/// alignment argument of the overloads without std::align_val_t.
+	/// Their block must be aligned for any object that fits in it: a 16 bytes
+	/// long double fits in 24. A size class block is aligned to the largest
+	/// power of two dividing its size (chunks are DEFAULT_CHUNK_ALIGNMENT
+	/// aligned), so requests bigger than 8 are rounded up to a multiple of
+	/// __STDCPP_DEFAULT_NEW_ALIGNMENT__ (see NewSize), as the preload shim does.
+
+	constexpr std::size_t NO_ALIGNMENT = 0;
+
+	constexpr std::size_t NEW_ALIGNMENT = __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+
+	/// -----------------------------------------------------------------------------
+	/// NewSize
+	/// -----------------------------------------------------------------------------
+	/// Size actually requested for n bytes: allocation and sized delete must
+	/// round the same way to find the same size class. new(0) must return a
+	/// unique pointer: 0 bytes take the smallest size class.
+
+	constexpr std::size_t NewSize(std::size_t n, std::size_t alignment) noexcept
+	{
+		if (n == 0) return 1;
+		if (alignment == NO_ALIGNMENT && n > 8) return soa::AlignUp(n, NEW_ALIGNMENT);
+		return n;
+	}
+
+	/// -----------------------------------------------------------------------------
+	/// TryAllocate
+	/// -----------------------------------------------------------------------------
+	/// nullptr on failure
+
+	void* TryAllocate(std::size_t n, std::size_t alignment) noexcept
+	{
+		n = NewSize(n, alignment);
+
+		try
+		{
+			if (Cache* cache = Cache::Current())
+				return alignment ? cache->Allocate(n, alignment) : cache->Allocate(n);
+
+			std::lock_guard<std::mutex> lock(Cache::SharedMutex());
+			soa::SmallObjAllocator& allocator = GlobalAllocator::Instance();
+			return alignment ? allocator.Allocate(n, alignment) : allocator.Allocate(n);
+		}
+		catch (const std::bad_alloc&)
+		{
+			return nullptr; // a size class table or pool that couldn't grow
+		}
+	}
+
+	/// -----------------------------------------------------------------------------
+	/// Allocate
+	/// -----------------------------------------------------------------------------
+	/// The standard operator new loop: retry as long as a new_handler is set
+
+	void* Allocate(std::size_t n, std::size_t alignment)
+	{
+		for (;;)
+		{
+			if (void* p = TryAllocate(n, alignment)) return p;
+
+			std::new_handler handler = std::get_new_handler();
+			if (!handler) throw std::bad_alloc();
+			handler();
+		}
+	}
+
+	void* AllocateNoThrow(std::size_t n, std::size_t alignment) noexcept
+	{
+		try
+		{
+			return Allocate(n, alignment);
+		}
+		catch (...)
+		{
+			return nullptr;
+		}
+	}
+
+	/// -----------------------------------------------------------------------------
+	/// Deallocate (sized)
+	/// -----------------------------------------------------------------------------
+	/// n and alignment are the ones of the allocation, so the same rounding
+	/// picks the same size class or fallback
+
+	void Deallocate(void* p, std::size_t n, std::size_t alignment) noexcept
+	{
+		if (!p) return;
+		n = NewSize(n, alignment);
+
+		if (Cache* cache = Cache::Current())
+			return alignment ? cache->Deallocate(p, n, alignment) : cache->Deallocate(p, n);
+
+		std::lock_guard<std::mutex> lock(Cache::SharedMutex());
+		soa::SmallObjAllocator& allocator = GlobalAllocator::Instance();
+		alignment ? allocator.Deallocate(p, n, alignment) : allocator.Deallocate(p, n);
+	}
+
+	/// -----------------------------------------------------------------------------
+	/// Deallocate (unsized)
+	/// -----------------------------------------------------------------------------
+	/// The PageMap tells chunk blocks from fallbacks. Up to alignof(max_align_t)
+	/// fallbacks are std::malloc'ed, past it they are AlignedMalloc'ed
+	/// (see IsDefaultAligned).
+
+	void Deallocate(void* p, std::size_t alignment) noexcept
+	{
+		if (!p) return;
+
+		if (alignment > alignof(std::max_align_t) && !soa::PageMap::Instance().Contains(p))
+			return soa::AlignedFree(p);
+
+		if (Cache* cache = Cache::Current())
+			return cache->Deallocate(p);
+
+		std::lock_guard<std::mutex> lock(Cache::SharedMutex());
+		GlobalAllocator::Instance().Deallocate(p);
+	}
+
+}
+
+/// -----------------------------------------------------------------------------
+/// operator new
+/// -----------------------------------------------------------------------------
+
+void* operator new(std::size_t n)
+{
+	return Allocate(n, NO_ALIGNMENT);
+}
+
+void* operator new[](std::size_t n)
+{
+	return Allocate(n, NO_ALIGNMENT);
+}
+
+void* operator new(std::size_t n, const std::nothrow_t&) noexcept
+{
+	return AllocateNoThrow(n, NO_ALIGNMENT);
+}
+
+void* operator new[](std::size_t n, const std::nothrow_t&) noexcept
+{
+	return AllocateNoThrow(n, NO_ALIGNMENT);
+}
+
+// aligned, from C++17 (types with alignof > __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+
+void* operator new(std::size_t n, std::align_val_t al)
+{
+	return Allocate(n, static_cast<std::size_t>(al));
+}
+
+void* operator new[](std::size_t n, std::align_val_t al)
+{
+	return Allocate(n, static_cast<std::size_t>(al));
+}
+
+void* operator new(std::size_t n, std::align_val_t al, const std::nothrow_t&) noexcept
+{
+	return AllocateNoThrow(n, static_cast<std::size_t>(al));
+}
+
+void* operator new[](std::size_t n, std::align_val_t al, const std::nothrow_t&) noexcept
+{
+	return AllocateNoThrow(n, static_cast<std::size_t>(al));
+}
+
+/// -----------------------------------------------------------------------------
+/// operator delete
+/// -----------------------------------------------------------------------------
+/// Unsized: incomplete types, base classes without a virtual dtor, code built
+/// without sized deallocation, arrays of trivially destructible types.
+/// Sized (from C++14): n is what the matching new got, array cookie included.
+
+void operator delete(void* p) noexcept
+{
+	Deallocate(p, NO_ALIGNMENT);
+}
+
+void operator delete[](void* p) noexcept
+{
+	Deallocate(p, NO_ALIGNMENT);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept
+{
+	Deallocate(p, NO_ALIGNMENT);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept
+{
+	Deallocate(p, NO_ALIGNMENT);
+}
+
+void operator delete(void* p, std::size_t n) noexcept
+{
+	Deallocate(p, n, NO_ALIGNMENT);
+}
+
+void operator delete[](void* p, std::size_t n) noexcept
+{
+	Deallocate(p, n, NO_ALIGNMENT);
+}
+
+// aligned
+
+void operator delete(void* p, std::align_val_t al) noexcept
+{
+	Deallocate(p, static_cast<std::size_t>(al));
+}
+
+void operator delete[](void* p, std::align_val_t al) noexcept
+{
+	Deallocate(p, static_cast<std::size_t>(al));
+}
+
+void operator delete(void* p, std::align_val_t al, const std::nothrow_t&) noexcept
+{
+	Deallocate(p, static_cast<std::size_t>(al));
+}
+
+void operator delete[](void* p, std::align_val_t al, const std::nothrow_t&) noexcept
+{
+	Deallocate(p, static_cast<std::size_t>(al));
+}
+
+void operator delete(void* p, std::size_t n, std::align_val_t al) noexcept
+{
+	Deallocate(p, n, static_cast<std::size_t>(al));
+}
+
+void operator delete[](void* p, std::size_t n, std::align_val_t al) noexcept
+{
+	Deallocate(p, n, static_cast<std::size_t>(al));
+}
+
+#endif // USE_SMALL_OBJ_ALLOC
@@ -0,0 +1,331 @@
+/// -----------------------------------------------------------------------------
+/// malloc-compatible C ABI, loadable with LD_PRELOAD (Linux, glibc)
+/// -----------------------------------------------------------------------------
+/// Compiled only with SOA_PRELOAD defined. Built as a shared object together
+/// with the sources of src/SmallObjAllocator and src/CustomSmallObjAllocator
+/// (-shared -fPIC -ftls-model=initial-exec -DSOA_PRELOAD -DNDEBUG), it
+/// replaces the allocator of an unmodified process:
+///
+///     LD_PRELOAD=./libsoa_preload.so ./program
+///
+/// - Exports malloc, free, calloc, realloc, posix_memalign, aligned_alloc
+///   and malloc_usable_size.
+/// - Requests up to DEFAULT_MAX_OBJ_SIZE come from a per-thread ThreadCache
+///   over a CtmSmallObjAllocator that is never destroyed, chunk storage is
+///   mmap'ed by the VirtualPageProvider.
+/// - Bigger (or more aligned) requests go to glibc (__libc_malloc and co.).
+/// - free/realloc tell the two apart with the PageMap: pointers not in any
+///   chunk belong to glibc, so memory of functions not exported here
+///   (memalign, valloc, strdup inside libc...) can be freed as usual.
+/// - The allocator internals call std::malloc too, that resolves here: a
+///   per-thread busy flag sends them straight to glibc, nothing recurses.
+/// - Small blocks bigger than 8 bytes are 16 bytes aligned, as glibc ones:
+///   programs rely on it even when the standard wouldn't require it.
+/// - SOA_HEAP_PROFILE=<path> starts the HeapProfiler (interval from
+///   SOA_HEAP_PROFILE_INTERVAL, bytes) and writes a pprof heap profile
+///   of the blocks still live at exit.
+
+#ifdef SOA_PRELOAD
+
+#ifndef __linux__
+#error "SOA_PRELOAD: the LD_PRELOAD shim needs Linux and glibc"
+#endif
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <dlfcn.h>
+#include <pthread.h>
+#include "SmallObjAllocator\SOA_defaults.h"
+#include "SmallObjAllocator\SOA_memory.h"
+#include "SmallObjAllocator\PageMap.h"
+#include "SmallObjAllocator\HeapProfiler.h"
+#include "SmallObjAllocator\PageProvider.h"
+#include "SmallObjAllocator\ThreadCache.h"
+#include "CustomSmallObjAllocator\CtmSmallObjAllocator.h"
+
+#ifdef SOA_DEBUG_LOG_ENABLED
+#error "SOA_DEBUG_LOG_ENABLED logs through iostreams, that allocate: not usable with SOA_PRELOAD"
+#endif
+
+extern "C" {
+	void* __libc_malloc(std::size_t size);
+	void* __libc_calloc(std::size_t n, std::size_t size);
+	void* __libc_realloc(void* p, std::size_t size);
+	void* __libc_memalign(std::size_t alignment, std::size_t size);
+	void  __libc_free(void* p);
+}
+
+namespace {
+
+	/// Allocator behind the shim, never destroyed: atexit handlers and
+	/// static destructors of the process can free until the very end
+
+	struct PreloadAllocator {
+		static soa::CtmSmallObjAllocator& Instance() noexcept
+		{
+			alignas(soa::CtmSmallObjAllocator) static unsigned char storage[sizeof(soa::CtmSmallObjAllocator)];
+			static soa::CtmSmallObjAllocator* allocator = new(storage) soa::CtmSmallObjAllocator(
+				soa::DEFAULT_CHUNK_SIZE, soa::DEFAULT_MAX_OBJ_SIZE,
+				soa::DEFAULT_CTM_CHUNK_LOOKUP, &soa::VirtualPageProvider::Instance());
+			return *allocator;
+		}
+	};
+
+	using Cache = soa::ThreadCache<PreloadAllocator>;
+
+	constexpr std::size_t MALLOC_ALIGNMENT = 16; // glibc: 2 * sizeof(size_t) on 64 bit
+
+	/// true while the calling thread is inside the shim (its allocations go
+	/// to glibc), and for good once the thread starts exiting
+
+	[[gnu::tls_model("initial-exec")]] thread_local bool t_busy = false;
+
+	struct BusyScope {
+		bool m_prev = t_busy;
+		BusyScope() noexcept { t_busy = true; }
+		~BusyScope() { t_busy = m_prev; }
+	};
+
+	/// Per-thread state. Its cache is built first, so it is destroyed after
+	/// ThreadState: when the cache flushes at thread exit the busy flag is
+	/// already set, the allocator internals don't come back here.
+	/// Touched only with t_busy set.
+
+	struct ThreadState {
+		Cache* m_cache = &Cache::Local();
+		~ThreadState() { t_busy = true; }
+	};
+
+	thread_local ThreadState t_state;
+
+	/// -----------------------------------------------------------------------------
+	/// SmallAllocate
+	/// -----------------------------------------------------------------------------
+	/// n <= DEFAULT_MAX_OBJ_SIZE, requires t_busy. nullptr on failure.
+
+	void* SmallAllocate(std::size_t n) noexcept
+	{
+		if (n == 0) n = 1;
+		if (n > 8) n = soa::AlignUp(n, MALLOC_ALIGNMENT);
+
+		try
+		{
+			return t_state.m_cache->Allocate(n);
+		}
+		catch (const std::bad_alloc&)
+		{
+			return nullptr; // no storage for a new chunk
+		}
+	}
+
+	/// -----------------------------------------------------------------------------
+	/// SmallDeallocate
+	/// -----------------------------------------------------------------------------
+	/// blockSize from the PageMap. A thread that is exiting has no cache
+	/// anymore: straight to the shared allocator.
+
+	void SmallDeallocate(void* p, std::size_t blockSize) noexcept
+	{
+		if (t_busy)
+		{
+			Cache::SerializedLock lock;
+			PreloadAllocator::Instance().Deallocate(p, blockSize);
+			return;
+		}
+
+		BusyScope busy;
+		t_state.m_cache->Deallocate(p, blockSize);
+	}
+
+	/// -----------------------------------------------------------------------------
+	/// Aligned
+	/// -----------------------------------------------------------------------------
+	/// Size classes multiple of alignment are aligned enough, see IsDefaultAligned
+
+	void* Aligned(std::size_t alignment, std::size_t n) noexcept
+	{
+		if (alignment <= MALLOC_ALIGNMENT)
+			return malloc(n);
+
+		if (t_busy || !soa::IsDefaultAligned(n, alignment, soa::DEFAULT_MAX_OBJ_SIZE))
+			return __libc_memalign(alignment, n);
+
+		BusyScope busy;
+		return SmallAllocate(soa::AlignUp(n ? n : 1, alignment));
+	}
+
+	/// -----------------------------------------------------------------------------
+	/// LibcUsableSize
+	/// -----------------------------------------------------------------------------
+	/// glibc exports no __libc_ version of it: the next definition in lookup
+	/// order, resolved on first use (dlsym may allocate, hence the busy flag)
+
+	std::size_t LibcUsableSize(void* p) noexcept
+	{
+		using UsableSizeFn = std::size_t(*)(void*);
+		static UsableSizeFn next = [] {
+			BusyScope busy;
+			return reinterpret_cast<UsableSizeFn>(dlsym(RTLD_NEXT, "malloc_usable_size"));
+		}();
+
+		return next ? next(p) : 0;
+	}
+
+	/// -----------------------------------------------------------------------------
+	/// fork
+	/// -----------------------------------------------------------------------------
+	/// The child has only the forking thread: no other thread may hold the
+	/// shared lock across the fork
+
+	void ForkPrepare() noexcept { Cache::SharedMutex().lock(); }
+	void ForkParent() noexcept { Cache::SharedMutex().unlock(); }
+	void ForkChild() noexcept { Cache::SharedMutex().unlock(); }
+
+	[[gnu::constructor]] void RegisterForkHandlers() noexcept
+	{
+		BusyScope busy;
+		pthread_atfork(ForkPrepare, ForkParent, ForkChild);
+	}
+
+	/// -----------------------------------------------------------------------------
+	/// Heap profile
+	/// -----------------------------------------------------------------------------
+	/// The dump runs with the busy flag: the streams allocate from glibc
+
+	[[gnu::constructor]] void StartHeapProfile() noexcept
+	{
+		if (!std::getenv("SOA_HEAP_PROFILE")) return;
+
+		const char* interval = std::getenv("SOA_HEAP_PROFILE_INTERVAL");
+		soa::HeapProfiler::Instance().Start(interval ? std::strtoull(interval, nullptr, 10) : 0);
+	}
+
+	[[gnu::destructor]] void DumpHeapProfile() noexcept
+	{
+		const char* path = std::getenv("SOA_HEAP_PROFILE");
+		if (!path) return;
+
+		BusyScope busy;
+		try
+		{
+			soa::HeapProfiler::Instance().DumpPprof(path);
+		}
+		catch (...)
+		{
+		}
+	}
+}
+
+/// -----------------------------------------------------------------------------
+/// Exported functions
+/// -----------------------------------------------------------------------------
+
+extern "C" {
+
+	[[gnu::visibility("default")]] void* malloc(std::size_t n) noexcept
+	{
+		if (t_busy || n > soa::DEFAULT_MAX_OBJ_SIZE)
+			return __libc_malloc(n);
+
+		BusyScope busy;
+		void* p = SmallAllocate(n);
+		if (!p) errno = ENOMEM;
+		return p;
+	}
+
+	[[gnu::visibility("default")]] void free(void* p) noexcept
+	{
+		if (!p) return;
+
+		const std::size_t blockSize = soa::PageMap::Instance().BlockSize(p);
+		if (!blockSize)
+			return __libc_free(p);
+
+		SmallDeallocate(p, blockSize);
+	}
+
+	[[gnu::visibility("default")]] void* calloc(std::size_t n, std::size_t size) noexcept
+	{
+		if (size && n > static_cast<std::size_t>(-1) / size)
+		{
+			errno = ENOMEM;
+			return nullptr;
+		}
+
+		const std::size_t bytes = n * size;
+		if (t_busy || bytes > soa::DEFAULT_MAX_OBJ_SIZE)
+			return __libc_calloc(n, size);
+
+		void* p = malloc(bytes);
+		if (p) std::memset(p, 0, bytes);
+		return p;
+	}
+
+	/// Shrinking, or growing within the size class, keeps the block.
+	/// glibc blocks stay glibc blocks.
+
+	[[gnu::visibility("default")]] void* realloc(void* p, std::size_t n) noexcept
+	{
+		if (!p) return malloc(n);
+
+		const std::size_t blockSize = soa::PageMap::Instance().BlockSize(p);
+		if (!blockSize)
+			return __libc_realloc(p, n);
+
+		if (n == 0)
+		{
+			free(p);
+			return nullptr;
+		}
+
+		if (n <= blockSize) return p;
+
+		void* q = malloc(n);
+		if (!q) return nullptr; // p untouched
+
+		std::memcpy(q, p, blockSize);
+		SmallDeallocate(p, blockSize);
+		return q;
+	}
+
+	[[gnu::visibility("default")]] int posix_memalign(void** out, std::size_t alignment, std::size_t n) noexcept
+	{
+		if (!soa::IsPowerOfTwo(alignment) || alignment % sizeof(void*))
+			return EINVAL;
+
+		void* p = Aligned(alignment, n);
+		if (!p) return ENOMEM;
+
+		*out = p;
+		return 0;
+	}
+
+	[[gnu::visibility("default")]] void* aligned_alloc(std::size_t alignment, std::size_t n) noexcept
+	{
+		if (!soa::IsPowerOfTwo(alignment))
+		{
+			errno = EINVAL;
+			return nullptr;
+		}
+
+		void* p = Aligned(alignment, n);
+		if (!p) errno = ENOMEM;
+		return p;
+	}
+
+	[[gnu::visibility("default")]] std::size_t malloc_usable_size(void* p) noexcept
+	{
+		if (!p) return 0;
+
+		if (const std::size_t blockSize = soa::PageMap::Instance().BlockSize(p))
+			return blockSize;
+
+		return LibcUsableSize(p);
+	}
+}
+
+#endif // SOA_PRELOAD
@@ -1,28 +1,51 @@
 #include <cassert>
+#include <cstdlib>
 #include "SmallObjAllocator\SmallObjAllocator.h"
+#include "SmallObjAllocator\PageMap.h"
+#include "SmallObjAllocator\HeapProfiler.h"
+#include "SmallObjAllocator\Hardened.h"
+#include "SmallObjAllocator\SOA_memory.h"
 #include "SmallObjAllocator\SOA_debug.h"
 
 /// -----------------------------------------------------------------------------
 /// SmallObjAllocator::SmallObjAllocator ctor
 /// -----------------------------------------------------------------------------
 
-soa::SmallObjAllocator::SmallObjAllocator(std::size_t chunkSize, std::size_t maxObjectSize)
-	: m_chunkSize(chunkSize), m_maxObjSize(maxObjectSize)
+soa::SmallObjAllocator::SmallObjAllocator(std::size_t chunkSize, std::size_t maxObjectSize,
+	PageProvider* provider, const RetentionPolicy& retention)
+	: m_table(SizeClassIndex(maxObjectSize) + 1)
+	, m_chunkSize(chunkSize), m_maxObjSize(maxObjectSize), m_provider(provider)
+	, m_retention(retention)
 {
 }
 
 /// -----------------------------------------------------------------------------
-/// Functor
+/// SmallObjAllocator::CreateFixedAllocator
 /// -----------------------------------------------------------------------------
+/// First request of a size class: build its allocator in place and publish it
 
-namespace {
+soa::FixedAllocator& soa::SmallObjAllocator::CreateFixedAllocator(std::size_t index)
+{
+	assert(index > 0 && index < m_table.size());
+	assert(!m_table[index].load(std::memory_order_relaxed));
 
-	struct CompareFixedAllocatorSize {
+	m_Pool.emplace_back(SizeClassBytes(index), m_chunkSize, m_provider, m_retention);
+	m_table[index].store(&m_Pool.back(), std::memory_order_release);
+	return m_Pool.back();
+}
 
-		bool operator()(const soa::FixedAllocator& x, std::size_t numBytes) const noexcept {
-			return x.GetBlockSize() < numBytes;
-		}
-	};
+/// -----------------------------------------------------------------------------
+/// SmallObjAllocator::GetFixedAllocator
+/// -----------------------------------------------------------------------------
+
+soa::FixedAllocator& soa::SmallObjAllocator::GetFixedAllocator(std::size_t numBytes)
+{
+	assert(numBytes <= m_maxObjSize);
+
+	const std::size_t index = SizeClassIndex(numBytes);
+	FixedAllocator* fixed = m_table[index].load(std::memory_order_acquire);
+
+	return fixed ? *fixed : CreateFixedAllocator(index);
 }
 
 /// -----------------------------------------------------------------------------
@@ -30,9 +53,8 @@ namespace {
 /// -----------------------------------------------------------------------------
 /// - If the size of the request is greater then the max small object size handled
 ///   fallback to the default allocator.
-/// - First checks if the last fixed allocator used for dealloc has the 
-///   right block size. In that case forward allocation request.
-/// - Otherwise linear search.
+/// - Otherwise forward to the fixed allocator of its size class, 
+///   creating it on the first request.
 
 void* soa::SmallObjAllocator::Allocate(std::size_t numBytes)
 {
@@ -43,28 +65,19 @@ void* soa::SmallObjAllocator::Allocate(std::size_t numBytes)
 	}
 		
 
-	if (m_pLastAlloc && m_pLastAlloc->GetBlockSize() == numBytes)
-	{
-		SOA_LOG("Soa allocate called");
-		return m_pLastAlloc->Allocate();
-	}
+	const std::size_t index = SizeClassIndex(numBytes);
+	FixedAllocator* fixed = m_table[index].load(std::memory_order_acquire);
 
-	std::vector<FixedAllocator>::iterator it = std::lower_bound(
-		m_Pool.begin(),
-		m_Pool.end(),
-		numBytes,
-		CompareFixedAllocatorSize{});
+	if (!fixed)
+		fixed = &CreateFixedAllocator(index);
 
-	if (it == m_Pool.end() || it->GetBlockSize() != numBytes)
-	{
-		it = m_Pool.insert(it, FixedAllocator(numBytes));
-		m_pLastDealloc = &*m_Pool.begin();
-	}
+	SOA_LOG("Soa allocate called");
+	void* p = fixed->Allocate();
 
-	m_pLastAlloc = &*it;
+	if (HeapProfiler::Tick(SizeClassBytes(index))) [[unlikely]]
+		HeapProfiler::Instance().RecordAllocation(this, p, SizeClassBytes(index));
 
-	SOA_LOG("Soa allocate called");
-	return m_pLastAlloc->Allocate();
+	return p;
 }
 
 /// -----------------------------------------------------------------------------
@@ -77,28 +90,229 @@ void soa::SmallObjAllocator::Deallocate(void* p, std::size_t numBytes)
 {
 	if (numBytes > m_maxObjSize)
 	{
+#ifdef SOA_HARDENED
+		if (!hardened::CheckNotInChunk(p)) return;
+#endif
 		SOA_LOG("std::free called");
 		return std::free(p);
 	}
 		
-	if (m_pLastDealloc && m_pLastDealloc->GetBlockSize() == numBytes)
+	FixedAllocator* fixed = m_table[SizeClassIndex(numBytes)].load(std::memory_order_acquire);
+
+	assert(fixed);
+
+	SOA_LOG("Soa deallocate called");
+	HeapProfiler::OnFree(p);
+	fixed->Deallocate(p);
+}
+
+/// -----------------------------------------------------------------------------
+/// SmallObjAllocator::Deallocate (size-less)
+/// -----------------------------------------------------------------------------
+/// The PageMap gives the size class, then the fixed allocator reads the
+/// chunk tag of the same entry: no search of its chunks. A block of another
+/// allocator would be given to the fixed allocator of its size here: don't
+/// mix them.
+
+void soa::SmallObjAllocator::Deallocate(void* p)
+{
+	if (!p) return;
+
+	const std::size_t blockSize = PageMap::Instance().BlockSize(p);
+
+	if (!blockSize)
 	{
-		SOA_LOG("Soa deallocate called");
-		m_pLastDealloc->Deallocate(p);
-		return;
+		SOA_LOG("std::free called");
+		return std::free(p);
 	}
 
-	std::vector<FixedAllocator>::iterator it = std::lower_bound(
-		m_Pool.begin(),
-		m_Pool.end(),
-		numBytes,
-		CompareFixedAllocatorSize{});
+	assert(blockSize <= m_maxObjSize);
 
-	assert(it != m_Pool.end());
-	assert(it->GetBlockSize() == numBytes);
+	FixedAllocator* fixed = m_table[SizeClassIndex(blockSize)].load(std::memory_order_acquire);
 
-	m_pLastDealloc = &*it;
+	assert(fixed && fixed->GetBlockSize() == blockSize);
 
 	SOA_LOG("Soa deallocate called");
-	m_pLastDealloc->Deallocate(p);
-}
\ No newline at end of file
+	HeapProfiler::OnFree(p);
+	fixed->Deallocate(p);
+}
+
+/// -----------------------------------------------------------------------------
+/// SmallObjAllocator::AllocateBatch
+/// -----------------------------------------------------------------------------
+/// One size check and one table lookup for the whole batch, then the fixed
+/// allocator fills out chunk by chunk.
+/// Returns how many objects were allocated: less than n only when out of memory.
+
+std::size_t soa::SmallObjAllocator::AllocateBatch(std::size_t numBytes, std::size_t n, void** out)
+{
+	if (numBytes > m_maxObjSize)
+	{
+		SOA_LOG("std::malloc called");
+		for (std::size_t i = 0; i < n; ++i)
+		{
+			out[i] = std::malloc(numBytes);
+			if (!out[i]) return i;
+		}
+		return n;
+	}
+
+	const std::size_t index = SizeClassIndex(numBytes);
+	FixedAllocator* fixed = m_table[index].load(std::memory_order_acquire);
+
+	if (!fixed)
+		fixed = &CreateFixedAllocator(index);
+
+	SOA_LOG("Soa allocate batch called");
+	return fixed->AllocateBatch(n, out);
+}
+
+/// -----------------------------------------------------------------------------
+/// SmallObjAllocator::DeallocateBatch
+/// -----------------------------------------------------------------------------
+
+void soa::SmallObjAllocator::DeallocateBatch(std::size_t numBytes, std::size_t n, void** in)
+{
+	if (numBytes > m_maxObjSize)
+	{
+		SOA_LOG("std::free called");
+		for (std::size_t i = 0; i < n; ++i) std::free(in[i]);
+		return;
+	}
+
+	FixedAllocator* fixed = m_table[SizeClassIndex(numBytes)].load(std::memory_order_acquire);
+
+	assert(fixed);
+
+	SOA_LOG("Soa deallocate batch called");
+	for (std::size_t i = 0; i < n; ++i) HeapProfiler::OnFree(in[i]);
+	fixed->DeallocateBatch(n, in);
+}
+
+/// -----------------------------------------------------------------------------
+/// SmallObjAllocator::Allocate (aligned)
+/// -----------------------------------------------------------------------------
+/// Chunks are DEFAULT_CHUNK_ALIGNMENT aligned, so every block of a size class
+/// multiple of alignment is aligned as well: round the request up and take
+/// the usual path (e.g. 48 bytes aligned to 64 are served by the 64 class).
+/// Alignments the size classes can't guarantee go to AlignedMalloc.
+
+void* soa::SmallObjAllocator::Allocate(std::size_t numBytes, std::size_t alignment)
+{
+	assert(IsPowerOfTwo(alignment));
+
+	if (IsDefaultAligned(numBytes, alignment, m_maxObjSize))
+		return Allocate(AlignUp(numBytes, alignment));
+
+	SOA_LOG("AlignedMalloc called");
+	return AlignedMalloc(AlignUp(numBytes, alignment), alignment);
+}
+
+/// -----------------------------------------------------------------------------
+/// SmallObjAllocator::Deallocate (aligned)
+/// -----------------------------------------------------------------------------
+
+void soa::SmallObjAllocator::Deallocate(void* p, std::size_t numBytes, std::size_t alignment)
+{
+	assert(IsPowerOfTwo(alignment));
+
+	if (IsDefaultAligned(numBytes, alignment, m_maxObjSize))
+		return Deallocate(p, AlignUp(numBytes, alignment));
+
+	SOA_LOG("AlignedFree called");
+	AlignedFree(p);
+}
+
+/// -----------------------------------------------------------------------------
+/// SmallObjAllocator::Snapshot
+/// -----------------------------------------------------------------------------
+/// Walks the table rather than the pool: entries are published with release
+/// semantics, a size class created concurrently is either seen whole or not.
+
+soa::AllocatorSnapshot soa::SmallObjAllocator::Snapshot() const
+{
+	AllocatorSnapshot snapshot;
+
+	for (std::size_t index = 1; index < m_table.size(); ++index)
+	{
+		if (const FixedAllocator* fixed = m_table[index].load(std::memory_order_acquire))
+			AddSizeClass(snapshot, fixed->GetStats());
+	}
+
+	return snapshot;
+}
+
+/// -----------------------------------------------------------------------------
+/// SmallObjAllocator::Trim
+/// -----------------------------------------------------------------------------
+/// Returns to the provider the storage of the empty chunks, and asks it to
+/// give the physical pages back to the OS: after a spike this is what brings
+/// the footprint down (with VirtualPageProvider, malloc may keep it).
+
+std::size_t soa::SmallObjAllocator::Trim()
+{
+	std::size_t released = 0;
+
+	for (FixedAllocator& fixed : m_Pool)
+	{
+		released += fixed.Trim();
+	}
+
+	PageProvider& provider = m_provider ? *m_provider : DefaultPageProvider();
+	provider.Decommit();
+
+	SOA_LOG_OSS("SmallObjAllocator::Trim: released " << released << " chunks");
+
+	return released;
+}
+
+/// -----------------------------------------------------------------------------
+/// SmallObjAllocator::Reset
+/// -----------------------------------------------------------------------------
+/// One pass over the chunks of every size class: a request-scoped arena
+/// drops everything it allocated without walking its objects.
+
+void soa::SmallObjAllocator::Reset()
+{
+	HeapProfiler::Instance().DropOwner(this);
+
+	for (FixedAllocator& fixed : m_Pool)
+	{
+		fixed.Reset();
+	}
+}
+
+/// -----------------------------------------------------------------------------
+/// SmallObjAllocator::Release
+/// -----------------------------------------------------------------------------
+/// The size classes stay, their chunks are allocated again on demand
+
+std::size_t soa::SmallObjAllocator::Release()
+{
+	HeapProfiler::Instance().DropOwner(this);
+
+	std::size_t released = 0;
+
+	for (FixedAllocator& fixed : m_Pool)
+	{
+		released += fixed.Release();
+	}
+
+	SOA_LOG_OSS("SmallObjAllocator::Release: released " << released << " chunks");
+
+	return released;
+}
+
+/// -----------------------------------------------------------------------------
+/// SmallObjAllocator::SetRetentionPolicy
+/// -----------------------------------------------------------------------------
+
+void soa::SmallObjAllocator::SetRetentionPolicy(const RetentionPolicy& retention)
+{
+	m_retention = retention;
+
+	for (FixedAllocator& fixed : m_Pool)
+	{
+		fixed.SetRetentionPolicy(retention);
+	}
+}
@@ -0,0 +1,32 @@
+#include "SmallObjAllocator\StackArena.h"
+
+/// -----------------------------------------------------------------------------
+/// StackArena::Deallocate
+/// -----------------------------------------------------------------------------
+/// Only the block right below the bump pointer can be given back: blocks of
+/// an older buffer end before the header of the current one, never at m_cur.
+/// Its alignment padding stays used.
+
+void soa::StackArena::Deallocate(void* p, std::size_t numBytes) noexcept
+{
+	if (!p) return;
+	if (numBytes == 0) numBytes = 1;
+
+	char* block = static_cast<char*>(p);
+	if (block + numBytes == m_cur)
+		m_cur = block;
+}
+
+void soa::StackArena::Deallocate(void* p, std::size_t numBytes, std::size_t) noexcept
+{
+	Deallocate(p, numBytes);
+}
+
+/// -----------------------------------------------------------------------------
+/// StackArena::Rollback
+/// -----------------------------------------------------------------------------
+
+void soa::StackArena::Rollback(const Marker& marker) noexcept
+{
+	MoveTo(marker.m_buffer, marker.m_cur);
+}
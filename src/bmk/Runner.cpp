@@ -0,0 +1,238 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include "bmk\Runner.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+#ifdef __linux__
+    /// CPUs of the process, read before any thread of the benchmarks is
+    /// pinned (new threads inherit the mask of their creator)
+
+    const cpu_set_t& ProcessCpus() noexcept
+    {
+        static const cpu_set_t cpus = [] {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            if (sched_getaffinity(getpid(), sizeof(set), &set) != 0) CPU_SET(0, &set);
+            return set;
+        }();
+        return cpus;
+    }
+#endif
+
+    double Percentile(const std::vector<std::uint64_t>& sorted, double q) noexcept
+    {
+        const std::size_t rank = static_cast<std::size_t>(std::ceil(q * static_cast<double>(sorted.size())));
+        const std::uint64_t ticks = sorted[rank ? rank - 1 : 0];
+        return (std::max)(0.0, bmk::Clock::ToNs(ticks) - bmk::Clock::OverheadNs());
+    }
+}
+
+/// -----------------------------------------------------------------------------
+/// Clock::NsPerTick
+/// -----------------------------------------------------------------------------
+/// TSC: ticks counted over 20 ms of steady_clock, once
+
+double bmk::Clock::NsPerTick() noexcept
+{
+#ifdef BMK_HAS_TSC
+    static const double nsPerTick = [] {
+        using namespace std::chrono;
+
+        const auto start = steady_clock::now();
+        const std::uint64_t ticksStart = __rdtsc();
+
+        auto now = start;
+        while (now - start < milliseconds(20)) now = steady_clock::now();
+
+        const std::uint64_t ticks = __rdtsc() - ticksStart;
+        const double ns = static_cast<double>(duration_cast<nanoseconds>(now - start).count());
+        return ticks ? ns / static_cast<double>(ticks) : 1.0;
+    }();
+    return nsPerTick;
+#else
+    return 1.0;
+#endif
+}
+
+/// -----------------------------------------------------------------------------
+/// Clock::OverheadNs
+/// -----------------------------------------------------------------------------
+/// Best of 1000: what a sample of an empty operation measures
+
+double bmk::Clock::OverheadNs() noexcept
+{
+    static const double overhead = [] {
+        std::uint64_t best = ~std::uint64_t(0);
+        for (int i = 0; i < 1000; ++i) {
+            const std::uint64_t start = Now();
+            const std::uint64_t end = Now();
+            best = (std::min)(best, end - start);
+        }
+        return ToNs(best);
+    }();
+    return overhead;
+}
+
+/// -----------------------------------------------------------------------------
+/// PinCurrentThread / UnpinCurrentThread
+/// -----------------------------------------------------------------------------
+/// Windows: the first 64 CPUs only (processor group of the process)
+
+bool bmk::PinCurrentThread(int cpu) noexcept
+{
+    if (cpu < 0) return false;
+
+#ifdef _WIN32
+    DWORD_PTR process, system;
+    if (!GetProcessAffinityMask(GetCurrentProcess(), &process, &system) || !process) return false;
+
+    int count = 0;
+    for (DWORD_PTR m = process; m; m &= m - 1) ++count;
+
+    int index = cpu % count;
+    for (DWORD_PTR m = process; m; m &= m - 1) {
+        if (index-- == 0) return SetThreadAffinityMask(GetCurrentThread(), m & (~m + 1)) != 0;
+    }
+    return false;
+#elif defined(__linux__)
+    const cpu_set_t& cpus = ProcessCpus();
+    const int count = CPU_COUNT(&cpus);
+    if (count == 0) return false;
+
+    int index = cpu % count;
+    for (int c = 0; c < CPU_SETSIZE; ++c) {
+        if (!CPU_ISSET(c, &cpus) || index-- != 0) continue;
+
+        cpu_set_t one;
+        CPU_ZERO(&one);
+        CPU_SET(c, &one);
+        return pthread_setaffinity_np(pthread_self(), sizeof(one), &one) == 0;
+    }
+    return false;
+#else
+    return false;
+#endif
+}
+
+void bmk::UnpinCurrentThread() noexcept
+{
+#ifdef _WIN32
+    DWORD_PTR process, system;
+    if (GetProcessAffinityMask(GetCurrentProcess(), &process, &system) && process)
+        SetThreadAffinityMask(GetCurrentThread(), process);
+#elif defined(__linux__)
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &ProcessCpus());
+#endif
+}
+
+/// -----------------------------------------------------------------------------
+/// Repetition::Find
+/// -----------------------------------------------------------------------------
+
+bmk::PhaseData& bmk::Repetition::Find(const char* phase, std::size_t ops)
+{
+    for (PhaseData& data : *m_phases) {
+        if (std::strcmp(data.Name, phase) == 0) return data;
+    }
+
+    m_phases->push_back(PhaseData{ phase, ops, {}, {} });
+    return m_phases->back();
+}
+
+/// -----------------------------------------------------------------------------
+/// Runner::Summarize
+/// -----------------------------------------------------------------------------
+/// Sorts the samples in place
+
+std::vector<bmk::PhaseStats> bmk::Runner::Summarize(std::vector<PhaseData>& phases)
+{
+    std::vector<PhaseStats> stats;
+    stats.reserve(phases.size());
+
+    for (PhaseData& data : phases) {
+        PhaseStats s{};
+        s.Name = data.Name;
+        s.Operations = data.Operations;
+        s.Repetitions = data.NsPerOp.size();
+
+        std::vector<double> sorted = data.NsPerOp;
+        std::sort(sorted.begin(), sorted.end());
+
+        const std::size_t n = sorted.size();
+        if (n) {
+            s.MedianNsPerOp = n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2.0;
+            s.MinNsPerOp = sorted.front();
+
+            double sum = 0.0;
+            for (double v : sorted) sum += v;
+            s.MeanNsPerOp = sum / static_cast<double>(n);
+
+            double squares = 0.0;
+            for (double v : sorted) squares += (v - s.MeanNsPerOp) * (v - s.MeanNsPerOp);
+            s.StddevNsPerOp = n > 1 ? std::sqrt(squares / static_cast<double>(n - 1)) : 0.0;
+        }
+
+        std::sort(data.Samples.begin(), data.Samples.end());
+        s.NumSamples = data.Samples.size();
+        if (s.NumSamples) {
+            s.P50Ns = Percentile(data.Samples, 0.50);
+            s.P99Ns = Percentile(data.Samples, 0.99);
+            s.P999Ns = Percentile(data.Samples, 0.999);
+            s.MaxNs = Percentile(data.Samples, 1.0);
+        }
+
+        stats.push_back(s);
+    }
+
+    return stats;
+}
+
+/// -----------------------------------------------------------------------------
+/// Runner::MedianOf
+/// -----------------------------------------------------------------------------
+
+std::chrono::nanoseconds bmk::Runner::MedianOf(std::vector<std::chrono::nanoseconds>& times)
+{
+    if (times.empty()) return std::chrono::nanoseconds(0);
+
+    std::sort(times.begin(), times.end());
+    const std::size_t n = times.size();
+    return n % 2 ? times[n / 2] : (times[n / 2 - 1] + times[n / 2]) / 2;
+}
+
+/// -----------------------------------------------------------------------------
+/// PrintStats
+/// -----------------------------------------------------------------------------
+
+void bmk::PrintStats(const char* title, const std::vector<PhaseStats>& phases)
+{
+    std::cout << title << '\n';
+
+    for (const PhaseStats& s : phases) {
+        char line[256];
+        std::snprintf(line, sizeof(line), "\t%-12s %10zu ops  %9.2f ns/op median  (mean %.2f, stddev %.2f, min %.2f, %zu runs)\n",
+            s.Name, s.Operations, s.MedianNsPerOp, s.MeanNsPerOp, s.StddevNsPerOp, s.MinNsPerOp, s.Repetitions);
+        std::cout << line;
+
+        if (s.NumSamples) {
+            std::snprintf(line, sizeof(line), "\t%-12s latency ns   p50 %.0f  p99 %.0f  p99.9 %.0f  max %.0f  (%zu samples)\n",
+                "", s.P50Ns, s.P99Ns, s.P999Ns, s.MaxNs, s.NumSamples);
+            std::cout << line;
+        }
+    }
+}
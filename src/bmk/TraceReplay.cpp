@@ -0,0 +1,80 @@
+#include <cstdio>
+#include <iostream>
+#include "bmk\TraceReplay.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#include <malloc.h>
+#elif defined(__linux__)
+#include <unistd.h>
+#include <malloc.h>
+#endif
+
+/// -----------------------------------------------------------------------------
+/// ResidentBytes
+/// -----------------------------------------------------------------------------
+/// Windows: working set. Linux: resident pages of /proc/self/statm
+
+std::size_t bmk::ResidentBytes() noexcept
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+    return counters.WorkingSetSize;
+#elif defined(__linux__)
+    std::FILE* file = std::fopen("/proc/self/statm", "r");
+    if (!file) return 0;
+
+    unsigned long long size = 0;
+    unsigned long long resident = 0;
+    const int read = std::fscanf(file, "%llu %llu", &size, &resident);
+    std::fclose(file);
+
+    if (read != 2) return 0;
+    return static_cast<std::size_t>(resident) * static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+#else
+    return 0;
+#endif
+}
+
+/// -----------------------------------------------------------------------------
+/// ReleaseFreeMemory
+/// -----------------------------------------------------------------------------
+
+void bmk::ReleaseFreeMemory() noexcept
+{
+#ifdef _WIN32
+    _heapmin();
+#elif defined(__GLIBC__)
+    malloc_trim(0);
+#endif
+}
+
+/// -----------------------------------------------------------------------------
+/// PrintReplay
+/// -----------------------------------------------------------------------------
+
+void bmk::PrintReplay(const char* title, const ReplayResults& results)
+{
+    const double ms = std::chrono::duration<double, std::milli>(results.Elapsed).count();
+
+    std::cout << title << '\n';
+    std::cout << "\tOperations:      " << results.Operations << '\n';
+    std::cout << "\tElapsed ms:      " << ms << '\n';
+    std::cout << "\tOps/sec:         " << (ms > 0.0 ? results.Operations * 1000.0 / ms : 0.0) << '\n';
+    std::cout << "\tPeak live bytes: " << results.PeakLiveBytes << '\n';
+    std::cout << "\tPeak footprint:  " << results.PeakFootprint << '\n';
+
+    std::cout << "\t  operation        live   footprint  fragmentation\n";
+    for (const ReplaySample& s : results.Samples)
+    {
+        char line[96];
+        std::snprintf(line, sizeof(line), "\t%11zu %11zu %11zu  %12.1f%%\n",
+            s.Operation, s.LiveBytes, s.Footprint, s.Fragmentation * 100.0);
+        std::cout << line;
+    }
+}
@@ -1,20 +1,43 @@
 #include "bmk\Benchmark.h"
 #include "mema\Alloc_typedef.h"
 #include "mema\CtmSOABackend.h"
+#include "mema\ThreadCacheBackend.h"
+#include "mema\InstanceBackend.h"
+#include "mema\MemoryResource.h"
+#include "mema\RecordingBackend.h"
+#include "bmk\TraceReplay.h"
+#include "SmallObjAllocator\HeapProfiler.h"
+#include "test\Test.h"
+#include <algorithm>
 #include <iostream>
+#include <thread>
+#include <type_traits>
 
-int main()
+int main(int argc, char** argv)
 {
 	constexpr std::size_t numOps = 4000000;
 
 	bmk::BmkAllocator<SystemBackend> sysAlloc;
 	bmk::BmkAllocator<mema::SOABackend> soaAlloc;
 	bmk::BmkAllocator<mema::CtmSOABackend> ctmAlloc;
+	bmk::BmkAllocator<mema::TcSOABackend> tcSoaAlloc;
+	bmk::BmkAllocator<mema::TcCtmSOABackend> tcCtmAlloc;
 
 	bmk::Benchmark bench(numOps);
 
 	std::size_t size = 16;
 
+#ifdef SOA_HARDENED
+	// overhead of the checks: compare with a build without SOA_HARDENED
+	std::cout << "(SOA_HARDENED build)\n\n";
+
+	// a layout change (stride, redzone, shadow) must not disable a check
+	if (!tst::TestHardened()) return 1;
+#endif
+
+	if (!tst::TestRetentionReleasesMemory()) return 1;
+	if (!tst::TestChunkEngines()) return 1;
+
 	std::cout << "=====SYSTEM ALLOCATOR=====";
 	//bench.BenchBulk(sysAlloc, size);
 	//bench.BenchSameOrder(sysAlloc, size);
@@ -26,12 +49,156 @@ int main()
 	//bench.BenchSameOrder(soaAlloc, size);
 	//bench.BenchReverseOrder(soaAlloc, size);
 	bench.BenchButterfly(soaAlloc, size);
+	bmk::Benchmark::PrintSnapshot("SmallObjAllocator snapshot:", soa::SmallObjAllocator::Instance().Snapshot());
 
 	std::cout << "\n\n=====CUSTOM SMALL OBJ ALLOCATOR=====";
 	//bench.BenchBulk(ctmAlloc, size);
 	//bench.BenchSameOrder(ctmAlloc, size);
 	//bench.BenchReverseOrder(ctmAlloc, size);
 	bench.BenchButterfly(ctmAlloc, size);
+	bmk::Benchmark::PrintSnapshot("CtmSmallObjAllocator snapshot:", soa::CtmSmallObjAllocator::Instance().Snapshot());
+
+	std::cout << "\n\n=====HEAP PROFILER=====";
+	soa::HeapProfiler::Instance().Start();
+	bench.BenchButterfly(soaAlloc, size);
+	soa::HeapProfiler::Instance().Stop();
+	soa::HeapProfiler::Instance().Clear();
+
+	std::cout << "\n\n=====BATCH=====";
+	bench.BenchBatch(soaAlloc, size, 256);
+	bench.BenchBatch(ctmAlloc, size, 256);
+
+	std::cout << "\n\n=====CHUNK ENGINES=====";
+	{
+		// one fixed allocator per engine, no size class dispatch
+		auto engine = [&](const char* name, auto& fixed) {
+			std::cout << "\n\n--- " << name << " ---";
+			bmk::BmkAllocator<mema::FixedInstanceBackend<std::remove_reference_t<decltype(fixed)>>> alloc(mema::FixedInstanceBackend{ fixed });
+			bench.BenchButterfly(alloc, size);
+			bench.BenchBatch(alloc, size, 256);
+			};
+
+		soa::BasicFixedAllocator<soa::Chunk8> fixed8(size);
+		soa::FixedAllocator fixed16(size);
+		soa::BasicFixedAllocator<soa::Chunk32> fixed32(size);
+		soa::BitmapFixedAllocator bitmapFixed(size);
+		soa::CtmFixedAllocator ctmFixed(size);
+		soa::BitmapCtmFixedAllocator bitmapCtmFixed(size);
+
+		engine("FixedAllocator Chunk8", fixed8);
+		engine("FixedAllocator Chunk16", fixed16);
+		engine("FixedAllocator Chunk32", fixed32);
+		engine("FixedAllocator BitmapChunk", bitmapFixed);
+		engine("CtmFixedAllocator Chunk16", ctmFixed);
+		engine("CtmFixedAllocator BitmapChunk", bitmapCtmFixed);
+	}
+
+	std::cout << "\n\n=====STATIC FIXED ALLOCATOR=====";
+	bench.BenchStaticFixed<8>();
+	bench.BenchStaticFixed<16>();
+	bench.BenchStaticFixed<24>();
+	bench.BenchStaticFixed<32>();
+	bench.BenchStaticFixed<40>();
+	bench.BenchStaticFixed<48>();
+	bench.BenchStaticFixed<56>();
+	bench.BenchStaticFixed<64>();
+
+	std::cout << "\n\n=====ARENA RESET=====";
+	{
+		soa::SmallObjAllocator arena(soa::DEFAULT_CHUNK_SIZE, soa::DEFAULT_MAX_OBJ_SIZE);
+		soa::CtmSmallObjAllocator ctmArena(soa::DEFAULT_CHUNK_SIZE, soa::DEFAULT_MAX_OBJ_SIZE);
+		bmk::BmkAllocator<mema::SOAInstanceBackend> arenaAlloc(mema::SOAInstanceBackend{ arena });
+		bmk::BmkAllocator<mema::CtmSOAInstanceBackend> ctmArenaAlloc(mema::CtmSOAInstanceBackend{ ctmArena });
+
+		bench.BenchReset(arenaAlloc, size, 4096);
+		bench.BenchReset(ctmArenaAlloc, size, 4096);
+	}
+
+	std::cout << "\n\n=====PMR RESOURCES=====";
+	{
+		std::pmr::unsynchronized_pool_resource pool;
+		mema::SoaResource soaResource;
+		mema::CtmSoaResource ctmResource;
+		std::pmr::unsynchronized_pool_resource soaPool(&soaResource);
+
+		const std::size_t pmrOps = numOps / 4;
+		bmk::Benchmark pmrBench(pmrOps);
+
+		pmrBench.BenchPmrNodes("new_delete_resource", *std::pmr::new_delete_resource());
+		pmrBench.BenchPmrNodes("unsynchronized_pool_resource", pool);
+		pmrBench.BenchPmrNodes("SoaResource", soaResource);
+		pmrBench.BenchPmrNodes("CtmSoaResource", ctmResource);
+		pmrBench.BenchPmrNodes("unsynchronized_pool_resource(SoaResource)", soaPool);
+	}
+
+	std::cout << "\n\n=====THREAD CACHED CUSTOM SMALL OBJ ALLOCATOR=====";
+	for (std::size_t threads = 1; threads <= 4; threads *= 2)
+	{
+		//bench.BenchButterflyThreads(sysAlloc, size, threads);
+		bench.BenchButterflyThreads(tcCtmAlloc, size, threads);
+	}
+
+	std::cout << "\n\n=====MULTI-THREADED SCALING=====";
+	{
+		// thread safe backends only
+		const std::size_t maxThreads = (std::max)(1u, std::thread::hardware_concurrency());
+		bmk::Benchmark mtBench(numOps / 4);
+
+		auto scaling = [&](const char* name, auto& allocator) {
+			std::cout << "\n\n--- " << name << " ---";
+			mtBench.BenchChurnThreads(allocator, 8, 64, maxThreads);
+			mtBench.BenchProducerConsumer(allocator, size, maxThreads);
+			mtBench.BenchLarson(allocator, 8, 64, maxThreads);
+			mtBench.BenchSharedContainer(allocator, maxThreads);
+			};
+
+		scaling("SystemBackend", sysAlloc);
+		scaling("TcSOABackend", tcSoaAlloc);
+		scaling("TcCtmSOABackend", tcCtmAlloc);
+	}
+
+	std::cout << "\n\n=====TRACE REPLAY=====";
+	{
+		// a trace given on the command line (e.g. recorded in production with
+		// mema::RecordingBackend), otherwise the pmr node workload recorded here
+		const char* tracePath = argc > 1 ? argv[1] : "alloc_trace.bin";
+		if (argc <= 1)
+		{
+			mema::TraceWriter writer;
+			if (writer.Open(tracePath))
+			{
+				mema::BackendResource<mema::RecordingBackend<SystemBackend>> recording(mema::RecordingBackend<SystemBackend>{ writer });
+				bmk::Benchmark(numOps / 16).BenchPmrNodes("recorded", recording);
+				writer.Close();
+			}
+		}
+
+		mema::TraceReader trace;
+		if (trace.Open(tracePath))
+		{
+			std::cout << "\n" << tracePath << ": " << trace.GetNumRecords() << " records, "
+				<< trace.GetHeader().m_numThreads << " thread(s)\n";
+
+			// size classes created by the worker threads of the benchmarks
+			// are trimmed under the lock of the thread caches
+			auto trimCtm = [] {
+				soa::ThreadCache<soa::CtmSmallObjAllocator>::SerializedLock lock;
+				soa::CtmSmallObjAllocator::Instance().Trim();
+				};
+
+			bmk::PrintReplay("Replay SystemBackend:", bmk::ReplayTrace(sysAlloc, trace));
+			// empty chunks of the earlier benchmarks would hide the growth
+			soa::SmallObjAllocator::Instance().Trim();
+			trimCtm();
+
+			bmk::PrintReplay("Replay SOABackend:", bmk::ReplayTrace(soaAlloc, trace));
+			soa::SmallObjAllocator::Instance().Trim();
+			bmk::PrintReplay("Replay CtmSOABackend:", bmk::ReplayTrace(ctmAlloc, trace));
+			trimCtm();
+			bmk::PrintReplay("Replay TcCtmSOABackend:", bmk::ReplayTrace(tcCtmAlloc, trace));
+		}
+		else std::cout << "\ncan't read the trace " << tracePath << '\n';
+	}
 
 	return 0;
 }
\ No newline at end of file
@@ -0,0 +1,400 @@
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <new>
+#include "mema\AllocationTrace.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+    unsigned Log2(std::size_t alignment) noexcept
+    {
+        unsigned log2 = 0;
+        while ((std::size_t(1) << log2) < alignment) ++log2;
+        return log2;
+    }
+}
+
+/// -----------------------------------------------------------------------------
+/// TraceWriter::Open
+/// -----------------------------------------------------------------------------
+
+bool mema::TraceWriter::Open(const char* path)
+{
+    Close();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return false;
+    m_file = file;
+#else
+    m_fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (m_fd < 0) return false;
+#endif
+
+    m_ids.clear();
+    m_threads.clear();
+    m_numRecords = 0;
+    m_nextId = 0;
+    m_numUntracked = 0;
+    m_numDropped = 0;
+
+    if (!MapWindow(0))
+    {
+#ifdef _WIN32
+        CloseHandle(m_file);
+        m_file = nullptr;
+#else
+        close(m_fd);
+        m_fd = -1;
+#endif
+        return false;
+    }
+
+    m_cursor = m_window + TRACE_HEADER_SIZE;
+    m_open = true;
+    return true;
+}
+
+/// -----------------------------------------------------------------------------
+/// TraceWriter::Close
+/// -----------------------------------------------------------------------------
+/// The valid part of the file is the header slot and m_numRecords records:
+/// the rest of the last window is cut off
+
+bool mema::TraceWriter::Close() noexcept
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (!m_open) return false;
+    m_open = false;
+
+    UnmapWindow();
+
+    TraceHeader header{};
+    std::memcpy(header.m_magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    header.m_version = TRACE_VERSION;
+    header.m_numThreads = static_cast<std::uint32_t>(m_threads.size());
+    header.m_numRecords = m_numRecords;
+    header.m_numIds = m_nextId;
+    header.m_numUntracked = m_numUntracked;
+    header.m_numDropped = m_numDropped;
+
+    const std::uint64_t used = TRACE_HEADER_SIZE + m_numRecords * sizeof(TraceRecord);
+
+#ifdef _WIN32
+    LARGE_INTEGER position;
+    position.QuadPart = static_cast<LONGLONG>(used);
+    bool ok = SetFilePointerEx(m_file, position, nullptr, FILE_BEGIN) && SetEndOfFile(m_file);
+
+    position.QuadPart = 0;
+    DWORD written = 0;
+    ok = SetFilePointerEx(m_file, position, nullptr, FILE_BEGIN)
+        && WriteFile(m_file, &header, sizeof(header), &written, nullptr)
+        && written == sizeof(header) && ok;
+
+    CloseHandle(m_file);
+    m_file = nullptr;
+#else
+    bool ok = ftruncate(m_fd, static_cast<off_t>(used)) == 0;
+    ok = pwrite(m_fd, &header, sizeof(header), 0) == static_cast<ssize_t>(sizeof(header)) && ok;
+
+    close(m_fd);
+    m_fd = -1;
+#endif
+
+    m_ids.clear();
+    m_threads.clear();
+    return ok;
+}
+
+/// -----------------------------------------------------------------------------
+/// TraceWriter::RecordAllocate
+/// -----------------------------------------------------------------------------
+/// An address still live (its free wasn't seen) gets the new id
+
+void mema::TraceWriter::RecordAllocate(const void* p, std::size_t size, std::size_t alignment) noexcept
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (!m_open) return;
+
+    if (!m_window || m_nextId == (std::numeric_limits<std::uint32_t>::max)())
+    {
+        ++m_numDropped;
+        return;
+    }
+
+    const std::uint32_t id = m_nextId;
+
+    try
+    {
+        m_ids[p] = id;
+    }
+    catch (const std::bad_alloc&)
+    {
+        ++m_numDropped;
+        return;
+    }
+
+    ++m_nextId;
+    Append(size, alignment, alignment ? TraceOp::AllocateAligned : TraceOp::Allocate, id);
+}
+
+/// -----------------------------------------------------------------------------
+/// TraceWriter::RecordFree
+/// -----------------------------------------------------------------------------
+
+void mema::TraceWriter::RecordFree(const void* p, std::size_t size, std::size_t alignment) noexcept
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (!m_open) return;
+
+    auto it = m_ids.find(p);
+    if (it == m_ids.end())
+    {
+        ++m_numUntracked;
+        return;
+    }
+
+    const std::uint32_t id = it->second;
+    m_ids.erase(it);
+
+    if (!m_window)
+    {
+        ++m_numDropped;
+        return;
+    }
+
+    Append(size, alignment, alignment ? TraceOp::FreeAligned : TraceOp::Free, id);
+}
+
+/// -----------------------------------------------------------------------------
+/// TraceWriter::GetNumRecords / GetNumUntracked / GetNumDropped
+/// -----------------------------------------------------------------------------
+
+std::uint64_t mema::TraceWriter::GetNumRecords() const noexcept
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_numRecords;
+}
+
+std::uint64_t mema::TraceWriter::GetNumUntracked() const noexcept
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_numUntracked;
+}
+
+std::uint64_t mema::TraceWriter::GetNumDropped() const noexcept
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_numDropped;
+}
+
+/// -----------------------------------------------------------------------------
+/// TraceWriter::Append
+/// -----------------------------------------------------------------------------
+/// Requires the lock and a window. Moves the window when it is full: if the
+/// file can't grow, this record and the next ones are dropped.
+
+void mema::TraceWriter::Append(std::size_t size, std::size_t alignment, TraceOp op, std::uint32_t id) noexcept
+{
+    if (m_cursor == m_window + TRACE_WINDOW_SIZE)
+    {
+        const std::uint64_t next = m_windowOffset + TRACE_WINDOW_SIZE;
+        UnmapWindow();
+        if (!MapWindow(next))
+        {
+            ++m_numDropped;
+            return;
+        }
+        m_cursor = m_window;
+    }
+
+    std::uint16_t thread;
+    try
+    {
+        // past 65535 threads the last index is shared
+        const std::size_t next = (std::min)(m_threads.size(), std::size_t((std::numeric_limits<std::uint16_t>::max)()));
+        auto [it, inserted] = m_threads.try_emplace(std::this_thread::get_id(), static_cast<std::uint16_t>(next));
+        thread = it->second;
+    }
+    catch (const std::bad_alloc&)
+    {
+        thread = (std::numeric_limits<std::uint16_t>::max)();
+    }
+
+    TraceRecord record{};
+    record.m_size = size;
+    record.m_id = id;
+    record.m_thread = thread;
+    record.m_op = op;
+    record.m_alignmentLog2 = static_cast<std::uint8_t>(alignment ? Log2(alignment) : 0);
+
+    std::memcpy(m_cursor, &record, sizeof(record));
+    m_cursor += sizeof(record);
+    ++m_numRecords;
+}
+
+/// -----------------------------------------------------------------------------
+/// TraceWriter::MapWindow / UnmapWindow
+/// -----------------------------------------------------------------------------
+/// Grows the file to the end of the window first
+
+bool mema::TraceWriter::MapWindow(std::uint64_t offset) noexcept
+{
+    const std::uint64_t fileSize = offset + TRACE_WINDOW_SIZE;
+
+#ifdef _WIN32
+    // a mapping can't outgrow its size: a new one per window
+    HANDLE mapping = CreateFileMappingA(m_file, nullptr, PAGE_READWRITE,
+        static_cast<DWORD>(fileSize >> 32), static_cast<DWORD>(fileSize), nullptr);
+    if (!mapping) return false;
+
+    void* window = MapViewOfFile(mapping, FILE_MAP_WRITE,
+        static_cast<DWORD>(offset >> 32), static_cast<DWORD>(offset), TRACE_WINDOW_SIZE);
+    if (!window)
+    {
+        CloseHandle(mapping);
+        return false;
+    }
+
+    m_mapping = mapping;
+#else
+    if (ftruncate(m_fd, static_cast<off_t>(fileSize)) != 0) return false;
+
+    void* window = mmap(nullptr, TRACE_WINDOW_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, static_cast<off_t>(offset));
+    if (window == MAP_FAILED) return false;
+#endif
+
+    m_window = static_cast<unsigned char*>(window);
+    m_windowOffset = offset;
+    return true;
+}
+
+void mema::TraceWriter::UnmapWindow() noexcept
+{
+    if (!m_window) return;
+
+#ifdef _WIN32
+    UnmapViewOfFile(m_window);
+    CloseHandle(m_mapping);
+    m_mapping = nullptr;
+#else
+    munmap(m_window, TRACE_WINDOW_SIZE);
+#endif
+
+    m_window = nullptr;
+    m_cursor = nullptr;
+}
+
+/// -----------------------------------------------------------------------------
+/// TraceReader::Open
+/// -----------------------------------------------------------------------------
+
+bool mema::TraceReader::Open(const char* path)
+{
+    Close();
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return false;
+    m_file = file;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || static_cast<std::uint64_t>(size.QuadPart) < TRACE_HEADER_SIZE)
+    {
+        Close();
+        return false;
+    }
+    m_size = static_cast<std::size_t>(size.QuadPart);
+
+    m_mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!m_mapping)
+    {
+        Close();
+        return false;
+    }
+
+    m_data = static_cast<const unsigned char*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+#else
+    m_fd = open(path, O_RDONLY);
+    if (m_fd < 0) return false;
+
+    struct stat info;
+    if (fstat(m_fd, &info) != 0 || static_cast<std::uint64_t>(info.st_size) < TRACE_HEADER_SIZE)
+    {
+        Close();
+        return false;
+    }
+    m_size = static_cast<std::size_t>(info.st_size);
+
+    void* data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+    if (data != MAP_FAILED) m_data = static_cast<const unsigned char*>(data);
+#endif
+
+    if (!m_data || !Validate())
+    {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+/// -----------------------------------------------------------------------------
+/// TraceReader::Close
+/// -----------------------------------------------------------------------------
+
+void mema::TraceReader::Close() noexcept
+{
+#ifdef _WIN32
+    if (m_data) UnmapViewOfFile(m_data);
+    if (m_mapping) CloseHandle(m_mapping);
+    if (m_file) CloseHandle(m_file);
+    m_mapping = nullptr;
+    m_file = nullptr;
+#else
+    if (m_data) munmap(const_cast<unsigned char*>(m_data), m_size);
+    if (m_fd >= 0) close(m_fd);
+    m_fd = -1;
+#endif
+
+    m_data = nullptr;
+    m_size = 0;
+}
+
+/// -----------------------------------------------------------------------------
+/// TraceReader::Validate
+/// -----------------------------------------------------------------------------
+/// The replay indexes its table with the ids unchecked
+
+bool mema::TraceReader::Validate() const noexcept
+{
+    const TraceHeader& header = GetHeader();
+
+    if (std::memcmp(header.m_magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0) return false;
+    if (header.m_version != TRACE_VERSION) return false;
+    if (header.m_numRecords > (m_size - TRACE_HEADER_SIZE) / sizeof(TraceRecord)) return false;
+
+    for (const TraceRecord& record : *this)
+    {
+        if (record.m_id >= header.m_numIds) return false;
+        if (record.m_op > TraceOp::FreeAligned) return false;
+        if (record.m_alignmentLog2 >= sizeof(std::size_t) * 8) return false;
+    }
+    return true;
+}
@@ -1,7 +1,17 @@
 #include "test/Test.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
 #include <vector>
 #include <iostream>
+#include <thread>
 #include <mema\Alloc_typedef.h>
+#include "CustomSmallObjAllocator\CtmFixedAllocator.h"
+#include "CustomSmallObjAllocator\CtmSmallObjAllocator.h"
+#include "SmallObjAllocator\FixedAllocator.h"
+#include "SmallObjAllocator\Hardened.h"
+#include "bmk\TraceReplay.h"
 
 void tst::TestAllocatorsWithVector()
 {
@@ -20,3 +30,238 @@ void tst::TestAllocatorsWithVector()
 		vec_soa.push_back(i);
 	}
 }
+
+/// A spike of 64 MB of blocks, then every block is freed: the empty chunks
+/// past the watermarks are released, and the provider decommits them past
+/// its cache bound. The resident memory must fall back near the baseline
+/// (at most a quarter of the spike left).
+/// Windows: MEM_RESET pages leave the working set only when the OS trims
+/// it, the check is skipped.
+
+bool tst::TestRetentionReleasesMemory()
+{
+	std::cout << "\n\n=====Testing Retention Releases Memory=====\n";
+
+#ifdef _WIN32
+	std::cout << "skipped (working set not trimmed by MEM_RESET)\n";
+	return true;
+#else
+	constexpr std::size_t numBlocks = 1024 * 1024;
+	constexpr std::size_t blockSize = 64;
+
+	soa::VirtualPageProvider provider; // outlives the allocator
+	bool ok = true;
+
+	{
+		soa::CtmSmallObjAllocator allocator(soa::DEFAULT_CHUNK_SIZE, soa::DEFAULT_MAX_OBJ_SIZE,
+			soa::DEFAULT_CTM_CHUNK_LOOKUP, &provider);
+
+		std::vector<void*> blocks(numBlocks);
+		const std::size_t baseline = bmk::ResidentBytes();
+
+		for (void*& p : blocks) p = allocator.Allocate(blockSize);
+		const std::size_t peak = bmk::ResidentBytes();
+
+		for (void* p : blocks) allocator.Deallocate(p, blockSize);
+		const std::size_t after = bmk::ResidentBytes();
+
+		const std::size_t spike = peak > baseline ? peak - baseline : 0;
+		const std::size_t left = after > baseline ? after - baseline : 0;
+
+		ok = left <= spike / 4;
+		std::cout << (ok ? "ok     " : "FAILED ") << "resident after the frees, no Trim: "
+			<< left / 1024 << " KB of a " << spike / 1024 << " KB spike"
+			<< " (provider cache " << provider.GetCommittedFreeBytes() / 1024 << " KB)\n";
+	}
+
+	return ok;
+#endif
+}
+
+namespace {
+
+	// every block distinct and at least blockSize apart
+	bool Disjoint(std::vector<void*> blocks, std::size_t blockSize)
+	{
+		std::sort(blocks.begin(), blocks.end());
+		for (std::size_t i = 1; i < blocks.size(); ++i)
+			if (static_cast<char*>(blocks[i]) - static_cast<char*>(blocks[i - 1]) < static_cast<std::ptrdiff_t>(blockSize))
+				return false;
+		return true;
+	}
+
+	/// One engine: blocks one by one until a second chunk is needed (the
+	/// first one is full), the first chunk emptied, then the same blocks
+	/// again by batches. Nothing is released (high = low = SIZE_MAX) until
+	/// the Trim at the end, that must free every chunk.
+	template<typename Fixed, typename... Args>
+	bool TestEngine(const std::string& name, Args&&... args)
+	{
+		constexpr std::size_t blockSize = 16;
+		constexpr std::size_t numChunks = 4;
+
+		Fixed fixed(std::forward<Args>(args)...);
+		fixed.SetRetentionPolicy(soa::RetentionPolicy{ SIZE_MAX, SIZE_MAX });
+
+		bool ok = true;
+		auto check = [&](bool condition, const char* what) {
+			if (!condition) std::cout << "FAILED " << name << ": " << what << '\n';
+			ok &= condition;
+			};
+
+		// full: the block past the first chunk opens a second one
+		std::vector<void*> blocks;
+		while (fixed.GetStats().m_chunks < 2) blocks.push_back(fixed.Allocate());
+		const std::size_t perChunk = blocks.size() - 1;
+		check(perChunk > 0 && fixed.GetStats().m_emptyChunks == 0, "first chunk full");
+
+		while (blocks.size() < numChunks * perChunk) blocks.push_back(fixed.Allocate());
+		check(Disjoint(blocks, blockSize), "no duplicate blocks");
+		check(fixed.GetStats().m_chunks == numChunks && fixed.GetStats().m_liveBlocks == blocks.size(), "chunks full");
+
+		// empty: the first chunk back, the others still full
+		for (std::size_t i = 0; i < perChunk; ++i) fixed.Deallocate(blocks[i]);
+		check(fixed.GetStats().m_emptyChunks == 1, "first chunk empty");
+		for (std::size_t i = perChunk; i < blocks.size(); ++i) fixed.Deallocate(blocks[i]);
+		check(fixed.GetStats().m_emptyChunks == numChunks && fixed.GetStats().m_liveBlocks == 0, "every chunk empty");
+
+		// batches of odd sizes, across chunk boundaries, on top of one by one blocks
+		std::vector<void*> batched(blocks.size());
+		std::size_t n = 0;
+		for (std::size_t batch = 1; n < batched.size(); batch += 37)
+		{
+			const std::size_t count = (std::min)(batch, batched.size() - n);
+			const std::size_t got = fixed.AllocateBatch(count, batched.data() + n);
+			check(got == count, "whole batch");
+			if (got != count) break;
+			n += got;
+			if (n < batched.size()) batched[n++] = fixed.Allocate();
+		}
+		check(Disjoint(batched, blockSize), "no duplicate blocks in batches");
+		check(fixed.GetStats().m_chunks == numChunks && fixed.GetStats().m_emptyChunks == 0, "same chunks reused");
+
+		for (std::size_t i = 0; i < n; i += 64)
+			fixed.DeallocateBatch((std::min)(std::size_t(64), n - i), batched.data() + i);
+		check(fixed.GetStats().m_emptyChunks == numChunks && fixed.GetStats().m_liveBlocks == 0, "batches given back");
+
+		check(fixed.Trim() == numChunks && fixed.GetStats().m_chunks == 0, "Trim frees every chunk");
+
+		if (ok) std::cout << "ok     " << name << " (" << perChunk << " blocks per chunk)\n";
+		return ok;
+	}
+}
+
+/// Every chunk engine behind both fixed allocators, see TestEngine.
+
+bool tst::TestChunkEngines()
+{
+	std::cout << "\n\n=====Testing Chunk Engines=====\n";
+
+	constexpr std::size_t blockSize = 16;
+	bool ok = true;
+
+	ok &= TestEngine<soa::BasicFixedAllocator<soa::Chunk8>>("FixedAllocator Chunk8", blockSize);
+	ok &= TestEngine<soa::BasicFixedAllocator<soa::Chunk16>>("FixedAllocator Chunk16", blockSize);
+	ok &= TestEngine<soa::BasicFixedAllocator<soa::Chunk32>>("FixedAllocator Chunk32", blockSize);
+	ok &= TestEngine<soa::BitmapFixedAllocator>("FixedAllocator BitmapChunk", blockSize);
+
+	for (soa::CtmChunkLookup lookup : { soa::CtmChunkLookup::Map, soa::CtmChunkLookup::Aligned })
+	{
+		const std::string mode = lookup == soa::CtmChunkLookup::Map ? " (Map)" : " (Aligned)";
+		ok &= TestEngine<soa::BasicCtmFixedAllocator<soa::Chunk8>>("CtmFixedAllocator Chunk8" + mode, blockSize, soa::DEFAULT_CHUNK_SIZE, lookup);
+		ok &= TestEngine<soa::BasicCtmFixedAllocator<soa::Chunk16>>("CtmFixedAllocator Chunk16" + mode, blockSize, soa::DEFAULT_CHUNK_SIZE, lookup);
+		ok &= TestEngine<soa::BasicCtmFixedAllocator<soa::Chunk32>>("CtmFixedAllocator Chunk32" + mode, blockSize, soa::DEFAULT_CHUNK_SIZE, lookup);
+		ok &= TestEngine<soa::BitmapCtmFixedAllocator>("CtmFixedAllocator BitmapChunk" + mode, blockSize, soa::DEFAULT_CHUNK_SIZE, lookup);
+	}
+
+	return ok;
+}
+
+#ifdef SOA_HARDENED
+
+namespace {
+
+	// reports by HardenedError, written by the handler (remote frees: before the join)
+	std::size_t s_reports[static_cast<std::size_t>(soa::HardenedError::CorruptFreeList) + 1]{};
+
+	void CountingHandler(const soa::HardenedReport& report)
+	{
+		++s_reports[static_cast<std::size_t>(report.m_error)];
+	}
+
+	// exactly one report since the last check, of the expected error
+	bool Expect(const char* misuse, soa::HardenedError error)
+	{
+		std::size_t total = 0;
+		for (std::size_t count : s_reports) total += count;
+
+		const bool ok = total == 1 && s_reports[static_cast<std::size_t>(error)] == 1;
+		std::cout << (ok ? "ok     " : "FAILED ") << misuse << " (" << soa::ToString(error) << ")\n";
+
+		std::fill(std::begin(s_reports), std::end(s_reports), 0);
+		return ok;
+	}
+}
+
+/// One misuse per detection path, each must be reported once. The handler
+/// returns, so every bad free is skipped and the test goes on: the blocks
+/// are freed properly afterwards, the allocators end empty.
+
+bool tst::TestHardened()
+{
+	std::cout << "\n\n=====Testing Hardened Mode=====\n";
+
+	const soa::HardenedHandler previous = soa::SetHardenedHandler(&CountingHandler);
+	bool ok = true;
+
+	{
+		soa::CtmFixedAllocator fixed24(24);
+		soa::CtmFixedAllocator fixed32(32);
+		unsigned char* keep = static_cast<unsigned char*>(fixed24.Allocate()); // chunk stays in use
+
+		// occupancy shadow
+		void* p = fixed24.Allocate();
+		fixed24.Deallocate(p);
+		fixed24.Deallocate(p);
+		ok &= Expect("double free", soa::HardenedError::DoubleFree);
+
+		// PageMap ownership
+		p = fixed24.Allocate();
+		fixed32.Deallocate(p);
+		ok &= Expect("free into another size class", soa::HardenedError::WrongSizeClass);
+		fixed24.Deallocate(p);
+
+		unsigned char local[64]{};
+		fixed24.Deallocate(local);
+		ok &= Expect("free of a pointer not allocated here", soa::HardenedError::ForeignPointer);
+
+		// redzone canary, the block is freed anyway
+		unsigned char* block = static_cast<unsigned char*>(fixed24.Allocate());
+		block[24] = 0;
+		fixed24.Deallocate(block);
+		ok &= Expect("write past the end", soa::HardenedError::Overflow);
+
+		// poison, checked when the block is handed out again (last freed, first reused)
+		block = static_cast<unsigned char*>(fixed24.Allocate());
+		fixed24.Deallocate(block);
+		block[8] = 0;
+		void* again = fixed24.Allocate();
+		ok &= Expect("write after free", soa::HardenedError::WriteAfterFree);
+		fixed24.Deallocate(again);
+
+		// redzone mark of a block waiting on the remote list of the owner
+		p = fixed24.Allocate();
+		std::thread([&] {
+			fixed24.Deallocate(p);
+			fixed24.Deallocate(p);
+			}).join();
+		ok &= Expect("double free from another thread", soa::HardenedError::DoubleFree);
+
+		fixed24.Deallocate(keep); // drains the remote free as well
+	}
+
+	soa::SetHardenedHandler(previous);
+	return ok;
+}
+
+#endif